@@ -0,0 +1,846 @@
+#include <stdlib.h>
+#include <string.h>
+#include "bletemp.h"
+#include "temp_codec.h"
+#include "temp_sampler.h"
+
+/* Per-connection state */
+struct bletemp_conn {
+    uint16_t conn_handle;
+    uint16_t mtu;
+    uint8_t notify;       /* temperature client configuration, BLETEMP_SUB_* */
+    uint8_t hist_notify;  /* history client configuration */
+    uint32_t hist_cursor; /* next history sample to send */
+    uint8_t hist_batch;   /* samples in the last full history batch */
+    uint8_t hist_flush;   /* the catch-up after subscribing is not complete */
+    uint8_t sent;         /* a sample was notified since subscribing */
+    uint8_t dropped;      /* the transport refused the last temperature notification */
+    int16_t sent_temp;    /* Celsius value of the last notified sample */
+    uint32_t sent_ms;     /* and its timestamp */
+    uint16_t itvl;        /* connection interval in use, 1.25 ms units */
+    uint16_t latency;     /* slave latency in use */
+    uint16_t timeout;     /* supervision timeout, 10 ms units */
+    uint8_t tx_phy;       /* BLETEMP_PHY_* */
+    uint8_t rx_phy;
+    uint16_t tx_octets;   /* LL payload lengths */
+    uint16_t rx_octets;
+    struct bletemp_conn_params requested; /* last request, itvl_max 0 if none */
+    uint32_t window_ms;   /* start of the notification count window */
+    uint16_t window_sent; /* notifications sent in the window */
+    uint8_t ind_chr;      /* indication awaiting confirmation, BLETEMP_CHR_COUNT if none */
+    uint32_t ind_ms;      /* and when the stack accepted it */
+};
+
+/* Connected centrals; guarded by the port lock */
+static struct bletemp_conn conns[BLETEMP_MAX_CONN];
+
+static const struct bletemp_transport *transport;
+static uint8_t unit = 'C';
+static uint16_t interval_ms = BLETEMP_INTERVAL_DEFAULT_MS;
+static deadband_struct deadband;
+
+static struct bletemp_conn *
+bletemp_conn_find(uint16_t conn_handle)
+{
+    int i;
+
+    for (i = 0; i < BLETEMP_MAX_CONN; i++) {
+        if (conns[i].conn_handle == conn_handle) {
+            return &conns[i];
+        }
+    }
+    return NULL;
+}
+
+int
+bletemp_init(const struct bletemp_transport *t)
+{
+    int i;
+
+    bletemp_port_init();
+
+    bletemp_port_lock();
+    transport = t;
+    unit = 'C';
+    interval_ms = BLETEMP_INTERVAL_DEFAULT_MS;
+    memset(&deadband, 0, sizeof(deadband));
+    bletemp_rtt_reset();
+    bletemp_adv_reset();
+    for (i = 0; i < BLETEMP_MAX_CONN; i++) {
+        conns[i].conn_handle = BLETEMP_CONN_NONE;
+    }
+    bletemp_port_unlock();
+
+    return 0;
+}
+
+/* Latest sample and its value in the active unit; false before the first one */
+static bool
+bletemp_latest(temp_sample *sample, temp_struct *value)
+{
+    value->temperature = 0;
+    value->unit = unit;
+
+    /* a lock-free read that never waits on the sampler */
+    if (!temp_history_latest(sample)) {
+        return false;
+    }
+    value->temperature = temp_convert(sample->temperature, value->unit);
+    return true;
+}
+
+temp_struct
+bletemp_get_temp(void)
+{
+    temp_struct value;
+    temp_sample sample;
+
+    bletemp_latest(&sample, &value);
+    return value;
+}
+
+uint8_t
+bletemp_unit(void)
+{
+    return unit;
+}
+
+uint16_t
+bletemp_interval(void)
+{
+    return interval_ms;
+}
+
+/*
+ * Sends a value the way the central configured chr. ATT allows a single
+ * indication in flight per connection, so while one awaits its
+ * confirmation the next is refused like a full stack refuses it, and the
+ * confirmation resumes what was held back. Port lock must be held.
+ */
+static int
+bletemp_send(struct bletemp_conn *conn, enum bletemp_chr chr, uint8_t cfg,
+             const uint8_t *data, uint16_t len)
+{
+    int rc;
+
+    if (!(cfg & BLETEMP_SUB_INDICATE) || transport->indicate == NULL) {
+        return transport->notify(conn->conn_handle, chr, data, len);
+    }
+    if (conn->ind_chr != BLETEMP_CHR_COUNT) {
+        return -1;
+    }
+    rc = transport->indicate(conn->conn_handle, chr, data, len);
+    if (rc == 0) {
+        conn->ind_chr = chr;
+        conn->ind_ms = bletemp_port_time_ms();
+    }
+    return rc;
+}
+
+/* Sends value to one connection and remembers the sample it came from */
+static int
+bletemp_notify_temp(struct bletemp_conn *conn, const temp_struct *value,
+                    const temp_sample *sample)
+{
+    int rc;
+
+    rc = bletemp_send(conn, BLETEMP_CHR_TEMP, conn->notify,
+                      (const uint8_t *)value, sizeof(*value));
+    /* a refused sample is not queued, bletemp_resume() sends the latest instead */
+    conn->dropped = (rc != 0);
+    if (rc == 0) {
+        conn->window_sent++;
+    }
+    if (rc == 0 && sample != NULL) {
+        conn->sent = 1;
+        conn->sent_temp = sample->temperature;
+        conn->sent_ms = sample->timestamp;
+    }
+    return rc;
+}
+
+/*
+ * With a deadband set, a sample is only worth notifying once it moved past
+ * the threshold from the last one sent or the heartbeat is due.
+ */
+static bool
+bletemp_deadband_due(const struct bletemp_conn *conn, const temp_sample *sample)
+{
+    if (deadband.threshold == 0 || !conn->sent) {
+        return true;
+    }
+    if (abs(sample->temperature - conn->sent_temp) > deadband.threshold) {
+        return true;
+    }
+    return deadband.heartbeat != 0 &&
+           sample->timestamp - conn->sent_ms >= deadband.heartbeat * 1000u;
+}
+
+/*
+ * Sends the history pending for one connection as MTU-sized batches. Only
+ * full batches are sent unless flush is set or a catch-up was cut short;
+ * how many samples make one depends on how well they compress. Port lock
+ * must be held.
+ */
+static int
+bletemp_send_history(struct bletemp_conn *conn, bool flush)
+{
+    static uint8_t buf[TEMP_HISTORY_MAX_PAYLOAD];
+    uint32_t pending, cursor;
+    uint16_t batch, len;
+    uint8_t count;
+    int rc;
+
+    batch = temp_history_batch_size(conn->mtu - 3);
+    flush = flush || conn->hist_flush;
+    while (conn->hist_notify) {
+        pending = temp_history_pending(conn->hist_cursor);
+        if (pending == 0) {
+            conn->hist_flush = 0;
+            break;
+        }
+        if (!flush && pending < batch) {
+            break;
+        }
+
+        cursor = conn->hist_cursor;
+        len = temp_history_encode(&cursor, unit, buf, conn->mtu - 3);
+        if (len == 0) {
+            conn->hist_cursor = cursor;
+            break;
+        }
+        count = ((temp_codec_hdr *)buf)->count;
+        if (cursor < temp_history_head() || count == UINT8_MAX) {
+            /* stopped short of the newest sample, so the batch is full */
+            conn->hist_batch = count;
+        } else if (!flush) {
+            break;
+        }
+
+        rc = bletemp_send(conn, BLETEMP_CHR_HIST, conn->hist_notify, buf, len);
+        if (rc != 0) {
+            /* keep the cursor, the batch is retried on the next publish */
+            return rc;
+        }
+        conn->hist_cursor = cursor;
+        conn->window_sent++;
+    }
+    return 0;
+}
+
+static int
+bletemp_subscribers(void)
+{
+    int i, n = 0;
+
+    for (i = 0; i < BLETEMP_MAX_CONN; i++) {
+        if (conns[i].conn_handle != BLETEMP_CONN_NONE &&
+            (conns[i].notify || conns[i].hist_notify)) {
+            n++;
+        }
+    }
+    return n;
+}
+
+/* Notification period implied by the subscriptions, 0 when there are none */
+static uint32_t
+bletemp_expected_period(const struct bletemp_conn *conn)
+{
+    if (conn->notify) {
+        return interval_ms;
+    }
+    if (conn->hist_notify) {
+        return interval_ms * (conn->hist_batch ? conn->hist_batch :
+                              temp_history_batch_size(conn->mtu - 3));
+    }
+    return 0;
+}
+
+/*
+ * Asks the central for the parameters the policy picks for period_ms,
+ * unless they are already requested or in use. Port lock must be held.
+ */
+static void
+bletemp_policy_apply(struct bletemp_conn *conn, uint32_t period_ms)
+{
+    struct bletemp_conn_params params;
+
+    if (transport->update_params == NULL) {
+        return;
+    }
+
+    bletemp_policy_select(period_ms, bletemp_subscribers(), &params);
+    if (memcmp(&params, &conn->requested, sizeof(params)) == 0 ||
+        bletemp_policy_satisfied(&params, conn->itvl, conn->latency)) {
+        return;
+    }
+    if (transport->update_params(conn->conn_handle, &params) == 0) {
+        conn->requested = params;
+    }
+}
+
+/* Re-evaluates every connection after the subscriptions or the period changed */
+static void
+bletemp_policy_apply_all(void)
+{
+    uint32_t now = bletemp_port_time_ms();
+    int i;
+
+    for (i = 0; i < BLETEMP_MAX_CONN; i++) {
+        if (conns[i].conn_handle != BLETEMP_CONN_NONE) {
+            bletemp_policy_apply(&conns[i], bletemp_expected_period(&conns[i]));
+            conns[i].window_ms = now;
+            conns[i].window_sent = 0;
+        }
+    }
+}
+
+/* Revisits the choice with the notification rate observed over the last window */
+static void
+bletemp_policy_tick(struct bletemp_conn *conn, uint32_t now)
+{
+    uint32_t elapsed = now - conn->window_ms;
+
+    if (elapsed < BLETEMP_POLICY_WINDOW_MS) {
+        return;
+    }
+    bletemp_policy_apply(conn, conn->window_sent ? elapsed / conn->window_sent : 0);
+    conn->window_ms = now;
+    conn->window_sent = 0;
+}
+
+int
+bletemp_on_connect(uint16_t conn_handle)
+{
+    struct bletemp_conn *conn;
+    int rc = 0;
+
+    bletemp_port_lock();
+    conn = bletemp_conn_find(BLETEMP_CONN_NONE);
+    if (conn != NULL) {
+        memset(conn, 0, sizeof(*conn));
+        conn->conn_handle = conn_handle;
+        conn->mtu = BLETEMP_DEFAULT_MTU;
+        /* what every link starts with until the controller reports otherwise */
+        conn->tx_phy = BLETEMP_PHY_1M;
+        conn->rx_phy = BLETEMP_PHY_1M;
+        conn->tx_octets = 27;
+        conn->rx_octets = 27;
+        conn->window_ms = bletemp_port_time_ms();
+        conn->ind_chr = BLETEMP_CHR_COUNT;
+    } else {
+        rc = -1;
+    }
+    bletemp_port_unlock();
+
+    return rc;
+}
+
+void
+bletemp_on_disconnect(uint16_t conn_handle)
+{
+    struct bletemp_conn *conn;
+
+    bletemp_port_lock();
+    conn = bletemp_conn_find(conn_handle);
+    if (conn != NULL) {
+        conn->conn_handle = BLETEMP_CONN_NONE;
+        conn->notify = 0;
+        conn->hist_notify = 0;
+        /* the remaining centrals get more of the radio */
+        bletemp_policy_apply_all();
+    }
+    bletemp_port_unlock();
+}
+
+void
+bletemp_on_mtu(uint16_t conn_handle, uint16_t mtu)
+{
+    struct bletemp_conn *conn;
+
+    bletemp_port_lock();
+    conn = bletemp_conn_find(conn_handle);
+    if (conn != NULL && mtu >= BLETEMP_DEFAULT_MTU) {
+        conn->mtu = mtu;
+    }
+    bletemp_port_unlock();
+}
+
+void
+bletemp_on_conn_params(uint16_t conn_handle, uint16_t itvl,
+                       uint16_t latency, uint16_t timeout)
+{
+    struct bletemp_conn *conn;
+
+    bletemp_port_lock();
+    conn = bletemp_conn_find(conn_handle);
+    if (conn != NULL) {
+        conn->itvl = itvl;
+        conn->latency = latency;
+        conn->timeout = timeout;
+    }
+    bletemp_port_unlock();
+}
+
+void
+bletemp_on_phy(uint16_t conn_handle, uint8_t tx_phy, uint8_t rx_phy)
+{
+    struct bletemp_conn *conn;
+
+    bletemp_port_lock();
+    conn = bletemp_conn_find(conn_handle);
+    if (conn != NULL) {
+        conn->tx_phy = tx_phy;
+        conn->rx_phy = rx_phy;
+    }
+    bletemp_port_unlock();
+}
+
+void
+bletemp_on_data_len(uint16_t conn_handle, uint16_t tx_octets, uint16_t rx_octets)
+{
+    struct bletemp_conn *conn;
+
+    bletemp_port_lock();
+    conn = bletemp_conn_find(conn_handle);
+    if (conn != NULL) {
+        conn->tx_octets = tx_octets;
+        conn->rx_octets = rx_octets;
+    }
+    bletemp_port_unlock();
+}
+
+int
+bletemp_on_subscribe(uint16_t conn_handle, enum bletemp_chr chr, uint16_t cfg)
+{
+    struct bletemp_conn *conn;
+    temp_struct value;
+    temp_sample sample;
+    bool have;
+    int rc = 0;
+
+    bletemp_port_lock();
+    conn = bletemp_conn_find(conn_handle);
+    if (conn == NULL) {
+        rc = -1;
+    } else if (chr == BLETEMP_CHR_TEMP) {
+        conn->notify = cfg;
+        conn->sent = 0;
+        conn->dropped = 0;
+        if (cfg) {
+            have = bletemp_latest(&sample, &value);
+            rc = bletemp_notify_temp(conn, &value, have ? &sample : NULL);
+        }
+    } else if (chr == BLETEMP_CHR_HIST) {
+        if (cfg && !conn->hist_notify) {
+            /* start with everything still held in RAM and catch up on the backlog */
+            conn->hist_cursor = temp_history_oldest();
+            conn->hist_batch = 0;
+            conn->hist_notify = cfg;
+            conn->hist_flush = 1;
+            rc = bletemp_send_history(conn, true);
+        }
+        conn->hist_notify = cfg;
+    }
+    if (conn != NULL) {
+        bletemp_policy_apply_all();
+    }
+    bletemp_port_unlock();
+
+    return rc;
+}
+
+/*
+ * Retries what the transport refused on one connection, see
+ * bletemp_resume(). Port lock must be held.
+ */
+static int
+bletemp_resume_conn(struct bletemp_conn *conn, const temp_struct *value,
+                    const temp_sample *sample)
+{
+    int rc, ret = 0;
+
+    if (conn->notify && conn->dropped) {
+        ret = bletemp_notify_temp(conn, value, sample);
+    }
+    if (conn->hist_notify) {
+        rc = bletemp_send_history(conn, false);
+        if (rc != 0) {
+            ret = rc;
+        }
+    }
+    return ret;
+}
+
+void
+bletemp_on_indicate_sent(uint16_t conn_handle, enum bletemp_chr chr)
+{
+    struct bletemp_conn *conn;
+
+    bletemp_port_lock();
+    conn = bletemp_conn_find(conn_handle);
+    if (conn != NULL && conn->ind_chr == chr) {
+        /* the round trip starts when it goes on air, not when it was queued */
+        conn->ind_ms = bletemp_port_time_ms();
+    }
+    bletemp_port_unlock();
+}
+
+void
+bletemp_on_confirm(uint16_t conn_handle, enum bletemp_chr chr, int status)
+{
+    struct bletemp_conn *conn;
+    temp_struct value;
+    temp_sample sample;
+    bool have;
+
+    have = bletemp_latest(&sample, &value);
+
+    bletemp_port_lock();
+    conn = bletemp_conn_find(conn_handle);
+    if (conn != NULL && conn->ind_chr == chr) {
+        conn->ind_chr = BLETEMP_CHR_COUNT;
+        if (status == 0) {
+            bletemp_rtt_add(bletemp_port_time_ms() - conn->ind_ms);
+        } else {
+            bletemp_rtt_lost();
+        }
+        /* the next indication may go */
+        bletemp_resume_conn(conn, &value, have ? &sample : NULL);
+    }
+    bletemp_port_unlock();
+}
+
+int
+bletemp_read(uint16_t conn_handle, enum bletemp_chr chr,
+             uint8_t *buf, uint16_t buf_len, uint16_t *out_len)
+{
+    struct bletemp_conn *conn;
+    temp_struct value;
+    diag_struct diag;
+    rtt_struct rtt;
+    jitter_struct jitter;
+    power_struct power;
+    aggregate_struct aggregate;
+    uint32_t cursor, start, head;
+    uint16_t mtu, batch;
+
+    switch (chr) {
+    case BLETEMP_CHR_TEMP:
+        /* the only BLETEMP_GATT_SENSOR row, the one sensor the sampler reads */
+        if (buf_len < sizeof(value)) {
+            return BLETEMP_ATT_ERR_INSUFFICIENT_RES;
+        }
+        value = bletemp_get_temp();
+        memcpy(buf, &value, sizeof(value));
+        *out_len = sizeof(value);
+        return 0;
+
+    case BLETEMP_CHR_UNIT:
+        if (buf_len < 1) {
+            return BLETEMP_ATT_ERR_INSUFFICIENT_RES;
+        }
+        buf[0] = unit;
+        *out_len = 1;
+        return 0;
+
+    case BLETEMP_CHR_INTERVAL:
+        if (buf_len < sizeof(interval_ms)) {
+            return BLETEMP_ATT_ERR_INSUFFICIENT_RES;
+        }
+        buf[0] = interval_ms & 0xFF;
+        buf[1] = interval_ms >> 8;
+        *out_len = sizeof(interval_ms);
+        return 0;
+
+    case BLETEMP_CHR_DEADBAND:
+        if (buf_len < sizeof(deadband)) {
+            return BLETEMP_ATT_ERR_INSUFFICIENT_RES;
+        }
+        bletemp_port_lock();
+        memcpy(buf, &deadband, sizeof(deadband));
+        bletemp_port_unlock();
+        *out_len = sizeof(deadband);
+        return 0;
+
+    case BLETEMP_CHR_DIAG:
+        if (buf_len < sizeof(diag)) {
+            return BLETEMP_ATT_ERR_INSUFFICIENT_RES;
+        }
+        bletemp_port_lock();
+        conn = bletemp_conn_find(conn_handle);
+        if (conn == NULL) {
+            bletemp_port_unlock();
+            return BLETEMP_ATT_ERR_UNLIKELY;
+        }
+        diag.tx_phy = conn->tx_phy;
+        diag.rx_phy = conn->rx_phy;
+        diag.tx_octets = conn->tx_octets;
+        diag.rx_octets = conn->rx_octets;
+        diag.mtu = conn->mtu;
+        diag.itvl = conn->itvl;
+        diag.latency = conn->latency;
+        diag.timeout = conn->timeout;
+        bletemp_port_unlock();
+        memcpy(buf, &diag, sizeof(diag));
+        *out_len = sizeof(diag);
+        return 0;
+
+    case BLETEMP_CHR_RTT:
+        if (buf_len < sizeof(rtt)) {
+            return BLETEMP_ATT_ERR_INSUFFICIENT_RES;
+        }
+        bletemp_port_lock();
+        bletemp_rtt_get(&rtt);
+        bletemp_port_unlock();
+        memcpy(buf, &rtt, sizeof(rtt));
+        *out_len = sizeof(rtt);
+        return 0;
+
+    case BLETEMP_CHR_JITTER:
+        if (buf_len < sizeof(jitter)) {
+            return BLETEMP_ATT_ERR_INSUFFICIENT_RES;
+        }
+        temp_jitter_get(&jitter);
+        memcpy(buf, &jitter, sizeof(jitter));
+        *out_len = sizeof(jitter);
+        return 0;
+
+    case BLETEMP_CHR_POWER:
+        if (buf_len < sizeof(power)) {
+            return BLETEMP_ATT_ERR_INSUFFICIENT_RES;
+        }
+        bletemp_port_power(&power);
+        memcpy(buf, &power, sizeof(power));
+        *out_len = sizeof(power);
+        return 0;
+
+    case BLETEMP_CHR_AGGREGATE:
+        if (buf_len < sizeof(aggregate)) {
+            return BLETEMP_ATT_ERR_INSUFFICIENT_RES;
+        }
+        temp_aggregate_get(&aggregate);
+        if (aggregate.count > 0) {
+            aggregate.min = temp_convert(aggregate.min, unit);
+            aggregate.max = temp_convert(aggregate.max, unit);
+            aggregate.mean = temp_convert(aggregate.mean, unit);
+            /* a spread only scales */
+            aggregate.stddev = (unit == 'F') ? aggregate.stddev * 9 / 5 : aggregate.stddev;
+        }
+        aggregate.unit = unit;
+        memcpy(buf, &aggregate, sizeof(aggregate));
+        *out_len = sizeof(aggregate);
+        return 0;
+
+    case BLETEMP_CHR_HIST:
+        bletemp_port_lock();
+        conn = bletemp_conn_find(conn_handle);
+        mtu = (conn != NULL) ? conn->mtu : BLETEMP_DEFAULT_MTU;
+        bletemp_port_unlock();
+
+        /* the newest samples that fit in a single read response */
+        if (buf_len > mtu - 1) {
+            buf_len = mtu - 1;
+        }
+        batch = UINT8_MAX;
+        head = temp_history_head();
+        for (;;) {
+            start = (head > batch) ? head - batch : 0;
+            if (start < temp_history_oldest()) {
+                start = temp_history_oldest();
+            }
+            cursor = start;
+            *out_len = temp_history_encode(&cursor, unit, buf, buf_len);
+            if (*out_len == 0 || cursor >= head) {
+                return 0;
+            }
+            /* the newest did not fit, retry with as many as did */
+            batch = (cursor - start < batch) ? cursor - start : batch - 1;
+        }
+
+    default:
+        return BLETEMP_ATT_ERR_READ_NOT_PERMITTED;
+    }
+}
+
+/* Validates and applies a new sampling period, little-endian milliseconds */
+static int
+bletemp_write_interval(const uint8_t *data, uint16_t len)
+{
+    uint16_t ms;
+
+    if (len != sizeof(ms)) {
+        return BLETEMP_ATT_ERR_INVALID_LEN;
+    }
+
+    ms = data[0] | (data[1] << 8);
+    if (ms < BLETEMP_INTERVAL_MIN_MS || ms > BLETEMP_INTERVAL_MAX_MS) {
+        return BLETEMP_ATT_ERR_OUT_OF_RANGE;
+    }
+
+    bletemp_port_lock();
+    if (ms != interval_ms) {
+        /* takes effect right away, the sampler restarts its wait */
+        if (temp_sampler_set_period(ms) != 0) {
+            bletemp_port_unlock();
+            return BLETEMP_ATT_ERR_UNLIKELY;
+        }
+        interval_ms = ms;
+        bletemp_policy_apply_all();
+    }
+    bletemp_port_unlock();
+
+    return 0;
+}
+
+/* Threshold 0 turns the deadband off, heartbeat 0 allows unbounded silence */
+static int
+bletemp_write_deadband(const uint8_t *data, uint16_t len)
+{
+    if (len != sizeof(deadband)) {
+        return BLETEMP_ATT_ERR_INVALID_LEN;
+    }
+
+    bletemp_port_lock();
+    memcpy(&deadband, data, sizeof(deadband));
+    bletemp_port_unlock();
+
+    return 0;
+}
+
+static int
+bletemp_write_unit(const uint8_t *data, uint16_t len)
+{
+    temp_struct value;
+    temp_sample sample;
+    bool have;
+    uint8_t requnit;
+    int i;
+
+    if (len != 1) {
+        return BLETEMP_ATT_ERR_INVALID_LEN;
+    }
+
+    requnit = (data[0] == 'F') ? 'F' : 'C';
+
+    bletemp_port_lock();
+    if (requnit != unit) {
+        //unit changed
+        unit = requnit;
+        have = bletemp_latest(&sample, &value);
+        for (i = 0; i < BLETEMP_MAX_CONN; i++) {
+            if (conns[i].conn_handle != BLETEMP_CONN_NONE && conns[i].notify) {
+                bletemp_notify_temp(&conns[i], &value, have ? &sample : NULL);
+            }
+        }
+    }
+    bletemp_port_unlock();
+
+    return 0;
+}
+
+int
+bletemp_write(uint16_t conn_handle, enum bletemp_chr chr,
+              const uint8_t *data, uint16_t len)
+{
+    switch (chr) {
+    case BLETEMP_CHR_UNIT:
+        return bletemp_write_unit(data, len);
+    case BLETEMP_CHR_INTERVAL:
+        return bletemp_write_interval(data, len);
+    case BLETEMP_CHR_DEADBAND:
+        return bletemp_write_deadband(data, len);
+    default:
+        return BLETEMP_ATT_ERR_WRITE_NOT_PERMITTED;
+    }
+}
+
+int
+bletemp_publish(void)
+{
+    temp_struct value;
+    temp_sample sample;
+    uint32_t now = bletemp_port_time_ms();
+    int i, rc, ret = 0;
+
+    /* encode once, fan out to every subscriber */
+    if (!bletemp_latest(&sample, &value)) {
+        return 0;
+    }
+
+    bletemp_port_lock();
+    for (i = 0; i < BLETEMP_MAX_CONN; i++) {
+        if (conns[i].conn_handle == BLETEMP_CONN_NONE) {
+            continue;
+        }
+        if (conns[i].notify && bletemp_deadband_due(&conns[i], &sample)) {
+            rc = bletemp_notify_temp(&conns[i], &value, &sample);
+            if (rc != 0) {
+                ret = rc;
+            }
+        }
+        if (conns[i].hist_notify) {
+            rc = bletemp_send_history(&conns[i], false);
+            if (rc != 0) {
+                ret = rc;
+            }
+        }
+        bletemp_policy_tick(&conns[i], now);
+    }
+    bletemp_port_unlock();
+
+    return ret;
+}
+
+int
+bletemp_resume(void)
+{
+    temp_struct value;
+    temp_sample sample;
+    bool have;
+    int i, rc, ret = 0;
+
+    have = bletemp_latest(&sample, &value);
+
+    bletemp_port_lock();
+    for (i = 0; i < BLETEMP_MAX_CONN; i++) {
+        if (conns[i].conn_handle == BLETEMP_CONN_NONE) {
+            continue;
+        }
+        rc = bletemp_resume_conn(&conns[i], &value, have ? &sample : NULL);
+        if (rc != 0) {
+            ret = rc;
+        }
+    }
+    bletemp_port_unlock();
+
+    return ret;
+}
+
+int
+bletemp_conn_count(void)
+{
+    int i, n = 0;
+
+    bletemp_port_lock();
+    for (i = 0; i < BLETEMP_MAX_CONN; i++) {
+        if (conns[i].conn_handle != BLETEMP_CONN_NONE) {
+            n++;
+        }
+    }
+    bletemp_port_unlock();
+
+    return n;
+}
+
+int
+bletemp_subscriber_count(void)
+{
+    int n;
+
+    bletemp_port_lock();
+    n = bletemp_subscribers();
+    bletemp_port_unlock();
+
+    return n;
+}
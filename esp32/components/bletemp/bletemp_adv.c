@@ -0,0 +1,87 @@
+#include <stdlib.h>
+#include "bletemp.h"
+
+/*
+ * One tier per time since the reading last moved. Centrals scanning for
+ * the change find it within a few hundred ms, a stable sensor costs one
+ * advertising event a second.
+ */
+struct bletemp_adv_tier {
+    uint32_t stable_below_ms;   /* 0 matches anything */
+    uint16_t itvl_min;          /* 0.625 ms */
+    uint16_t itvl_max;
+};
+
+static const struct bletemp_adv_tier tiers[] = {
+    { 10000, 0x0020, 0x0030 },  /* 20-30 ms */
+    { 60000, 0x00F4, 0x0110 },  /* 152.5-170 ms */
+    {     0, 0x0640, 0x06A0 },  /* 1-1.06 s */
+};
+
+/* Guarded by the port lock */
+static adv_svc_data data;
+static const struct bletemp_adv_tier *tier;
+static int16_t ref_temp;        /* Celsius reading at the last change */
+static uint32_t change_ms;
+static bool have_ref;
+
+void bletemp_adv_reset(void) {
+    bletemp_port_lock();
+    data.uuid = BLETEMP_ADV_SVC_UUID;
+    data.temperature = 0;
+    data.unit = bletemp_unit();
+    data.seq = 0;
+    /* fast until the first sample settles */
+    tier = tiers;
+    have_ref = false;
+    bletemp_port_unlock();
+}
+
+int bletemp_adv_update(uint32_t now_ms) {
+    const struct bletemp_adv_tier *next;
+    adv_svc_data prev;
+    temp_sample sample;
+    uint32_t head;
+    int changed = 0;
+
+    if (!temp_history_latest(&sample)) {
+        return 0;
+    }
+    head = temp_history_head();
+
+    bletemp_port_lock();
+    if (!have_ref || abs(sample.temperature - ref_temp) >= BLETEMP_ADV_CHANGE) {
+        ref_temp = sample.temperature;
+        change_ms = now_ms;
+        have_ref = true;
+    }
+
+    prev = data;
+    data.unit = bletemp_unit();
+    data.temperature = temp_convert(sample.temperature, data.unit);
+    data.seq = (head - 1) & 0xFF;
+    if (data.temperature != prev.temperature || data.unit != prev.unit || data.seq != prev.seq) {
+        changed |= BLETEMP_ADV_DATA;
+    }
+
+    for (next = tiers; next->stable_below_ms != 0; next++) {
+        if (now_ms - change_ms < next->stable_below_ms) {
+            break;
+        }
+    }
+    if (next != tier) {
+        tier = next;
+        changed |= BLETEMP_ADV_ITVL;
+    }
+    bletemp_port_unlock();
+
+    return changed;
+}
+
+void bletemp_adv_get(adv_svc_data *out, uint16_t *itvl_min, uint16_t *itvl_max) {
+    bletemp_port_lock();
+    *out = data;
+    *itvl_min = tier->itvl_min;
+    *itvl_max = tier->itvl_max;
+    bletemp_port_unlock();
+}
@@ -0,0 +1,92 @@
+#include <stddef.h>
+#include <string.h>
+#include "bletemp.h"
+
+/* Presentation formats: format, exponent, unit (LE), namespace, description (LE) */
+static const uint8_t temp_fmt[BLETEMP_GATT_FMT_LEN] = {
+    0x0E, 0xFE,         /* signed 16-bit, hundredths */
+    0x2F, 0x27,         /* thermodynamic temperature, degree Celsius */
+    0x01, 0x00, 0x00,
+};
+
+/* Units of the presentation format, the Celsius one follows the active unit */
+#define FMT_UNIT_CELSIUS    0x272F
+#define FMT_UNIT_FAHRENHEIT 0x27AC
+
+static const uint8_t interval_fmt[BLETEMP_GATT_FMT_LEN] = {
+    0x06, 0xFD,         /* unsigned 16-bit, milliseconds */
+    0x03, 0x27,         /* time, second */
+    0x01, 0x00, 0x00,
+};
+
+static const uint8_t interval_range_data[4] = {
+    BLETEMP_INTERVAL_MIN_MS & 0xFF, BLETEMP_INTERVAL_MIN_MS >> 8,
+    BLETEMP_INTERVAL_MAX_MS & 0xFF, BLETEMP_INTERVAL_MAX_MS >> 8,
+};
+
+static const struct bletemp_gatt_range interval_range = {
+    .data = interval_range_data,
+    .len = sizeof(interval_range_data),
+};
+
+#define BLETEMP_GATT_ROW(id, uuid_, flags_, max_len_, desc_, fmt_, range_) \
+    [BLETEMP_CHR_##id] = {                                                  \
+        .uuid = (uuid_),                                                    \
+        .flags = (flags_),                                                  \
+        .max_len = (max_len_),                                              \
+        .desc = (desc_),                                                    \
+        .fmt = (fmt_),                                                      \
+        .range = (range_),                                                  \
+    },
+
+const struct bletemp_gatt_chr bletemp_gatt_chrs[BLETEMP_CHR_COUNT] = {
+    BLETEMP_GATT_CHRS(BLETEMP_GATT_ROW)
+};
+
+void bletemp_gatt_fmt(const struct bletemp_gatt_chr *def, uint8_t unit,
+                      uint8_t out[BLETEMP_GATT_FMT_LEN]) {
+    memcpy(out, def->fmt, BLETEMP_GATT_FMT_LEN);
+    if (unit == 'F' && (out[2] | out[3] << 8) == FMT_UNIT_CELSIUS) {
+        out[2] = FMT_UNIT_FAHRENHEIT & 0xFF;
+        out[3] = FMT_UNIT_FAHRENHEIT >> 8;
+    }
+}
+
+/* 9941XXXX-8e3e-11eb-8dcd-0242ac130003, little endian */
+static const uint8_t base_uuid[16] = {
+    0x03, 0x00, 0x13, 0xAC, 0x42, 0x02, 0xCD, 0x8D,
+    0xEB, 0x11, 0x3E, 0x8E, 0x00, 0x00, 0x41, 0x99,
+};
+
+void bletemp_gatt_uuid128(uint32_t uuid, uint8_t out[16]) {
+    memcpy(out, base_uuid, sizeof(base_uuid));
+    out[12] = uuid & 0xFF;
+    out[13] = (uuid >> 8) & 0xFF;
+}
+
+void bletemp_gatt_map_init(struct bletemp_gatt_map *map, uint16_t base,
+                           uint8_t *slot, uint16_t len) {
+    map->base = base;
+    map->len = len;
+    map->slot = slot;
+    memset(slot, BLETEMP_GATT_MAP_NONE, len);
+}
+
+int bletemp_gatt_map_add(struct bletemp_gatt_map *map, uint16_t handle, uint8_t entry) {
+    uint16_t i = handle - map->base;
+
+    if (handle < map->base || i >= map->len) {
+        return -1;
+    }
+    map->slot[i] = entry;
+    return 0;
+}
+
+int bletemp_gatt_map_get(const struct bletemp_gatt_map *map, uint16_t handle) {
+    uint16_t i = handle - map->base;
+
+    if (handle < map->base || i >= map->len || map->slot[i] == BLETEMP_GATT_MAP_NONE) {
+        return -1;
+    }
+    return map->slot[i];
+}
@@ -0,0 +1,85 @@
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "bletemp_load.h"
+
+#if CONFIG_BLETEMP_TASK_LOAD
+
+#define LOAD_TAG "LOAD"
+
+/* More tasks than this and a report is skipped */
+#define LOAD_MAX_TASKS 32
+
+/* The previous snapshot, each task's load is the difference */
+static TaskStatus_t load_tasks[2][LOAD_MAX_TASKS];
+static UBaseType_t load_count[2];
+static uint32_t load_total[2];
+
+static const TaskStatus_t *load_find(const TaskStatus_t *tasks, UBaseType_t n, TaskHandle_t handle) {
+    UBaseType_t i;
+
+    for (i = 0; i < n; i++) {
+        if (tasks[i].xHandle == handle) {
+            return &tasks[i];
+        }
+    }
+    return NULL;
+}
+
+static void load_report(int cur) {
+    const TaskStatus_t *task, *prev;
+    uint32_t elapsed, run;
+    UBaseType_t i;
+
+    /* the run time clock is the time of one core, loads are per core */
+    elapsed = load_total[cur] - load_total[!cur];
+    if (elapsed == 0) {
+        return;
+    }
+    for (i = 0; i < load_count[cur]; i++) {
+        task = &load_tasks[cur][i];
+        prev = load_find(load_tasks[!cur], load_count[!cur], task->xHandle);
+        /* started during the period */
+        run = task->ulRunTimeCounter - (prev ? prev->ulRunTimeCounter : 0);
+        ESP_LOGI(LOAD_TAG, "%-16s core %c %3u.%u%%", task->pcTaskName,
+                 (task->xCoreID == tskNO_AFFINITY) ? '-' : '0' + (int)task->xCoreID,
+                 (unsigned)((uint64_t)run * 100 / elapsed),
+                 (unsigned)((uint64_t)run * 1000 / elapsed % 10));
+    }
+}
+
+static void load_task(void *pvParameters) {
+    int prev = 0, cur;
+
+    load_count[prev] = uxTaskGetSystemState(load_tasks[prev], LOAD_MAX_TASKS, &load_total[prev]);
+    for ( ;; ) {
+        vTaskDelay(pdMS_TO_TICKS(CONFIG_BLETEMP_TASK_LOAD_PERIOD_MS));
+        cur = !prev;
+        load_count[cur] = uxTaskGetSystemState(load_tasks[cur], LOAD_MAX_TASKS, &load_total[cur]);
+        if (load_count[cur] == 0) {
+            /* keep the last good snapshot to compare the next one with */
+            ESP_LOGW(LOAD_TAG, "more than %d tasks", LOAD_MAX_TASKS);
+            continue;
+        }
+        load_report(cur);
+        prev = cur;
+    }
+}
+
+int bletemp_load_start(void) {
+    /* lowest priority above idle, it only reads counters */
+    if (xTaskCreate(&load_task, "load", 2560, NULL, 1, NULL) != pdPASS) {
+        ESP_LOGE(LOAD_TAG, "failed to create load task");
+        return -1;
+    }
+    return 0;
+}
+
+#else
+
+int bletemp_load_start(void) {
+    return 0;
+}
+
+#endif
@@ -0,0 +1,134 @@
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "bletemp_pm.h"
+#include "bletemp_port.h"
+
+#if CONFIG_BLETEMP_POWER_SAVE
+
+#include "esp_pm.h"
+
+#define PM_TAG "PM"
+
+#if CONFIG_ESP32_XTAL_FREQ > 0
+#define PM_MIN_FREQ_MHZ CONFIG_ESP32_XTAL_FREQ
+#else
+#define PM_MIN_FREQ_MHZ 40
+#endif
+
+static esp_pm_lock_handle_t pm_lock;
+
+/*
+ * Holders of the lock and cores in the idle sleep hook. Each state's time
+ * runs from the first to enter it to the last to leave, so two cores in
+ * it at once count once.
+ */
+static portMUX_TYPE pm_mux = portMUX_INITIALIZER_UNLOCKED;
+static int pm_busy, pm_sleeping;
+static int64_t pm_busy_since, pm_sleep_since;
+static uint64_t pm_active_us, pm_sleep_us;
+
+int bletemp_pm_init(void) {
+    esp_pm_config_esp32_t config = {
+        .max_freq_mhz = CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ,
+        .min_freq_mhz = PM_MIN_FREQ_MHZ,
+        .light_sleep_enable = true,
+    };
+    esp_err_t err;
+
+    err = esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "bletemp", &pm_lock);
+    if (err != ESP_OK) {
+        ESP_LOGE(PM_TAG, "failed to create pm lock: %d", err);
+        return -1;
+    }
+    err = esp_pm_configure(&config);
+    if (err != ESP_OK) {
+        ESP_LOGE(PM_TAG, "failed to configure pm: %d", err);
+        return -1;
+    }
+    ESP_LOGI(PM_TAG, "light sleep enabled, %d-%d MHz", PM_MIN_FREQ_MHZ,
+             CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ);
+    return 0;
+}
+
+void bletemp_pm_acquire(void) {
+    if (pm_lock == NULL) {
+        return;
+    }
+    esp_pm_lock_acquire(pm_lock);
+    portENTER_CRITICAL(&pm_mux);
+    if (pm_busy++ == 0) {
+        pm_busy_since = esp_timer_get_time();
+    }
+    portEXIT_CRITICAL(&pm_mux);
+}
+
+void bletemp_pm_release(void) {
+    if (pm_lock == NULL) {
+        return;
+    }
+    portENTER_CRITICAL(&pm_mux);
+    if (--pm_busy == 0) {
+        pm_active_us += esp_timer_get_time() - pm_busy_since;
+    }
+    portEXIT_CRITICAL(&pm_mux);
+    esp_pm_lock_release(pm_lock);
+}
+
+/*
+ * The tickless idle hook of esp_pm, which light-sleeps when no lock is
+ * held; linked in its place with --wrap (see CMakeLists.txt). The timer
+ * is corrected for the sleep before the hook returns.
+ */
+void __real_vApplicationSleep(TickType_t xExpectedIdleTime);
+
+void IRAM_ATTR __wrap_vApplicationSleep(TickType_t xExpectedIdleTime) {
+    portENTER_CRITICAL_ISR(&pm_mux);
+    if (pm_sleeping++ == 0) {
+        pm_sleep_since = esp_timer_get_time();
+    }
+    portEXIT_CRITICAL_ISR(&pm_mux);
+
+    __real_vApplicationSleep(xExpectedIdleTime);
+
+    portENTER_CRITICAL_ISR(&pm_mux);
+    if (--pm_sleeping == 0) {
+        pm_sleep_us += esp_timer_get_time() - pm_sleep_since;
+    }
+    portEXIT_CRITICAL_ISR(&pm_mux);
+}
+
+void bletemp_port_power(power_struct *power) {
+    uint64_t active, sleep, now;
+
+    portENTER_CRITICAL(&pm_mux);
+    now = esp_timer_get_time();
+    active = pm_active_us + (pm_busy ? now - pm_busy_since : 0);
+    sleep = pm_sleep_us + (pm_sleeping ? now - pm_sleep_since : 0);
+    portEXIT_CRITICAL(&pm_mux);
+
+    power->active = active / 1000;
+    power->sleep = sleep / 1000;
+    power->modem = (now > active + sleep) ? (now - active - sleep) / 1000 : 0;
+}
+
+#else
+
+int bletemp_pm_init(void) {
+    return 0;
+}
+
+void bletemp_pm_acquire(void) {
+}
+
+void bletemp_pm_release(void) {
+}
+
+void bletemp_port_power(power_struct *power) {
+    power->active = esp_timer_get_time() / 1000;
+    power->modem = 0;
+    power->sleep = 0;
+}
+
+#endif
@@ -0,0 +1,50 @@
+#include "bletemp_policy.h"
+
+/*
+ * One tier per notification rate. The values stay within the limits most
+ * centrals accept (Apple's accessory guidelines being the strictest):
+ * min interval of 15 ms, max at least 15 ms above min, interval times
+ * (latency + 1) at most 2 s and a supervision timeout of at most 6 s.
+ */
+struct bletemp_policy_tier {
+    uint32_t period_below_ms;   /* 0 matches anything, including no traffic */
+    uint16_t itvl_min;
+    uint16_t itvl_max;
+    uint16_t latency;
+    uint16_t timeout;
+};
+
+static const struct bletemp_policy_tier tiers[] = {
+    {   100,  12,  24, 0, 400 },   /* 15-30 ms, bursts and fast telemetry */
+    {  1000,  24,  48, 2, 400 },   /* 30-60 ms */
+    { 10000,  80, 104, 8, 400 },   /* 100-130 ms, wake about once a second */
+    {     0, 240, 320, 4, 600 },   /* 300-400 ms, idle */
+};
+
+/* Airtime reserved per connection event, keeps events of several centrals apart */
+#define BLETEMP_POLICY_SLOT 12
+
+void bletemp_policy_select(uint32_t period_ms, int subscribers,
+                           struct bletemp_conn_params *params) {
+    const struct bletemp_policy_tier *tier = tiers;
+
+    while (tier->period_below_ms != 0 &&
+           (period_ms == 0 || period_ms >= tier->period_below_ms)) {
+        tier++;
+    }
+
+    params->itvl_min = tier->itvl_min;
+    params->itvl_max = tier->itvl_max;
+    if (subscribers > 1 && params->itvl_min < subscribers * BLETEMP_POLICY_SLOT) {
+        params->itvl_min = subscribers * BLETEMP_POLICY_SLOT;
+        params->itvl_max = params->itvl_min + 12;
+    }
+    params->latency = tier->latency;
+    params->timeout = tier->timeout;
+}
+
+int bletemp_policy_satisfied(const struct bletemp_conn_params *params,
+                             uint16_t itvl, uint16_t latency) {
+    return itvl >= params->itvl_min && itvl <= params->itvl_max &&
+           latency == params->latency;
+}
@@ -0,0 +1,25 @@
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+#include "bletemp_port.h"
+
+static SemaphoreHandle_t lock = NULL;
+static StaticSemaphore_t lock_buffer;
+
+void bletemp_port_init(void) {
+    if (lock == NULL) {
+        lock = xSemaphoreCreateRecursiveMutexStatic(&lock_buffer);
+    }
+}
+
+uint32_t bletemp_port_time_ms(void) {
+    return esp_timer_get_time() / 1000;
+}
+
+void bletemp_port_lock(void) {
+    xSemaphoreTakeRecursive(lock, portMAX_DELAY);
+}
+
+void bletemp_port_unlock(void) {
+    xSemaphoreGiveRecursive(lock);
+}
@@ -0,0 +1,68 @@
+#include <string.h>
+#include "bletemp_rtt.h"
+
+/* Marks a lost indication in the window */
+#define RTT_LOST 0xFFFF
+
+/* The window as a ring of round trips, the histogram kept in step with it */
+static uint16_t window[BLETEMP_RTT_WINDOW];
+static uint16_t head, len;
+static rtt_struct hist;
+
+static int bucket(uint16_t ms) {
+    uint32_t bound = BLETEMP_RTT_FIRST_MS;
+    int i;
+
+    for (i = 0; i < BLETEMP_RTT_BUCKETS - 1; i++, bound <<= 1) {
+        if (ms < bound) {
+            break;
+        }
+    }
+    return i;
+}
+
+static void count(uint16_t ms, int delta) {
+    if (ms == RTT_LOST) {
+        hist.lost += delta;
+    } else {
+        hist.count[bucket(ms)] += delta;
+    }
+}
+
+static void push(uint16_t ms) {
+    if (len == BLETEMP_RTT_WINDOW) {
+        /* the oldest leaves the window */
+        count(window[head], -1);
+    } else {
+        len++;
+    }
+    window[head] = ms;
+    head = (head + 1) % BLETEMP_RTT_WINDOW;
+    count(ms, 1);
+}
+
+void bletemp_rtt_reset(void) {
+    head = 0;
+    len = 0;
+    memset(&hist, 0, sizeof(hist));
+}
+
+void bletemp_rtt_add(uint32_t ms) {
+    push(ms < RTT_LOST ? ms : RTT_LOST - 1);
+}
+
+void bletemp_rtt_lost(void) {
+    push(RTT_LOST);
+}
+
+void bletemp_rtt_get(rtt_struct *rtt) {
+    uint16_t i;
+
+    *rtt = hist;
+    rtt->max = 0;
+    for (i = 0; i < len; i++) {
+        if (window[i] != RTT_LOST && window[i] > rtt->max) {
+            rtt->max = window[i];
+        }
+    }
+}
@@ -0,0 +1,9 @@
+#
+# Thermometer service building blocks shared by the Bluedroid and NimBLE examples.
+#
+COMPONENT_ADD_INCLUDEDIRS := include
+
+ifdef CONFIG_BLETEMP_POWER_SAVE
+# bletemp_pm.c times the light sleeps of the tickless idle hook
+COMPONENT_ADD_LDFLAGS += -Wl,--wrap=vApplicationSleep
+endif
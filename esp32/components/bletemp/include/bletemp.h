@@ -0,0 +1,180 @@
+#ifndef H_BLETEMP_
+#define H_BLETEMP_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "bletemp_adv.h"
+#include "bletemp_gatt.h"
+#include "bletemp_port.h"
+#include "bletemp_policy.h"
+#include "bletemp_rtt.h"
+#include "temp_filter.h"
+#include "temp_history.h"
+#include "temp_jitter.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Stack independent thermometer service. The NimBLE and Bluedroid
+ * examples translate their GAP/GATT events into the calls below and
+ * provide a transport that puts notifications on air; on Linux the
+ * same core is driven by the simulator in esp32/host.
+ */
+
+/* Connection slots, one per central the controller can serve */
+#ifndef BLETEMP_MAX_CONN
+#if defined(CONFIG_BT_NIMBLE_MAX_CONNECTIONS)
+#define BLETEMP_MAX_CONN CONFIG_BT_NIMBLE_MAX_CONNECTIONS
+#elif defined(CONFIG_BTDM_CTRL_BLE_MAX_CONN)
+#define BLETEMP_MAX_CONN CONFIG_BTDM_CTRL_BLE_MAX_CONN
+#else
+#define BLETEMP_MAX_CONN 4
+#endif
+#endif
+
+#define BLETEMP_CONN_NONE 0xFFFF
+
+#define BLETEMP_DEFAULT_MTU 23
+
+/* Sampling and notification period accepted by the interval characteristic */
+#define BLETEMP_INTERVAL_DEFAULT_MS  5000
+#define BLETEMP_INTERVAL_MIN_MS      50
+#define BLETEMP_INTERVAL_MAX_MS      60000
+
+/* ATT error codes returned by bletemp_read() and bletemp_write() */
+#define BLETEMP_ATT_ERR_READ_NOT_PERMITTED   0x02
+#define BLETEMP_ATT_ERR_WRITE_NOT_PERMITTED  0x03
+#define BLETEMP_ATT_ERR_INVALID_LEN          0x0D
+#define BLETEMP_ATT_ERR_UNLIKELY             0x0E
+#define BLETEMP_ATT_ERR_INSUFFICIENT_RES     0x11
+#define BLETEMP_ATT_ERR_OUT_OF_RANGE         0xFF
+
+/*
+ * Characteristics of the service, independent of the attribute handles,
+ * in the order of BLETEMP_GATT_CHRS
+ */
+#define BLETEMP_CHR_ENUM(id, ...) BLETEMP_CHR_##id,
+enum bletemp_chr {
+    BLETEMP_GATT_CHRS(BLETEMP_CHR_ENUM)
+
+    BLETEMP_CHR_COUNT,
+};
+#undef BLETEMP_CHR_ENUM
+
+/* Temperature characteristic value */
+typedef struct {
+    int16_t temperature;    /* hundredths of a degree, in unit */
+    uint8_t unit;
+} __attribute__ ((packed)) temp_struct;
+
+/*
+ * Deadband characteristic value. Temperature notifications are held back
+ * until the reading moves by more than threshold from the last one sent,
+ * or heartbeat seconds passed without one.
+ */
+typedef struct {
+    uint16_t threshold;     /* hundredths of a degree Celsius, 0 = off */
+    uint16_t heartbeat;     /* seconds, 0 = none */
+} __attribute__ ((packed)) deadband_struct;
+
+/* LE PHY as reported by the controller */
+#define BLETEMP_PHY_1M      1
+#define BLETEMP_PHY_2M      2
+#define BLETEMP_PHY_CODED   3
+
+/* Largest LL payload with Data Length Extension and its air time on 1M */
+#define BLETEMP_LL_OCTETS_MAX   251
+#define BLETEMP_LL_TIME_MAX     2120
+
+/* Diagnostics characteristic value: what the link was negotiated to */
+typedef struct {
+    uint8_t tx_phy;         /* BLETEMP_PHY_* */
+    uint8_t rx_phy;
+    uint16_t tx_octets;     /* LL payload, 27 without DLE */
+    uint16_t rx_octets;
+    uint16_t mtu;
+    uint16_t itvl;          /* connection interval, 1.25 ms units */
+    uint16_t latency;
+    uint16_t timeout;       /* supervision timeout, 10 ms units */
+} __attribute__ ((packed)) diag_struct;
+
+/* Client characteristic configuration, as written to the CCCD */
+#define BLETEMP_SUB_NOTIFY      0x0001
+#define BLETEMP_SUB_INDICATE    0x0002
+
+struct bletemp_transport {
+    /* Puts a notification on air; returns 0 once the stack accepted it */
+    int (*notify)(uint16_t conn_handle, enum bletemp_chr chr,
+                  const uint8_t *data, uint16_t len);
+
+    /*
+     * Puts an indication on air and reports its confirmation through
+     * bletemp_on_confirm(), never from within the call (optional,
+     * indications are sent as notifications without it). A transport
+     * that accepts one but holds it back reports when it goes out with
+     * bletemp_on_indicate_sent().
+     */
+    int (*indicate)(uint16_t conn_handle, enum bletemp_chr chr,
+                    const uint8_t *data, uint16_t len);
+
+    /* Requests new connection parameters from the central (optional) */
+    int (*update_params)(uint16_t conn_handle,
+                         const struct bletemp_conn_params *params);
+};
+
+int bletemp_init(const struct bletemp_transport *transport);
+
+/* GAP/GATT events */
+int bletemp_on_connect(uint16_t conn_handle);
+void bletemp_on_disconnect(uint16_t conn_handle);
+void bletemp_on_mtu(uint16_t conn_handle, uint16_t mtu);
+/* Parameters the link runs with, on connect and after each update */
+void bletemp_on_conn_params(uint16_t conn_handle, uint16_t itvl,
+                            uint16_t latency, uint16_t timeout);
+void bletemp_on_phy(uint16_t conn_handle, uint8_t tx_phy, uint8_t rx_phy);
+void bletemp_on_data_len(uint16_t conn_handle, uint16_t tx_octets,
+                         uint16_t rx_octets);
+/* cfg is the CCCD value, BLETEMP_SUB_* bits; indications win when both are set */
+int bletemp_on_subscribe(uint16_t conn_handle, enum bletemp_chr chr, uint16_t cfg);
+/* An indication the transport held back went on air */
+void bletemp_on_indicate_sent(uint16_t conn_handle, enum bletemp_chr chr);
+/* Outcome of an indication: 0 once confirmed, non-zero when it failed or timed out */
+void bletemp_on_confirm(uint16_t conn_handle, enum bletemp_chr chr, int status);
+
+/* Attribute access; both return 0 or a BLETEMP_ATT_ERR_* code */
+int bletemp_read(uint16_t conn_handle, enum bletemp_chr chr,
+                 uint8_t *buf, uint16_t buf_len, uint16_t *out_len);
+int bletemp_write(uint16_t conn_handle, enum bletemp_chr chr,
+                  const uint8_t *data, uint16_t len);
+
+/*
+ * Sends the latest sample to the temperature subscribers outside the
+ * deadband and full history batches to the history subscribers
+ */
+int bletemp_publish(void);
+
+/*
+ * Retries what the transport refused: the latest sample to temperature
+ * subscribers whose last notification was dropped, coalescing whatever
+ * they missed, and history batches still due. Call once the stack has
+ * buffers again.
+ */
+int bletemp_resume(void);
+
+/* Latest sample in the active unit */
+temp_struct bletemp_get_temp(void);
+uint8_t bletemp_unit(void);
+
+/* Current sampling period in milliseconds */
+uint16_t bletemp_interval(void);
+
+int bletemp_conn_count(void);
+int bletemp_subscriber_count(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
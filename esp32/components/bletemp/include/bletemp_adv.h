@@ -0,0 +1,47 @@
+#ifndef H_BLETEMP_ADV_
+#define H_BLETEMP_ADV_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Reading in the legacy advertising data, for passive scanners that never
+ * connect, and the advertising interval: fast for a while after the
+ * reading moved, slow while it is stable. The stacks refresh their
+ * advertising data and parameters from here after every sample.
+ */
+
+/* Environmental Sensing service, the 16-bit UUID of the service data */
+#define BLETEMP_ADV_SVC_UUID    0x181A
+
+/* Reading change, hundredths of a degree Celsius, that counts as a new value */
+#define BLETEMP_ADV_CHANGE      10
+
+/* Returned by bletemp_adv_update() */
+#define BLETEMP_ADV_DATA        0x01    /* the service data changed */
+#define BLETEMP_ADV_ITVL        0x02    /* the interval changed */
+
+/* Service data (AD type 0x16), UUID first as in the advertising PDU */
+typedef struct {
+    uint16_t uuid;          /* BLETEMP_ADV_SVC_UUID */
+    int16_t temperature;    /* hundredths of a degree in unit */
+    uint8_t unit;           /* 'C' or 'F' */
+    uint8_t seq;            /* low bits of the sample sequence number */
+} __attribute__ ((packed)) adv_svc_data;
+
+void bletemp_adv_reset(void);
+
+/* Takes in the latest sample; returns BLETEMP_ADV_* bits of what changed */
+int bletemp_adv_update(uint32_t now_ms);
+
+/* Service data and advertising interval range, 0.625 ms units */
+void bletemp_adv_get(adv_svc_data *data, uint16_t *itvl_min, uint16_t *itvl_max);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,128 @@
+#ifndef H_BLETEMP_GATT_
+#define H_BLETEMP_GATT_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * The thermometer service, described once. Both stacks generate their
+ * attribute tables from this list and bletemp.h the characteristic enum,
+ * so a row added here shows up in both attribute tables; its value must
+ * still be served by bletemp_read() and bletemp_write(). One row per
+ * characteristic, in attribute order:
+ *
+ *   id        BLETEMP_CHR_<id>
+ *   uuid      BLETEMP_UUID16(assigned number) or BLETEMP_UUID128(short),
+ *             the latter in the base UUID of the service
+ *   flags     BLETEMP_GATT_F_*, notify or indicate adds a CCCD
+ *   max_len   longest value
+ *   desc      0x2901 user description, a string or NULL
+ *   fmt       0x2904 presentation format, BLETEMP_GATT_FMT_LEN bytes or NULL
+ *   range     0x2906 valid range, a struct bletemp_gatt_range or NULL
+ *
+ * Sensors all look the same, a readable value that can be notified or
+ * indicated, with a CCCD and a presentation format; BLETEMP_GATT_SENSOR
+ * makes that row. It only shapes the attributes: the core samples,
+ * reads and publishes a single sensor, TEMP, and another sensor row
+ * needs its own value source in bletemp_read() and bletemp_publish().
+ * The descriptor data is defined in bletemp_gatt.c.
+ */
+#define BLETEMP_GATT_CHRS(X) \
+    BLETEMP_GATT_SENSOR(X, TEMP, BLETEMP_UUID16(0x2A6E), sizeof(temp_struct), temp_fmt) \
+    X(UNIT,     BLETEMP_UUID128(0xFB38), BLETEMP_GATT_F_READ | BLETEMP_GATT_F_WRITE, \
+      1, "Temperature unit", NULL, NULL) \
+    X(HIST,     BLETEMP_UUID128(0xFC4A), BLETEMP_GATT_F_READ | BLETEMP_GATT_F_NOTIFY | \
+      BLETEMP_GATT_F_INDICATE, TEMP_HISTORY_MAX_PAYLOAD, NULL, NULL, NULL) \
+    X(INTERVAL, BLETEMP_UUID128(0xFC80), BLETEMP_GATT_F_READ | BLETEMP_GATT_F_WRITE, \
+      sizeof(uint16_t), "Measurement interval (ms)", interval_fmt, &interval_range) \
+    X(DEADBAND, BLETEMP_UUID128(0xFD12), BLETEMP_GATT_F_READ | BLETEMP_GATT_F_WRITE, \
+      sizeof(deadband_struct), NULL, NULL, NULL) \
+    X(DIAG,     BLETEMP_UUID128(0xFE01), BLETEMP_GATT_F_READ, \
+      sizeof(diag_struct), NULL, NULL, NULL) \
+    X(RTT,      BLETEMP_UUID128(0xFE37), BLETEMP_GATT_F_READ, \
+      sizeof(rtt_struct), NULL, NULL, NULL) \
+    X(JITTER,   BLETEMP_UUID128(0xFE6A), BLETEMP_GATT_F_READ, \
+      sizeof(jitter_struct), NULL, NULL, NULL) \
+    X(POWER,    BLETEMP_UUID128(0xFE9D), BLETEMP_GATT_F_READ, \
+      sizeof(power_struct), NULL, NULL, NULL) \
+    X(AGGREGATE, BLETEMP_UUID128(0xFCB1), BLETEMP_GATT_F_READ, \
+      sizeof(aggregate_struct), NULL, NULL, NULL)
+
+#define BLETEMP_GATT_SENSOR(X, id, uuid, max_len, fmt) \
+    X(id, uuid, BLETEMP_GATT_F_READ | BLETEMP_GATT_F_NOTIFY | BLETEMP_GATT_F_INDICATE, \
+      max_len, NULL, fmt, NULL)
+
+/* Short UUID of the service in its own base UUID */
+#define BLETEMP_GATT_SVC_UUID   0xF656
+
+#define BLETEMP_UUID16(v)       (v)
+#define BLETEMP_UUID128(v)      (0x10000 | (v))
+
+#define BLETEMP_GATT_F_READ     0x01
+#define BLETEMP_GATT_F_WRITE    0x02
+#define BLETEMP_GATT_F_NOTIFY   0x04
+#define BLETEMP_GATT_F_INDICATE 0x08
+
+#define BLETEMP_GATT_FMT_LEN    7
+
+struct bletemp_gatt_range {
+    const uint8_t *data;
+    uint8_t len;
+};
+
+struct bletemp_gatt_chr {
+    uint32_t uuid;          /* BLETEMP_UUID16() or BLETEMP_UUID128() */
+    uint8_t flags;
+    uint16_t max_len;
+    const char *desc;
+    const uint8_t *fmt;
+    const struct bletemp_gatt_range *range;
+};
+
+/* Indexed by enum bletemp_chr */
+extern const struct bletemp_gatt_chr bletemp_gatt_chrs[];
+
+/*
+ * Copies the presentation format of a characteristic that has one, a
+ * Celsius unit swapped for unit, as the value is converted to it
+ */
+void bletemp_gatt_fmt(const struct bletemp_gatt_chr *def, uint8_t unit,
+                      uint8_t out[BLETEMP_GATT_FMT_LEN]);
+
+/* Full UUID of a BLETEMP_UUID128() short UUID or of the service */
+void bletemp_gatt_uuid128(uint32_t uuid, uint8_t out[16]);
+
+/*
+ * Attribute handle to characteristic, filled once as the stack registers
+ * the service so that every access is an array lookup, however many
+ * characteristics the service has. The handles of a service are
+ * contiguous; slot i stands for handle base + i.
+ */
+#define BLETEMP_GATT_MAP_NONE   0xFF
+#define BLETEMP_GATT_MAP_CFG    0x80    /* the CCCD rather than the value */
+
+/* Attributes of the service: declaration, then per characteristic a
+ * declaration, the value, a CCCD and up to three descriptors */
+#define BLETEMP_GATT_MAP_MAX    (1 + BLETEMP_CHR_COUNT * 6)
+
+struct bletemp_gatt_map {
+    uint16_t base;          /* handle of the service declaration */
+    uint16_t len;
+    uint8_t *slot;          /* len entries, chr | BLETEMP_GATT_MAP_CFG */
+};
+
+void bletemp_gatt_map_init(struct bletemp_gatt_map *map, uint16_t base,
+                           uint8_t *slot, uint16_t len);
+/* Returns -1 when the handle falls outside the service */
+int bletemp_gatt_map_add(struct bletemp_gatt_map *map, uint16_t handle, uint8_t entry);
+/* The entry added for handle, -1 if none */
+int bletemp_gatt_map_get(const struct bletemp_gatt_map *map, uint16_t handle);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef H_BLETEMP_LOAD_
+#define H_BLETEMP_LOAD_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Starts logging, every CONFIG_BLETEMP_TASK_LOAD_PERIOD_MS, the share of
+ * its core each task used over the period. Does nothing unless
+ * CONFIG_BLETEMP_TASK_LOAD is set.
+ */
+int bletemp_load_start(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef H_BLETEMP_PM_
+#define H_BLETEMP_PM_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Power saving with CONFIG_BLETEMP_POWER_SAVE: the CPU runs at the XTAL
+ * frequency and the chip light-sleeps whenever it idles, except between
+ * bletemp_pm_acquire() and bletemp_pm_release(), which the sampling and
+ * sending code wraps its work in. The time in each state is what the
+ * power characteristic reads, through bletemp_port_power().
+ *
+ * Without the option the chip never sleeps, everything but the
+ * accounting is a no-op and all of the time counts as active.
+ */
+int bletemp_pm_init(void);
+
+/* Full clock and no sleep until the matching release, may nest */
+void bletemp_pm_acquire(void);
+void bletemp_pm_release(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
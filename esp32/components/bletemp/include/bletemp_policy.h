@@ -0,0 +1,41 @@
+#ifndef H_BLETEMP_POLICY_
+#define H_BLETEMP_POLICY_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Connection parameter policy: short intervals while notifications are
+ * frequent, long intervals and slave latency while the link is idle.
+ */
+
+/* How long notifications are counted before the choice is revisited */
+#define BLETEMP_POLICY_WINDOW_MS 30000
+
+/* Connection parameters in HCI units */
+struct bletemp_conn_params {
+    uint16_t itvl_min;      /* 1.25 ms */
+    uint16_t itvl_max;      /* 1.25 ms */
+    uint16_t latency;       /* connection events the peripheral may skip */
+    uint16_t timeout;       /* supervision timeout, 10 ms */
+};
+
+/*
+ * Picks the parameters for a connection that expects one notification
+ * every period_ms (0 for none) while subscribers centrals share the radio.
+ */
+void bletemp_policy_select(uint32_t period_ms, int subscribers,
+                           struct bletemp_conn_params *params);
+
+/* True when the link already runs with parameters acceptable for params */
+int bletemp_policy_satisfied(const struct bletemp_conn_params *params,
+                             uint16_t itvl, uint16_t latency);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef H_BLETEMP_PORT_
+#define H_BLETEMP_PORT_
+
+#include <stdint.h>
+
+#ifdef ESP_PLATFORM
+#include "sdkconfig.h"
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Platform services used by the thermometer core. Implemented by
+ * bletemp_port_esp32.c on the target and by esp32/host on Linux.
+ */
+
+void bletemp_port_init(void);
+
+/* Milliseconds since boot */
+uint32_t bletemp_port_time_ms(void);
+
+/* Recursive lock guarding the connection table */
+void bletemp_port_lock(void);
+void bletemp_port_unlock(void);
+
+/* Power characteristic value: where the time since boot went, ms */
+typedef struct {
+    uint32_t active;        /* sampling and sending, at full clock */
+    uint32_t modem;         /* awake otherwise, radio asleep between events */
+    uint32_t sleep;         /* light sleep */
+} __attribute__ ((packed)) power_struct;
+
+/* Time awake and asleep so far, bletemp_pm.c on the target */
+void bletemp_port_power(power_struct *power);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
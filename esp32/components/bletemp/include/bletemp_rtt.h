@@ -0,0 +1,43 @@
+#ifndef H_BLETEMP_RTT_
+#define H_BLETEMP_RTT_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Round trip of indications, from one going on air to the central's
+ * confirmation, over the last BLETEMP_RTT_WINDOW indications of
+ * all connections. Not locked, the core calls it with the port lock held.
+ */
+
+#define BLETEMP_RTT_WINDOW  64
+
+/* Buckets below 8, 16, ... 512 ms and one for anything longer */
+#define BLETEMP_RTT_BUCKETS 8
+#define BLETEMP_RTT_FIRST_MS 8
+
+/* Indication statistics characteristic value */
+typedef struct {
+    uint16_t count[BLETEMP_RTT_BUCKETS];    /* confirmations per bucket */
+    uint16_t lost;          /* indications that failed or were never confirmed */
+    uint16_t max;           /* longest round trip, ms */
+} __attribute__ ((packed)) rtt_struct;
+
+void bletemp_rtt_reset(void);
+
+/* Records a confirmation after ms */
+void bletemp_rtt_add(uint32_t ms);
+
+/* Records an indication that was not confirmed */
+void bletemp_rtt_lost(void);
+
+void bletemp_rtt_get(rtt_struct *rtt);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
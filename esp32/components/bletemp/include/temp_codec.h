@@ -0,0 +1,79 @@
+#ifndef H_TEMP_CODEC_
+#define H_TEMP_CODEC_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "temp_history.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Compact history batch, the payload of history notifications, reads and
+ * CoC SDUs. A header carries the first sample, then every further sample
+ * is a bit-packed pair, most significant bit first:
+ *
+ *   timestamp delta-of-delta, ms    temperature delta, 10^scale units
+ *     0                 0             0                 0
+ *     10  + 7 bits      -64..63       10  + 3 bits      -4..3
+ *     110 + 12 bits     -2048..2047   110 + 7 bits      -64..63
+ *     111 + 24 bits     otherwise     111 + 16 bits     otherwise, mod 2^16
+ *
+ * The first delta-of-delta is taken against a delta of 0. A regular
+ * sampling period costs one bit per timestamp; a sample whose timestamp
+ * cannot be coded starts the next batch. The format byte comes first and
+ * is never a unit character, so it cannot be mistaken for the raw batches
+ * of 6-byte samples sent before, which started with the unit.
+ */
+
+#define TEMP_CODEC_V1       0x01
+
+/* Decimal exponent of the temperatures, hundredths of a degree */
+#define TEMP_CODEC_SCALE    (-2)
+
+/* Largest coded sample, in bits */
+#define TEMP_CODEC_MAX_BITS (3 + 24 + 3 + 16)
+
+typedef struct {
+    uint8_t format;         /* TEMP_CODEC_V1 */
+    uint8_t unit;           /* 'C' or 'F' */
+    int8_t scale;           /* TEMP_CODEC_SCALE */
+    uint8_t count;          /* samples in the batch, 0 for an empty one */
+    uint32_t timestamp;     /* first sample */
+    int16_t temperature;
+} __attribute__ ((packed)) temp_codec_hdr;
+
+/* Batch being built in a caller supplied buffer */
+struct temp_codec_enc {
+    uint8_t *buf;
+    uint16_t len;
+    uint32_t bits;          /* written after the header */
+    uint32_t timestamp;     /* last sample, the base for the next one */
+    int32_t delta;
+    int16_t temperature;
+    uint8_t count;
+};
+
+/* Starts an empty batch of samples in unit; len must hold the header */
+void temp_codec_begin(struct temp_codec_enc *enc, uint8_t unit, uint8_t *buf, uint16_t len);
+
+/* Appends a sample; false when it does not fit, the batch is unchanged */
+bool temp_codec_put(struct temp_codec_enc *enc, uint32_t timestamp, int16_t temperature);
+
+/* Completes the header and returns the length of the batch */
+uint16_t temp_codec_end(struct temp_codec_enc *enc);
+
+/*
+ * Decodes up to max samples of a batch into out and stores its unit.
+ * Returns the number of samples, -1 for an unknown format or a batch cut
+ * short.
+ */
+int temp_codec_decode(const uint8_t *buf, uint16_t len, uint8_t *unit,
+                      temp_sample *out, uint16_t max);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef H_TEMP_CONVERT_CYCLES_
+#define H_TEMP_CONVERT_CYCLES_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Logs the CPU cycles one Celsius to Fahrenheit conversion takes on the
+ * target, temp_convert() against the double precision expression it
+ * replaced, which the ESP32 runs in software. The host benchmark only
+ * gives nanoseconds on the build machine. Does nothing unless
+ * CONFIG_BLETEMP_CONVERT_CYCLES is set.
+ */
+void temp_convert_cycles_log(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
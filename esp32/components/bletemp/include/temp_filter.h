@@ -0,0 +1,74 @@
+#ifndef H_TEMP_FILTER_
+#define H_TEMP_FILTER_
+
+#include <stdint.h>
+
+#ifdef ESP_PLATFORM
+#include "sdkconfig.h"
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Between the sensor and the history: each sample is the mean of
+ * TEMP_FILTER_OVERSAMPLE readings, then the median of the last
+ * TEMP_FILTER_MEDIAN such means, which drops single spikes. The samples
+ * are also summarised per TEMP_AGGREGATE_WINDOW_MS window for the
+ * aggregate characteristic. Integer arithmetic and fixed buffers only.
+ */
+#ifdef CONFIG_BLETEMP_FILTER_OVERSAMPLE
+#define TEMP_FILTER_OVERSAMPLE      CONFIG_BLETEMP_FILTER_OVERSAMPLE
+#else
+#define TEMP_FILTER_OVERSAMPLE      4
+#endif
+
+/* Odd, 1 turns the median off */
+#ifdef CONFIG_BLETEMP_FILTER_MEDIAN
+#define TEMP_FILTER_MEDIAN          CONFIG_BLETEMP_FILTER_MEDIAN
+#else
+#define TEMP_FILTER_MEDIAN          3
+#endif
+
+#ifdef CONFIG_BLETEMP_AGGREGATE_WINDOW_S
+#define TEMP_AGGREGATE_WINDOW_MS    (CONFIG_BLETEMP_AGGREGATE_WINDOW_S * 1000)
+#else
+#define TEMP_AGGREGATE_WINDOW_MS    60000
+#endif
+
+/* Aggregate characteristic value: the last complete window */
+typedef struct {
+    uint32_t start;         /* ms since boot */
+    uint32_t duration;      /* ms */
+    uint32_t count;         /* samples, 0 until a window completes */
+    int16_t min;            /* hundredths of a degree */
+    int16_t max;
+    int16_t mean;
+    uint16_t stddev;
+    uint8_t unit;
+} __attribute__ ((packed)) aggregate_struct;
+
+/* Sensor reading in hundredths of a degree Celsius */
+typedef int16_t (*temp_filter_read_fn)(void);
+
+void temp_filter_init(void);
+
+/*
+ * Reads the sensor TEMP_FILTER_OVERSAMPLE times and returns the filtered
+ * sample. Must only be called from the sampling task, as must
+ * temp_aggregate_add().
+ */
+int16_t temp_filter_sample(temp_filter_read_fn read);
+
+/* Adds a sample to the current window, completing it when timestamp is past its end */
+void temp_aggregate_add(uint32_t timestamp, int16_t temperature);
+
+/* Copies the last complete window, in Celsius */
+void temp_aggregate_get(aggregate_struct *aggregate);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
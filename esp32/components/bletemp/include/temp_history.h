@@ -0,0 +1,66 @@
+#ifndef H_TEMP_HISTORY_
+#define H_TEMP_HISTORY_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Number of samples kept in RAM (must be a power of two) */
+#define TEMP_HISTORY_LEN 256
+
+/* Largest attribute value a client can receive in one notification */
+#define TEMP_HISTORY_MAX_PAYLOAD 512
+
+/* One timestamped sample as sent over the air */
+typedef struct {
+    uint32_t timestamp;     /* ms since boot */
+    int16_t temperature;    /* hundredths of a degree */
+} __attribute__ ((packed)) temp_sample;
+
+void temp_history_init(void);
+
+/* Appends a Celsius sample, overwriting the oldest one when full.
+ * Must only be called from the sampling task. */
+void temp_history_push(uint32_t timestamp, int16_t temperature);
+
+/* Sequence number of the oldest sample still held */
+uint32_t temp_history_oldest(void);
+
+/* Sequence number the next pushed sample will get */
+uint32_t temp_history_head(void);
+
+/* Number of samples available past cursor */
+uint32_t temp_history_pending(uint32_t cursor);
+
+/* Copies the newest sample; false until the first sample is pushed */
+bool temp_history_latest(temp_sample *sample);
+
+/*
+ * Number of samples a batch of payload_len bytes holds at least; regular
+ * samples pack several times denser
+ */
+uint16_t temp_history_batch_size(uint16_t payload_len);
+
+/*
+ * Packs as many samples past *cursor as fit in buf into a temp_codec
+ * batch, converted to unit, and advances *cursor. Returns the number of
+ * bytes written (0 when there is nothing to send).
+ */
+uint16_t temp_history_encode(uint32_t *cursor, uint8_t unit,
+                             uint8_t *buf, uint16_t buf_len);
+
+/*
+ * Converts a Celsius reading to the requested unit ('C' or 'F'), both in
+ * hundredths of a degree. Integer only and rounded to nearest; readings
+ * outside -199.82 to 164.26 C saturate in Fahrenheit.
+ */
+int16_t temp_convert(int16_t celsius, uint8_t unit);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef H_TEMP_ISQRT_
+#define H_TEMP_ISQRT_
+
+#include <stdint.h>
+
+/* Integer square root, rounded down; for standard deviations without floats */
+static inline uint32_t temp_isqrt(uint64_t v) {
+    uint64_t r = 0, bit = (uint64_t)1 << 62;
+
+    while (bit > v) {
+        bit >>= 2;
+    }
+    while (bit != 0) {
+        if (v >= r + bit) {
+            v -= r + bit;
+            r = (r >> 1) + bit;
+        } else {
+            r >>= 1;
+        }
+        bit >>= 2;
+    }
+    return r;
+}
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef H_TEMP_JITTER_
+#define H_TEMP_JITTER_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Spacing of the samples: the time between the timer captures of
+ * consecutive samples against the period they were meant to be apart.
+ * One writer, the sampler; readers never block it and retry instead.
+ */
+
+/* Sampling jitter characteristic value, microseconds */
+typedef struct {
+    uint32_t count;         /* intervals since the period was last set */
+    uint32_t period;        /* nominal interval */
+    uint32_t min;
+    uint32_t max;
+    uint32_t stddev;        /* of the intervals */
+} __attribute__ ((packed)) jitter_struct;
+
+/* Starts over for samples period_us apart */
+void temp_jitter_reset(uint32_t period_us);
+
+/* Records the interval between two samples */
+void temp_jitter_add(uint32_t interval_us);
+
+void temp_jitter_get(jitter_struct *jitter);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef H_TEMP_LOG_
+#define H_TEMP_LOG_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "temp_history.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Append-only sample log on flash, kept across reboots. Samples are
+ * delta encoded into program pages of TEMP_LOG_PAGE_SIZE bytes, each
+ * written once; the log runs through the region as a ring, erasing the
+ * oldest sector when it needs room, so every sector sees one erase per
+ * lap. Each page starts with a header holding its first sample, which
+ * doubles as the index for range queries.
+ *
+ * Timestamps carry on from the last sample on flash after a reboot, so
+ * the log stays ordered although the sampler counts from boot: the log
+ * stamps a sample with its ms since boot plus temp_log_time_base(), and
+ * queries take and return timestamps on that timebase, not the one of
+ * the RAM history. The time the device was off is not counted.
+ *
+ * Neither side takes a lock: the sampler appends without waiting on
+ * readers, and a read that raced an append copies the RAM state again,
+ * so the BLE side is never kept waiting on flash either.
+ */
+
+/* Flash program page, the unit written at once */
+#define TEMP_LOG_PAGE_SIZE 256
+
+/* Storage the log runs on: the flash partition or a file on the host */
+struct temp_log_flash {
+    uint32_t size;          /* bytes, a multiple of sector_size */
+    uint32_t sector_size;   /* erase unit, a multiple of TEMP_LOG_PAGE_SIZE */
+    int (*read)(void *ctx, uint32_t offset, void *buf, size_t len);
+    int (*write)(void *ctx, uint32_t offset, const void *buf, size_t len);
+    int (*erase)(void *ctx, uint32_t offset);   /* one sector */
+    void *ctx;
+};
+
+/* Header at the start of every page */
+typedef struct {
+    uint32_t seq;           /* page number since the log was created */
+    uint32_t timestamp;     /* first sample */
+    int16_t temperature;
+    uint16_t count;         /* samples in the page */
+    uint16_t len;           /* encoded bytes after the header */
+    uint16_t crc;           /* CRC-16/CCITT of the page with crc set to 0 */
+} __attribute__ ((packed)) temp_log_page_hdr;
+
+/*
+ * Finds the newest page and resumes after it. Returns -1 when flash is
+ * NULL or its geometry does not fit, leaving the log disabled.
+ */
+int temp_log_init(const struct temp_log_flash *flash);
+
+/* Adds a sample stamped in ms since boot; must only be called from one task */
+int temp_log_append(uint32_t timestamp, int16_t temperature);
+
+/* Writes the samples still buffered in RAM as a partial page; same task as appends */
+int temp_log_flush(void);
+
+/*
+ * Copies up to max samples with from <= timestamp <= to, oldest first,
+ * including the ones not yet written. Returns the number copied; call
+ * again with from past the last one for more. Log timestamps throughout.
+ */
+size_t temp_log_query(uint32_t from, uint32_t to, temp_sample *out, size_t max);
+
+/* Log timestamp of the oldest sample held, false when the log is empty */
+bool temp_log_oldest(uint32_t *timestamp);
+
+/* Log timestamp of the newest sample, false when the log is empty */
+bool temp_log_newest(uint32_t *timestamp);
+
+/*
+ * Log timestamp of the moment of boot: a sample taken since is stamped
+ * its ms since boot plus this, the ones from earlier boots lie below it
+ */
+uint32_t temp_log_time_base(void);
+
+#ifdef ESP_PLATFORM
+/* Flash operations on the data partition with the given label, NULL if absent */
+const struct temp_log_flash *temp_log_partition(const char *label);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef H_TEMP_SAMPLER_
+#define H_TEMP_SAMPLER_
+
+#include <stdint.h>
+#include "temp_history.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Called from the sampling task after each new sample is published */
+typedef void (*temp_sampler_cb)(void);
+
+/*
+ * Starts the task that reads the sensor every period_ms and pushes the
+ * samples into the history ring, and into the flash log when one was
+ * opened beforehand. BLE callbacks only ever read the ring. The task runs
+ * on CONFIG_BLETEMP_APP_CORE, away from the BLE stack, and is woken by an
+ * esp_timer whose callback timestamps the sample, so the timestamps and
+ * the temp_jitter statistics don't include how late the task got to run.
+ */
+int temp_sampler_start(uint32_t period_ms, temp_sampler_cb cb);
+
+/*
+ * Changes the period without restarting the task. The timer is restarted,
+ * so the next sample is period_ms from now, and the jitter statistics
+ * start over.
+ */
+int temp_sampler_set_period(uint32_t period_ms);
+
+/* Least free stack the sampling task has had so far, in bytes */
+uint32_t temp_sampler_stack_free(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,200 @@
+#include <string.h>
+#include "temp_codec.h"
+
+#define HDR_SIZE sizeof(temp_codec_hdr)
+
+/* Value widths of the three coded tiers, the last one is the escape */
+static const uint8_t ts_bits[] = { 7, 12, 24 };
+static const uint8_t temp_bits[] = { 3, 7, 16 };
+
+/* Tier prefixes 10, 110 and 111 */
+static const uint8_t prefix[] = { 0x2, 0x6, 0x7 };
+static const uint8_t prefix_len[] = { 2, 3, 3 };
+
+/* Tier holding a non-zero v, 3 when it does not even fit the escape */
+static int tier(int32_t v, const uint8_t *bits) {
+    int i;
+
+    for (i = 0; i < 3; i++) {
+        if (v >= -(1 << (bits[i] - 1)) && v < (1 << (bits[i] - 1))) {
+            return i;
+        }
+    }
+    return 3;
+}
+
+/* Coded length of v in bits, v must fit */
+static uint32_t code_len(int32_t v, const uint8_t *bits) {
+    int t;
+
+    if (v == 0) {
+        return 1;
+    }
+    t = tier(v, bits);
+    return prefix_len[t] + bits[t];
+}
+
+static void put_bits(uint8_t *p, uint32_t pos, uint32_t v, uint8_t n) {
+    while (n--) {
+        if (v & (1u << n)) {
+            p[pos >> 3] |= 0x80 >> (pos & 7);
+        } else {
+            p[pos >> 3] &= ~(0x80 >> (pos & 7));
+        }
+        pos++;
+    }
+}
+
+/* Writes v at bit pos and returns the position after it */
+static uint32_t put_code(uint8_t *p, uint32_t pos, int32_t v, const uint8_t *bits) {
+    int t;
+
+    if (v == 0) {
+        put_bits(p, pos, 0, 1);
+        return pos + 1;
+    }
+    t = tier(v, bits);
+    put_bits(p, pos, prefix[t], prefix_len[t]);
+    put_bits(p, pos + prefix_len[t], (uint32_t)v & ((1u << bits[t]) - 1), bits[t]);
+    return pos + prefix_len[t] + bits[t];
+}
+
+void temp_codec_begin(struct temp_codec_enc *enc, uint8_t unit, uint8_t *buf, uint16_t len) {
+    memset(enc, 0, sizeof(*enc));
+    enc->buf = buf;
+    enc->len = len;
+    if (len >= HDR_SIZE) {
+        ((temp_codec_hdr *)buf)->unit = unit;
+    }
+}
+
+bool temp_codec_put(struct temp_codec_enc *enc, uint32_t timestamp, int16_t temperature) {
+    temp_codec_hdr *hdr = (temp_codec_hdr *)enc->buf;
+    int32_t delta, dod;
+    int16_t dtemp;
+    uint32_t need;
+
+    if (enc->len < HDR_SIZE || enc->count == UINT8_MAX) {
+        return false;
+    }
+
+    if (enc->count == 0) {
+        hdr->timestamp = timestamp;
+        hdr->temperature = temperature;
+    } else {
+        delta = (int32_t)(timestamp - enc->timestamp);
+        dod = delta - enc->delta;
+        dtemp = (int16_t)(temperature - enc->temperature);
+        if (tier(dod, ts_bits) > 2) {
+            return false;
+        }
+        need = code_len(dod, ts_bits) + code_len(dtemp, temp_bits);
+        if (HDR_SIZE * 8 + enc->bits + need > enc->len * 8u) {
+            return false;
+        }
+        enc->bits = put_code(enc->buf + HDR_SIZE, enc->bits, dod, ts_bits);
+        enc->bits = put_code(enc->buf + HDR_SIZE, enc->bits, dtemp, temp_bits);
+        enc->delta = delta;
+    }
+    enc->timestamp = timestamp;
+    enc->temperature = temperature;
+    enc->count++;
+    return true;
+}
+
+uint16_t temp_codec_end(struct temp_codec_enc *enc) {
+    temp_codec_hdr *hdr = (temp_codec_hdr *)enc->buf;
+
+    if (enc->len < HDR_SIZE) {
+        return 0;
+    }
+    hdr->format = TEMP_CODEC_V1;
+    hdr->scale = TEMP_CODEC_SCALE;
+    hdr->count = enc->count;
+    if (enc->count == 0) {
+        hdr->timestamp = 0;
+        hdr->temperature = 0;
+    }
+    /* pad the last byte with zeros */
+    if (enc->bits & 7) {
+        enc->buf[HDR_SIZE + enc->bits / 8] &= 0xFF << (8 - (enc->bits & 7));
+    }
+    return HDR_SIZE + (enc->bits + 7) / 8;
+}
+
+/* Reads n bits at *pos, false past end */
+static bool get_bits(const uint8_t *p, uint32_t end, uint32_t *pos, uint8_t n, uint32_t *v) {
+    if (*pos + n > end) {
+        return false;
+    }
+    *v = 0;
+    while (n--) {
+        *v = (*v << 1) | ((p[*pos >> 3] >> (7 - (*pos & 7))) & 1);
+        (*pos)++;
+    }
+    return true;
+}
+
+static bool get_code(const uint8_t *p, uint32_t end, uint32_t *pos, const uint8_t *bits,
+                     int32_t *v) {
+    uint32_t bit, raw;
+    int t;
+
+    /* count the leading ones of the prefix, at most three */
+    for (t = 0; t < 3; t++) {
+        if (!get_bits(p, end, pos, 1, &bit)) {
+            return false;
+        }
+        if (bit == 0) {
+            break;
+        }
+    }
+    if (t == 0) {
+        *v = 0;
+        return true;
+    }
+    t--;
+    if (!get_bits(p, end, pos, bits[t], &raw)) {
+        return false;
+    }
+    /* sign extend */
+    *v = (int32_t)(raw << (32 - bits[t])) >> (32 - bits[t]);
+    return true;
+}
+
+int temp_codec_decode(const uint8_t *buf, uint16_t len, uint8_t *unit,
+                      temp_sample *out, uint16_t max) {
+    temp_codec_hdr hdr;
+    uint32_t pos = 0, end, ts;
+    int32_t delta = 0, dod, dtemp;
+    int16_t temp;
+    uint16_t i, n;
+
+    if (len < HDR_SIZE) {
+        return -1;
+    }
+    memcpy(&hdr, buf, sizeof(hdr));
+    if (hdr.format != TEMP_CODEC_V1 || hdr.scale != TEMP_CODEC_SCALE) {
+        return -1;
+    }
+    *unit = hdr.unit;
+
+    n = (hdr.count < max) ? hdr.count : max;
+    end = (len - HDR_SIZE) * 8;
+    ts = hdr.timestamp;
+    temp = hdr.temperature;
+    for (i = 0; i < n; i++) {
+        if (i > 0) {
+            if (!get_code(buf + HDR_SIZE, end, &pos, ts_bits, &dod) ||
+                !get_code(buf + HDR_SIZE, end, &pos, temp_bits, &dtemp)) {
+                return -1;
+            }
+            delta += dod;
+            ts += delta;
+            temp += dtemp;
+        }
+        out[i].timestamp = ts;
+        out[i].temperature = temp;
+    }
+    return n;
+}
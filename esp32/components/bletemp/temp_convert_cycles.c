@@ -0,0 +1,72 @@
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_idf_version.h"
+#include "temp_history.h"
+#include "temp_convert_cycles.h"
+
+#if CONFIG_BLETEMP_CONVERT_CYCLES
+
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+#include "esp_cpu.h"
+#define cycles_now() esp_cpu_get_cycle_count()
+#else
+#include "soc/cpu.h"
+#define cycles_now() esp_cpu_get_ccount()
+#endif
+
+#define CYCLES_TAG "CYCLES"
+
+/* Conversions per run, the loop overhead is in both figures */
+#define CYCLES_RUNS 1000
+
+static portMUX_TYPE cycles_mux = portMUX_INITIALIZER_UNLOCKED;
+
+/* Defeats the optimiser, every conversion is summed in */
+static volatile int32_t sink;
+
+/* What temp_convert() did before, in double precision */
+static int16_t convert_float(int16_t celsius, uint8_t unit) {
+    if (unit == 'F') {
+        return (celsius * 1.8) + 32;
+    }
+    return celsius;
+}
+
+/* Cycles of CYCLES_RUNS conversions; no interrupt or core switch counts in */
+static uint32_t cycles_run(int16_t (*convert)(int16_t, uint8_t)) {
+    uint32_t start, end;
+    int32_t sum = 0;
+    int i;
+
+    portENTER_CRITICAL(&cycles_mux);
+    start = cycles_now();
+    for (i = 0; i < CYCLES_RUNS; i++) {
+        /* readings spread over the whole range */
+        sum += convert((int16_t)(i * 65), 'F');
+    }
+    end = cycles_now();
+    portEXIT_CRITICAL(&cycles_mux);
+
+    sink = sum;
+    return end - start;
+}
+
+void temp_convert_cycles_log(void) {
+    uint32_t fixed, flt;
+
+    /* a first run of each to fill the cache */
+    cycles_run(temp_convert);
+    cycles_run(convert_float);
+    fixed = cycles_run(temp_convert);
+    flt = cycles_run(convert_float);
+    ESP_LOGI(CYCLES_TAG, "temp_convert %u.%u cycles, float %u.%u cycles per conversion",
+             (unsigned)(fixed / CYCLES_RUNS), (unsigned)(fixed * 10 / CYCLES_RUNS % 10),
+             (unsigned)(flt / CYCLES_RUNS), (unsigned)(flt * 10 / CYCLES_RUNS % 10));
+}
+
+#else
+
+void temp_convert_cycles_log(void) {
+}
+
+#endif
@@ -0,0 +1,145 @@
+#include <stdbool.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "temp_filter.h"
+#include "temp_isqrt.h"
+
+#if TEMP_FILTER_OVERSAMPLE < 1 || TEMP_FILTER_MEDIAN < 1 || (TEMP_FILTER_MEDIAN & 1) == 0
+#error "TEMP_FILTER_OVERSAMPLE must be positive and TEMP_FILTER_MEDIAN odd"
+#endif
+
+/* The last means, the median is taken over the valid ones */
+static int16_t median_buf[TEMP_FILTER_MEDIAN];
+static uint8_t median_next, median_valid;
+
+/*
+ * Window being filled, sampler only. Deviations from the first sample
+ * are summed, which keeps the squares small.
+ */
+struct aggregate_acc {
+    bool started;
+    uint32_t start;
+    uint32_t count;
+    int16_t first;
+    int16_t min;
+    int16_t max;
+    int64_t sum;
+    uint64_t sum_sq;
+};
+
+static struct aggregate_acc acc;
+
+/* Last complete window; seq is odd while the sampler replaces it */
+static atomic_uint_least32_t seq;
+static aggregate_struct last;
+
+void temp_filter_init(void) {
+    median_next = 0;
+    median_valid = 0;
+    memset(&acc, 0, sizeof(acc));
+
+    atomic_store_explicit(&seq, 0, memory_order_relaxed);
+    memset(&last, 0, sizeof(last));
+    last.unit = 'C';
+}
+
+static int16_t median(void) {
+    int16_t v[TEMP_FILTER_MEDIAN], t;
+    int i, j;
+
+    /* insertion sort, a handful of values */
+    for (i = 0; i < median_valid; i++) {
+        t = median_buf[i];
+        for (j = i; j > 0 && v[j - 1] > t; j--) {
+            v[j] = v[j - 1];
+        }
+        v[j] = t;
+    }
+    return v[median_valid / 2];
+}
+
+int16_t temp_filter_sample(temp_filter_read_fn read) {
+    int32_t sum = 0;
+    int i;
+
+    for (i = 0; i < TEMP_FILTER_OVERSAMPLE; i++) {
+        sum += read();
+    }
+    /* rounded to nearest */
+    sum += (sum < 0) ? -TEMP_FILTER_OVERSAMPLE / 2 : TEMP_FILTER_OVERSAMPLE / 2;
+
+    median_buf[median_next] = sum / TEMP_FILTER_OVERSAMPLE;
+    median_next = (median_next + 1) % TEMP_FILTER_MEDIAN;
+    if (median_valid < TEMP_FILTER_MEDIAN) {
+        median_valid++;
+    }
+    return median();
+}
+
+static void aggregate_publish(uint32_t end) {
+    int64_t n = acc.count, q, r;
+    uint64_t sq;
+    uint32_t s;
+
+    s = atomic_load_explicit(&seq, memory_order_relaxed);
+    atomic_store_explicit(&seq, s + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    last.start = acc.start;
+    last.duration = end - acc.start;
+    last.count = acc.count;
+    last.min = acc.min;
+    last.max = acc.max;
+    /* rounded to nearest */
+    last.mean = acc.first + (acc.sum + ((acc.sum < 0) ? -n / 2 : n / 2)) / n;
+    /* n var = sum_sq - sum^2 / n, the square split so that nothing overflows */
+    q = acc.sum / n;
+    r = acc.sum % n;
+    sq = acc.sum * q + acc.sum * r / n;
+    last.stddev = temp_isqrt((acc.sum_sq > sq) ? (acc.sum_sq - sq) / n : 0);
+
+    atomic_store_explicit(&seq, s + 2, memory_order_release);
+}
+
+void temp_aggregate_add(uint32_t timestamp, int16_t temperature) {
+    int32_t d;
+
+    if (!acc.started) {
+        acc.started = true;
+        acc.start = timestamp;
+    } else if (timestamp - acc.start >= TEMP_AGGREGATE_WINDOW_MS) {
+        aggregate_publish(acc.start + TEMP_AGGREGATE_WINDOW_MS);
+        /* windows stay aligned, skipping any without samples */
+        acc.start += (timestamp - acc.start) / TEMP_AGGREGATE_WINDOW_MS * TEMP_AGGREGATE_WINDOW_MS;
+        acc.count = 0;
+    }
+    if (acc.count == 0) {
+        acc.first = temperature;
+        acc.min = temperature;
+        acc.max = temperature;
+        acc.sum = 0;
+        acc.sum_sq = 0;
+    }
+
+    d = temperature - acc.first;
+    acc.count++;
+    acc.sum += d;
+    acc.sum_sq += (uint64_t)((int64_t)d * d);
+    if (temperature < acc.min) {
+        acc.min = temperature;
+    }
+    if (temperature > acc.max) {
+        acc.max = temperature;
+    }
+}
+
+void temp_aggregate_get(aggregate_struct *aggregate) {
+    uint32_t s;
+
+    do {
+        s = atomic_load_explicit(&seq, memory_order_acquire);
+        memcpy(aggregate, &last, sizeof(*aggregate));
+        atomic_thread_fence(memory_order_acquire);
+        /* retry if the sampler was, or started, replacing it while copying */
+    } while ((s & 1) || atomic_load_explicit(&seq, memory_order_relaxed) != s);
+}
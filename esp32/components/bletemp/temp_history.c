@@ -0,0 +1,137 @@
+#include <string.h>
+#include <stdatomic.h>
+#include "temp_codec.h"
+#include "temp_history.h"
+
+/*
+ * Single-producer ring: the sampler owns the slots and publishes them by
+ * advancing head with release semantics. Readers never block the producer;
+ * they copy slots and then re-check head to discard anything that may have
+ * been overwritten while copying.
+ */
+
+#define TEMP_HISTORY_MASK (TEMP_HISTORY_LEN - 1)
+
+static temp_sample samples[TEMP_HISTORY_LEN];
+static atomic_uint_least32_t head;  /* sequence number of the next sample */
+
+/* Oldest sequence number that cannot be overwritten before head moves on */
+static uint32_t oldest_stable(uint32_t seq) {
+    return (seq >= TEMP_HISTORY_LEN) ? seq - TEMP_HISTORY_LEN + 1 : 0;
+}
+
+void temp_history_init(void) {
+    atomic_store_explicit(&head, 0, memory_order_relaxed);
+}
+
+void temp_history_push(uint32_t timestamp, int16_t temperature) {
+    uint32_t seq = atomic_load_explicit(&head, memory_order_relaxed);
+
+    samples[seq & TEMP_HISTORY_MASK].timestamp = timestamp;
+    samples[seq & TEMP_HISTORY_MASK].temperature = temperature;
+    atomic_store_explicit(&head, seq + 1, memory_order_release);
+}
+
+uint32_t temp_history_head(void) {
+    return atomic_load_explicit(&head, memory_order_acquire);
+}
+
+uint32_t temp_history_oldest(void) {
+    return oldest_stable(temp_history_head());
+}
+
+uint32_t temp_history_pending(uint32_t cursor) {
+    uint32_t seq = temp_history_head();
+    uint32_t oldest = oldest_stable(seq);
+
+    if (cursor < oldest) {
+        cursor = oldest;
+    }
+    return (seq > cursor) ? seq - cursor : 0;
+}
+
+bool temp_history_latest(temp_sample *sample) {
+    uint32_t seq;
+
+    do {
+        seq = temp_history_head();
+        if (seq == 0) {
+            return false;
+        }
+        memcpy(sample, &samples[(seq - 1) & TEMP_HISTORY_MASK], sizeof(*sample));
+        atomic_thread_fence(memory_order_acquire);
+        /* retry if the producer lapped us while copying */
+    } while (atomic_load_explicit(&head, memory_order_relaxed) - (seq - 1) >= TEMP_HISTORY_LEN);
+
+    return true;
+}
+
+uint16_t temp_history_batch_size(uint16_t payload_len) {
+    uint32_t n;
+
+    if (payload_len > TEMP_HISTORY_MAX_PAYLOAD) {
+        payload_len = TEMP_HISTORY_MAX_PAYLOAD;
+    }
+    if (payload_len < sizeof(temp_codec_hdr)) {
+        return 0;
+    }
+    /* the first sample rides in the header, the others take at most TEMP_CODEC_MAX_BITS */
+    n = 1 + (payload_len - sizeof(temp_codec_hdr)) * 8 / TEMP_CODEC_MAX_BITS;
+    return (n > UINT8_MAX) ? UINT8_MAX : n;
+}
+
+uint16_t temp_history_encode(uint32_t *cursor, uint8_t unit,
+                             uint8_t *buf, uint16_t buf_len) {
+    struct temp_codec_enc enc;
+    temp_sample sample;
+    uint32_t first, seq, end;
+
+    if (buf_len > TEMP_HISTORY_MAX_PAYLOAD) {
+        buf_len = TEMP_HISTORY_MAX_PAYLOAD;
+    }
+
+    do {
+        end = temp_history_head();
+        first = (*cursor < oldest_stable(end)) ? oldest_stable(end) : *cursor;
+        if (end <= first) {
+            return 0;
+        }
+
+        temp_codec_begin(&enc, unit, buf, buf_len);
+        for (seq = first; seq < end; seq++) {
+            memcpy(&sample, &samples[seq & TEMP_HISTORY_MASK], sizeof(sample));
+            if (!temp_codec_put(&enc, sample.timestamp, temp_convert(sample.temperature, unit))) {
+                break;
+            }
+        }
+        atomic_thread_fence(memory_order_acquire);
+        /* start over past the samples the producer overwrote while we encoded */
+    } while (oldest_stable(atomic_load_explicit(&head, memory_order_relaxed)) > first);
+
+    if (seq == first) {
+        return 0;
+    }
+    *cursor = seq;
+    return temp_codec_end(&enc);
+}
+
+int16_t temp_convert(int16_t celsius, uint8_t unit) {
+    int32_t f;
+
+    if (unit != 'F') {
+        return celsius;
+    }
+    /*
+     * 9/5 rounded to nearest, a fifth has no halves so that is the floor
+     * of (9c + 2) / 5; biased by 60000 fifths to divide a positive number,
+     * which is the floor without a branch on the sign. Plus 32 degrees.
+     */
+    f = ((int32_t)celsius * 9 + 2 + 5 * 60000) / 5 - 60000 + 3200;
+    if (f > INT16_MAX) {
+        return INT16_MAX;
+    }
+    if (f < INT16_MIN) {
+        return INT16_MIN;
+    }
+    return f;
+}
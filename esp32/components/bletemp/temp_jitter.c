@@ -0,0 +1,85 @@
+#include <string.h>
+#include <stdatomic.h>
+#include "temp_isqrt.h"
+#include "temp_jitter.h"
+
+/*
+ * Deviations from the period are summed rather than the intervals, so the
+ * squares stay small enough for 64 bits over days of samples
+ */
+struct jitter_acc {
+    uint32_t count;
+    uint32_t period;
+    uint32_t min;
+    uint32_t max;
+    int64_t sum;            /* of interval - period */
+    uint64_t sum_sq;
+};
+
+/* Odd while the sampler updates acc */
+static atomic_uint_least32_t seq;
+static struct jitter_acc acc;
+
+static void begin_write(void) {
+    uint32_t s = atomic_load_explicit(&seq, memory_order_relaxed);
+
+    atomic_store_explicit(&seq, s + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+static void end_write(void) {
+    uint32_t s = atomic_load_explicit(&seq, memory_order_relaxed);
+
+    atomic_store_explicit(&seq, s + 1, memory_order_release);
+}
+
+void temp_jitter_reset(uint32_t period_us) {
+    begin_write();
+    memset(&acc, 0, sizeof(acc));
+    acc.period = period_us;
+    acc.min = UINT32_MAX;
+    end_write();
+}
+
+void temp_jitter_add(uint32_t interval_us) {
+    int64_t d = (int64_t)interval_us - acc.period;
+
+    begin_write();
+    acc.count++;
+    if (interval_us < acc.min) {
+        acc.min = interval_us;
+    }
+    if (interval_us > acc.max) {
+        acc.max = interval_us;
+    }
+    acc.sum += d;
+    acc.sum_sq += (uint64_t)(d * d);
+    end_write();
+}
+
+void temp_jitter_get(jitter_struct *jitter) {
+    struct jitter_acc copy;
+    uint32_t s;
+    int64_t mean;
+    uint64_t var;
+
+    do {
+        s = atomic_load_explicit(&seq, memory_order_acquire);
+        copy = acc;
+        atomic_thread_fence(memory_order_acquire);
+        /* retry if the sampler was, or started, updating while copying */
+    } while ((s & 1) || atomic_load_explicit(&seq, memory_order_relaxed) != s);
+
+    jitter->count = copy.count;
+    jitter->period = copy.period;
+    jitter->min = copy.count ? copy.min : 0;
+    jitter->max = copy.max;
+    jitter->stddev = 0;
+    if (copy.count > 1) {
+        /* about the mean interval, not the period */
+        mean = copy.sum / (int64_t)copy.count;
+        var = copy.sum_sq / copy.count;
+        var = (var > (uint64_t)(mean * mean)) ? var - (uint64_t)(mean * mean) : 0;
+        jitter->stddev = temp_isqrt(var);
+    }
+}
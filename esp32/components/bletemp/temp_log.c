@@ -0,0 +1,458 @@
+#include <string.h>
+#include <stdatomic.h>
+#include "temp_log.h"
+
+/*
+ * The sampler is the only writer and takes no lock, so appending never
+ * waits on the BLE side. Page and ring state are updated inside a
+ * sequence count; flash is programmed outside it, and a page is only
+ * counted as part of the ring once it is on flash, so readers either see
+ * the old sector or the new page, never a half-written one they would
+ * take for valid. Readers copy the ring position and the pages still in
+ * RAM, retrying if the sampler updated them meanwhile, then read flash
+ * and skip any page written since the copy, which the copy already holds
+ * or which is newer than what they set out to read.
+ */
+
+#define TEMP_LOG_PAYLOAD (TEMP_LOG_PAGE_SIZE - sizeof(temp_log_page_hdr))
+#define TEMP_LOG_ERASED  0xFFFFFFFF
+
+static const struct temp_log_flash *flash;
+static uint32_t pages;              /* pages in the region */
+static uint32_t pages_per_sector;
+static uint32_t next_page;          /* where the next page goes, oldest page of the ring */
+static uint32_t next_seq;
+static uint32_t time_base;          /* added to the sampler's since-boot timestamps */
+
+/* Page being filled and the last sample in it, the base for the next delta */
+static uint8_t page[TEMP_LOG_PAGE_SIZE];
+static uint32_t last_ts;
+static int16_t last_temp;
+static bool have_last;              /* last_ts is a sample on the log */
+
+/* Full page on its way to flash, still served from RAM until it is there */
+static uint8_t out[TEMP_LOG_PAGE_SIZE];
+static bool out_pending;
+
+/* Odd while the sampler updates the state above */
+static atomic_uint_least32_t state_seq;
+
+static void begin_write(void) {
+    uint32_t s = atomic_load_explicit(&state_seq, memory_order_relaxed);
+
+    atomic_store_explicit(&state_seq, s + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+static void end_write(void) {
+    uint32_t s = atomic_load_explicit(&state_seq, memory_order_relaxed);
+
+    atomic_store_explicit(&state_seq, s + 1, memory_order_release);
+}
+
+/* Starts a read of the state, pass the result to read_retry() after it */
+static uint32_t read_begin(void) {
+    return atomic_load_explicit(&state_seq, memory_order_acquire);
+}
+
+/* True if the sampler was, or started, updating the state while it was read */
+static bool read_retry(uint32_t s) {
+    atomic_thread_fence(memory_order_acquire);
+    return (s & 1) || atomic_load_explicit(&state_seq, memory_order_relaxed) != s;
+}
+
+#define PAGE_HDR(p) ((temp_log_page_hdr *)(p))
+
+/* CRC-16/CCITT-FALSE */
+static uint16_t crc16(const uint8_t *p, size_t len) {
+    uint16_t crc = 0xFFFF;
+    int i;
+
+    while (len--) {
+        crc ^= (uint16_t)*p++ << 8;
+        for (i = 0; i < 8; i++) {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+static uint16_t page_crc(const uint8_t *p) {
+    temp_log_page_hdr hdr;
+    uint16_t crc;
+
+    memcpy(&hdr, p, sizeof(hdr));
+    hdr.crc = 0;
+    crc = crc16((const uint8_t *)&hdr, sizeof(hdr));
+    crc ^= crc16(p + sizeof(hdr), hdr.len);
+    return crc;
+}
+
+/* Zigzag varint, 1 byte for a change of up to +-0.63 C, 2 bytes for 81 s */
+static uint8_t varint_put(uint8_t *p, int32_t v) {
+    uint32_t u = ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+    uint8_t n = 0;
+
+    while (u >= 0x80) {
+        p[n++] = (u & 0x7F) | 0x80;
+        u >>= 7;
+    }
+    p[n++] = u;
+    return n;
+}
+
+static const uint8_t *varint_get(const uint8_t *p, const uint8_t *end, int32_t *v) {
+    uint32_t u = 0;
+    int shift = 0;
+
+    do {
+        if (p == end || shift > 28) {
+            return NULL;
+        }
+        u |= (uint32_t)(*p & 0x7F) << shift;
+        shift += 7;
+    } while (*p++ & 0x80);
+
+    *v = (int32_t)(u >> 1) ^ -(int32_t)(u & 1);
+    return p;
+}
+
+static bool hdr_valid(const temp_log_page_hdr *hdr) {
+    return hdr->seq != TEMP_LOG_ERASED && hdr->count > 0 && hdr->len <= TEMP_LOG_PAYLOAD;
+}
+
+/* What a reader goes by, copied so that flash is read against a consistent state */
+struct temp_log_view {
+    uint32_t next_page;     /* oldest page of the ring */
+    uint32_t next_seq;      /* pages from this one on were written after the copy */
+    bool out_pending;
+    uint8_t out[TEMP_LOG_PAGE_SIZE];
+    uint8_t page[TEMP_LOG_PAGE_SIZE];
+};
+
+static void view_get(struct temp_log_view *v) {
+    uint32_t s;
+
+    do {
+        s = read_begin();
+        v->next_page = next_page;
+        v->next_seq = next_seq;
+        v->out_pending = out_pending;
+        memcpy(v->out, out, sizeof(v->out));
+        memcpy(v->page, page, sizeof(v->page));
+    } while (read_retry(s));
+}
+
+/* Header of a page of the view, false when it is erased or newer than the view */
+static bool view_hdr(const struct temp_log_view *v, uint32_t pos, temp_log_page_hdr *hdr) {
+    return flash->read(flash->ctx, (v->next_page + pos) % pages * TEMP_LOG_PAGE_SIZE,
+                       hdr, sizeof(*hdr)) == 0 &&
+           hdr_valid(hdr) && hdr->seq < v->next_seq;
+}
+
+static bool read_hdr(uint32_t idx, temp_log_page_hdr *hdr) {
+    return flash->read(flash->ctx, idx * TEMP_LOG_PAGE_SIZE, hdr, sizeof(*hdr)) == 0 &&
+           hdr_valid(hdr);
+}
+
+/* Reads a whole page, false when it is erased, torn or corrupt */
+static bool read_page(uint32_t idx, uint8_t *buf) {
+    return flash->read(flash->ctx, idx * TEMP_LOG_PAGE_SIZE, buf, TEMP_LOG_PAGE_SIZE) == 0 &&
+           hdr_valid(PAGE_HDR(buf)) && PAGE_HDR(buf)->crc == page_crc(buf);
+}
+
+/* Where a range query collects its samples */
+struct temp_log_query {
+    uint32_t from, to;
+    temp_sample *out;
+    size_t max, n;
+    bool done;
+};
+
+/* Decodes the samples of one page into the query */
+static void page_decode(const uint8_t *p, struct temp_log_query *q) {
+    const temp_log_page_hdr *hdr = PAGE_HDR(p);
+    const uint8_t *pos = p + sizeof(*hdr), *end = pos + hdr->len;
+    uint32_t ts = hdr->timestamp;
+    int16_t temp = hdr->temperature;
+    int32_t dt, dtemp;
+    uint16_t i;
+
+    for (i = 0; i < hdr->count && !q->done; i++) {
+        if (i > 0) {
+            pos = varint_get(pos, end, &dt);
+            pos = pos ? varint_get(pos, end, &dtemp) : NULL;
+            if (pos == NULL) {
+                return;
+            }
+            ts += dt;
+            temp += dtemp;
+        }
+        if (ts > q->to || q->n == q->max) {
+            q->done = true;
+        } else if (ts >= q->from) {
+            q->out[q->n].timestamp = ts;
+            q->out[q->n].temperature = temp;
+            q->n++;
+        }
+    }
+}
+
+/* Timestamp of the last sample of the page in buf */
+static uint32_t page_last_ts(const uint8_t *p) {
+    const temp_log_page_hdr *hdr = PAGE_HDR(p);
+    const uint8_t *pos = p + sizeof(*hdr), *end = pos + hdr->len;
+    uint32_t ts = hdr->timestamp;
+    int32_t dt, dtemp;
+    uint16_t i;
+
+    for (i = 1; i < hdr->count; i++) {
+        pos = varint_get(pos, end, &dt);
+        pos = pos ? varint_get(pos, end, &dtemp) : NULL;
+        if (pos == NULL) {
+            break;
+        }
+        ts += dt;
+    }
+    return ts;
+}
+
+int temp_log_init(const struct temp_log_flash *f) {
+    temp_log_page_hdr hdr;
+    uint32_t i, newest = 0, newest_seq = 0;
+    bool found = false;
+
+    begin_write();
+    flash = NULL;
+    memset(page, 0, sizeof(page));
+    out_pending = false;
+    have_last = false;
+    end_write();
+
+    if (f == NULL || f->sector_size == 0 || f->sector_size % TEMP_LOG_PAGE_SIZE != 0 ||
+        f->size < 2 * f->sector_size || f->size % f->sector_size != 0) {
+        return -1;
+    }
+
+    begin_write();
+    flash = f;
+    pages = f->size / TEMP_LOG_PAGE_SIZE;
+    pages_per_sector = f->sector_size / TEMP_LOG_PAGE_SIZE;
+
+    /* the page with the highest sequence number is the newest */
+    for (i = 0; i < pages; i++) {
+        if (read_hdr(i, &hdr) && (!found || hdr.seq > newest_seq)) {
+            found = true;
+            newest = i;
+            newest_seq = hdr.seq;
+        }
+    }
+
+    next_page = 0;
+    next_seq = 0;
+    time_base = 0;
+    if (found) {
+        next_page = (newest + 1) % pages;
+        next_seq = newest_seq + 1;
+        read_hdr(newest, &hdr);
+        time_base = read_page(newest, out) ? page_last_ts(out) : hdr.timestamp;
+        last_ts = time_base;
+        have_last = true;
+
+        /* a page left over from a write cut short cannot be programmed again */
+        if (next_page % pages_per_sector != 0 &&
+            (flash->read(flash->ctx, next_page * TEMP_LOG_PAGE_SIZE, &hdr, sizeof(hdr)) != 0 ||
+             hdr.seq != TEMP_LOG_ERASED)) {
+            next_page = (next_page / pages_per_sector + 1) * pages_per_sector % pages;
+        }
+    }
+    end_write();
+
+    return 0;
+}
+
+/* Programs the page in out, then makes it part of the ring. Sampler only. */
+static int temp_log_write_out(void) {
+    uint32_t idx;
+    int rc = 0;
+
+    begin_write();
+    idx = next_page;
+    PAGE_HDR(out)->seq = next_seq;
+    PAGE_HDR(out)->crc = 0;
+    PAGE_HDR(out)->crc = page_crc(out);
+    end_write();
+
+    /* entering a sector drops the oldest pages of the ring */
+    if (idx % pages_per_sector == 0) {
+        rc = flash->erase(flash->ctx, idx * TEMP_LOG_PAGE_SIZE);
+    }
+    if (rc == 0) {
+        rc = flash->write(flash->ctx, idx * TEMP_LOG_PAGE_SIZE, out, TEMP_LOG_PAGE_SIZE);
+    }
+
+    begin_write();
+    /* a failed page is skipped so the log does not get stuck on a bad sector */
+    next_page = (idx + 1) % pages;
+    next_seq++;
+    out_pending = false;
+    end_write();
+
+    return rc;
+}
+
+int temp_log_append(uint32_t timestamp, int16_t temperature) {
+    temp_log_page_hdr *hdr = PAGE_HDR(page);
+    uint8_t delta[10];
+    uint8_t n;
+    bool full = false;
+
+    if (flash == NULL) {
+        return -1;
+    }
+    timestamp += time_base;
+
+    begin_write();
+    if (hdr->count > 0) {
+        n = varint_put(delta, (int32_t)(timestamp - last_ts));
+        n += varint_put(delta + n, temperature - last_temp);
+        if (hdr->len + n <= TEMP_LOG_PAYLOAD) {
+            memcpy(page + sizeof(*hdr) + hdr->len, delta, n);
+            hdr->len += n;
+            hdr->count++;
+        } else {
+            memcpy(out, page, sizeof(out));
+            out_pending = true;
+            full = true;
+            hdr->count = 0;
+        }
+    }
+    if (hdr->count == 0) {
+        memset(page, 0xFF, sizeof(page));
+        hdr->timestamp = timestamp;
+        hdr->temperature = temperature;
+        hdr->count = 1;
+        hdr->len = 0;
+    }
+    last_ts = timestamp;
+    last_temp = temperature;
+    have_last = true;
+    end_write();
+
+    return full ? temp_log_write_out() : 0;
+}
+
+int temp_log_flush(void) {
+    if (flash == NULL) {
+        return -1;
+    }
+
+    if (PAGE_HDR(page)->count == 0) {
+        return 0;
+    }
+    begin_write();
+    memcpy(out, page, sizeof(out));
+    out_pending = true;
+    PAGE_HDR(page)->count = 0;
+    end_write();
+
+    return temp_log_write_out();
+}
+
+/*
+ * Ring position of the first page worth decoding for a query starting at
+ * from: the last page starting at or before it. Pages are ordered from
+ * next_page on; erased ones only appear at the start of that order, and
+ * so do the ones the sampler wrote since the view was taken.
+ */
+static uint32_t temp_log_search(const struct temp_log_view *v, uint32_t from) {
+    temp_log_page_hdr hdr;
+    uint32_t lo = 0, hi = pages, mid;
+
+    /* first position whose page starts after from */
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (view_hdr(v, mid, &hdr) && hdr.timestamp > from) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return lo > 0 ? lo - 1 : 0;
+}
+
+size_t temp_log_query(uint32_t from, uint32_t to, temp_sample *samples, size_t max) {
+    struct temp_log_view v;
+    uint8_t buf[TEMP_LOG_PAGE_SIZE];
+    struct temp_log_query q = { from, to, samples, max, 0, false };
+    uint32_t pos;
+
+    if (flash == NULL || from > to || max == 0) {
+        return 0;
+    }
+
+    view_get(&v);
+    for (pos = temp_log_search(&v, from); pos < pages && !q.done; pos++) {
+        if (read_page((v.next_page + pos) % pages, buf) && PAGE_HDR(buf)->seq < v.next_seq) {
+            page_decode(buf, &q);
+        }
+    }
+    if (v.out_pending && !q.done) {
+        page_decode(v.out, &q);
+    }
+    if (PAGE_HDR(v.page)->count > 0 && !q.done) {
+        page_decode(v.page, &q);
+    }
+
+    return q.n;
+}
+
+bool temp_log_oldest(uint32_t *timestamp) {
+    struct temp_log_view v;
+    temp_log_page_hdr hdr;
+    uint32_t pos;
+    bool found = false;
+
+    if (flash == NULL) {
+        return false;
+    }
+
+    view_get(&v);
+    for (pos = 0; pos < pages && !found; pos++) {
+        found = view_hdr(&v, pos, &hdr);
+    }
+    if (!found && v.out_pending) {
+        memcpy(&hdr, v.out, sizeof(hdr));
+        found = true;
+    }
+    if (!found && PAGE_HDR(v.page)->count > 0) {
+        memcpy(&hdr, v.page, sizeof(hdr));
+        found = true;
+    }
+
+    if (found) {
+        *timestamp = hdr.timestamp;
+    }
+    return found;
+}
+
+bool temp_log_newest(uint32_t *timestamp) {
+    uint32_t s;
+    bool found;
+
+    if (flash == NULL) {
+        return false;
+    }
+
+    do {
+        s = read_begin();
+        found = have_last;
+        *timestamp = last_ts;
+    } while (read_retry(s));
+
+    return found;
+}
+
+uint32_t temp_log_time_base(void) {
+    return time_base;
+}
@@ -0,0 +1,36 @@
+#include "esp_partition.h"
+#include "esp_log.h"
+#include "temp_log.h"
+
+#define TEMP_LOG_TAG "TEMP_LOG"
+
+static const esp_partition_t *partition;
+static struct temp_log_flash partition_flash;
+
+static int partition_read(void *ctx, uint32_t offset, void *buf, size_t len) {
+    return esp_partition_read(partition, offset, buf, len) == ESP_OK ? 0 : -1;
+}
+
+static int partition_write(void *ctx, uint32_t offset, const void *buf, size_t len) {
+    return esp_partition_write(partition, offset, buf, len) == ESP_OK ? 0 : -1;
+}
+
+static int partition_erase(void *ctx, uint32_t offset) {
+    return esp_partition_erase_range(partition, offset, SPI_FLASH_SEC_SIZE) == ESP_OK ? 0 : -1;
+}
+
+const struct temp_log_flash *temp_log_partition(const char *label) {
+    partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+    if (partition == NULL) {
+        ESP_LOGW(TEMP_LOG_TAG, "no \"%s\" partition, samples are not logged", label);
+        return NULL;
+    }
+
+    partition_flash.size = partition->size - partition->size % SPI_FLASH_SEC_SIZE;
+    partition_flash.sector_size = SPI_FLASH_SEC_SIZE;
+    partition_flash.read = partition_read;
+    partition_flash.write = partition_write;
+    partition_flash.erase = partition_erase;
+    ESP_LOGI(TEMP_LOG_TAG, "logging to \"%s\", %u KB", label, partition_flash.size / 1024);
+    return &partition_flash;
+}
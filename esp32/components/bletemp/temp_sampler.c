@@ -0,0 +1,154 @@
+#include <stdatomic.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "bletemp_pm.h"
+#include "temp_filter.h"
+#include "temp_jitter.h"
+#include "temp_sampler.h"
+#include "temp_log.h"
+
+#define SAMPLER_TAG "SAMPLER"
+
+static TaskHandle_t sampler_handle = NULL;
+static esp_timer_handle_t sampler_timer = NULL;
+static temp_sampler_cb sampler_cb;
+
+/* When the timer last fired, taken in its callback rather than by the task */
+static volatile int64_t sampler_tick_us;
+/*
+ * When the timer was last (re)started and at what period, for the task
+ * to start the jitter statistics over from: it is their only writer
+ */
+static volatile int64_t sampler_start_us;
+static volatile uint32_t sampler_period_us;
+static atomic_bool sampler_restarted;
+
+/* Callbacks run from the timer ISR where the IDF allows it */
+#if CONFIG_ESP_TIMER_SUPPORTS_ISR_DISPATCH_METHOD
+#define SAMPLER_DISPATCH ESP_TIMER_ISR
+#else
+#define SAMPLER_DISPATCH ESP_TIMER_TASK
+#endif
+
+extern uint8_t temprature_sens_read();
+
+/* Returns the current temperature in hundredths of a degree Celsius */
+static int16_t temp_sensor_read(void) {
+    //return temprature_sens_read()*10;
+    return esp_random() % 10000;
+}
+
+static void IRAM_ATTR sampler_tick(void *arg) {
+#if CONFIG_ESP_TIMER_SUPPORTS_ISR_DISPATCH_METHOD
+    BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+
+    sampler_tick_us = esp_timer_get_time();
+    vTaskNotifyGiveFromISR(sampler_handle, &xHigherPriorityTaskWoken);
+    portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+#else
+    sampler_tick_us = esp_timer_get_time();
+    xTaskNotifyGive(sampler_handle);
+#endif
+}
+
+static void sampler_sample(uint32_t now) {
+    int16_t temperature;
+
+    bletemp_pm_acquire();
+    temperature = temp_filter_sample(temp_sensor_read);
+    temp_history_push(now, temperature);
+    temp_aggregate_add(now, temperature);
+    /* no-op unless a log was opened with temp_log_init() */
+    temp_log_append(now, temperature);
+    if (sampler_cb) {
+        sampler_cb();
+    }
+    bletemp_pm_release();
+}
+
+static void sampler_task(void *pvParameters) {
+    int64_t tick, last = 0, start;
+
+    sampler_sample(esp_timer_get_time() / 1000);
+    for ( ;; ) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        tick = sampler_tick_us;
+        if (atomic_exchange_explicit(&sampler_restarted, false, memory_order_acquire)) {
+            /* the first interval counts from the restart */
+            temp_jitter_reset(sampler_period_us);
+            start = sampler_start_us;
+            if (start > last) {
+                last = start;
+            }
+        }
+        /* a tick of the old timer still pending predates the restart */
+        if (tick > last) {
+            temp_jitter_add(tick - last);
+            last = tick;
+        }
+        sampler_sample(tick / 1000);
+    }
+}
+
+static int sampler_timer_start(uint32_t period_ms) {
+    esp_err_t err;
+
+    sampler_period_us = period_ms * 1000;
+    sampler_start_us = esp_timer_get_time();
+    atomic_store_explicit(&sampler_restarted, true, memory_order_release);
+    err = esp_timer_start_periodic(sampler_timer, (uint64_t)period_ms * 1000);
+    if (err != ESP_OK) {
+        ESP_LOGE(SAMPLER_TAG, "failed to start sampling timer: %d", err);
+        return -1;
+    }
+    return 0;
+}
+
+int temp_sampler_start(uint32_t period_ms, temp_sampler_cb cb) {
+    const esp_timer_create_args_t args = {
+        .callback = &sampler_tick,
+        .dispatch_method = SAMPLER_DISPATCH,
+        .name = "sampler",
+        /* a late task takes one sample, not a burst */
+        .skip_unhandled_events = true,
+    };
+
+    if (sampler_handle != NULL || period_ms == 0) {
+        return -1;
+    }
+
+    temp_history_init();
+    temp_filter_init();
+    sampler_cb = cb;
+
+    if (xTaskCreatePinnedToCore(&sampler_task, "sampler", CONFIG_BLETEMP_SAMPLER_STACK_SIZE, NULL,
+                                5, &sampler_handle, CONFIG_BLETEMP_APP_CORE) != pdPASS) {
+        ESP_LOGE(SAMPLER_TAG, "failed to create sampling task");
+        return -1;
+    }
+    if (esp_timer_create(&args, &sampler_timer) != ESP_OK) {
+        ESP_LOGE(SAMPLER_TAG, "failed to create sampling timer");
+        return -1;
+    }
+    return sampler_timer_start(period_ms);
+}
+
+int temp_sampler_set_period(uint32_t period_ms) {
+    if (period_ms == 0) {
+        return -1;
+    }
+    if (sampler_timer == NULL) {
+        return 0;
+    }
+
+    esp_timer_stop(sampler_timer);
+    return sampler_timer_start(period_ms);
+}
+
+uint32_t temp_sampler_stack_free(void) {
+    return (sampler_handle != NULL) ? uxTaskGetStackHighWaterMark(sampler_handle) : 0;
+}
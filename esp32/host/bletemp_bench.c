@@ -0,0 +1,530 @@
+/*
+ * Notification latency and throughput benchmark for the thermometer core.
+ * Runs against the simulated controller on a simulated clock, so the
+ * latency and throughput figures are reproducible; only the CPU times of
+ * publish and read are measured on the wall clock.
+ *
+ *   bletemp_bench [-f csv|json] [-s nimble|bluedroid] [-q depth]
+ *                 [-n samples] [-r rate_hz] [-o file]
+ *
+ * One row per stack, scenario and link setting:
+ *   latency     sample taken to temperature notification acknowledged
+ *   latency_indicate
+ *               sample taken to temperature indication confirmed
+ *   publish     CPU time of one sample push and publish
+ *   throughput  notifications sustained while sampling at rate_hz
+ *   throughput_indicate
+ *               the same with indications, one confirmation at a time
+ *   read        CPU time to serve one read request
+ *   deadband    notifications of a slowly drifting cold-chain reading,
+ *               with the deadband off and at 0.5 C with a 5 min heartbeat
+ *   download_*  full history download after subscribing, per PHY and LL
+ *               payload: 1m_27 (legacy), 1m_251 (DLE), 2m_251 (DLE, 2M)
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "sim.h"
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+/*
+ * Notifications each stack holds before refusing more: the NimBLE
+ * temperature notification pool and the Bluedroid GATT congestion
+ * threshold, approximately, with the default sdkconfig. Override with -q.
+ */
+struct bench_stack {
+    const char *name;
+    uint8_t tx_queue;
+};
+
+static const struct bench_stack stacks[] = {
+    { "nimble", 3 * BLETEMP_MAX_CONN },
+    { "bluedroid", 10 },
+};
+
+/* PHY and LL payload of the link, as negotiated after connecting */
+struct bench_phy {
+    const char *name;
+    uint8_t phy_mbps;
+    uint16_t ll_octets;
+};
+
+static const struct bench_phy phys[] = {
+    { "download_1m_27", 1, 27 },
+    { "download_1m_251", 1, BLETEMP_LL_OCTETS_MAX },
+    { "download_2m_251", 2, BLETEMP_LL_OCTETS_MAX },
+};
+
+static const uint32_t intervals_us[] = { 7500, 15000, 30000, 50000 };
+static const uint16_t mtus[] = { 23, 185, 247, 512 };
+
+static const char *chr_name[BLETEMP_CHR_COUNT] = {
+    [BLETEMP_CHR_TEMP] = "temp",
+    [BLETEMP_CHR_UNIT] = "unit",
+    [BLETEMP_CHR_HIST] = "hist",
+};
+
+struct bench_hist {
+    uint32_t *v;
+    size_t n, cap;
+};
+
+struct bench_row {
+    const char *stack;
+    const char *scenario;
+    const char *chr;
+    uint16_t mtu;
+    uint32_t interval_us;
+    const char *unit;
+    struct bench_hist *hist;
+    double rate_per_s;
+    double bytes_per_s;
+    uint32_t drops;
+};
+
+/* What the rx callback records */
+struct bench_rx {
+    enum bletemp_chr chr;
+    bool enabled;
+    struct bench_hist hist;
+    uint32_t count;
+    uint64_t bytes;
+    uint64_t last_rx_us;
+};
+
+static FILE *out;
+static bool json;
+static int rows;
+
+static uint32_t rng = 0x2545F491;
+
+/* xorshift32, identical on every libc */
+static uint32_t
+bench_rand(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+static uint64_t
+bench_clock_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static void
+hist_add(struct bench_hist *h, uint32_t v)
+{
+    if (h->n == h->cap) {
+        h->cap = h->cap ? h->cap * 2 : 1024;
+        h->v = realloc(h->v, h->cap * sizeof(*h->v));
+        if (h->v == NULL) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    h->v[h->n++] = v;
+}
+
+static int
+hist_cmp(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+/* Nearest-rank percentile, the histogram must be sorted */
+static uint32_t
+hist_pct(const struct bench_hist *h, double p)
+{
+    size_t rank;
+
+    if (h->n == 0) {
+        return 0;
+    }
+    rank = (size_t)(p * h->n + 0.999999);
+    return h->v[(rank > 0 ? rank : 1) - 1];
+}
+
+static void
+hist_reset(struct bench_hist *h)
+{
+    h->n = 0;
+}
+
+static void
+emit(const struct bench_row *r)
+{
+    struct bench_hist *h = r->hist;
+
+    qsort(h->v, h->n, sizeof(*h->v), hist_cmp);
+
+    if (json) {
+        fprintf(out, "%s\n  {\"stack\": \"%s\", \"scenario\": \"%s\", \"chr\": \"%s\", "
+                "\"mtu\": %u, \"interval_us\": %u, \"count\": %zu, \"unit\": \"%s\", "
+                "\"p50\": %u, \"p99\": %u, \"p999\": %u, \"max\": %u, "
+                "\"rate_per_s\": %.3f, \"bytes_per_s\": %.1f, \"drops\": %u}",
+                rows ? "," : "[", r->stack, r->scenario, r->chr, r->mtu,
+                r->interval_us, h->n, r->unit, hist_pct(h, 0.5), hist_pct(h, 0.99),
+                hist_pct(h, 0.999), hist_pct(h, 1.0), r->rate_per_s,
+                r->bytes_per_s, r->drops);
+    } else {
+        if (rows == 0) {
+            fprintf(out, "stack,scenario,chr,mtu,interval_us,count,unit,"
+                    "p50,p99,p999,max,rate_per_s,bytes_per_s,drops\n");
+        }
+        fprintf(out, "%s,%s,%s,%u,%u,%zu,%s,%u,%u,%u,%u,%.3f,%.1f,%u\n",
+                r->stack, r->scenario, r->chr, r->mtu, r->interval_us, h->n,
+                r->unit, hist_pct(h, 0.5), hist_pct(h, 0.99), hist_pct(h, 0.999),
+                hist_pct(h, 1.0), r->rate_per_s, r->bytes_per_s, r->drops);
+    }
+    rows++;
+}
+
+static void
+on_rx(const struct sim_packet *pkt, void *arg)
+{
+    struct bench_rx *rx = arg;
+
+    if (!rx->enabled || pkt->chr != rx->chr) {
+        return;
+    }
+    hist_add(&rx->hist, pkt->rx_us - pkt->tx_us);
+    rx->count++;
+    rx->bytes += pkt->len;
+    rx->last_rx_us = pkt->rx_us;
+}
+
+static uint16_t
+bench_setup(struct bench_rx *rx, uint8_t tx_queue, uint32_t interval_us,
+            uint16_t mtu, enum bletemp_chr chr, uint16_t cfg,
+            const struct bench_phy *phy)
+{
+    struct sim_link link = {
+        .interval_us = interval_us,
+        .ll_octets = phy->ll_octets,
+        .phy_mbps = phy->phy_mbps,
+        .tx_queue = tx_queue,
+    };
+    uint16_t conn;
+
+    rx->chr = chr;
+    rx->enabled = false;
+    rx->count = 0;
+    rx->bytes = 0;
+    hist_reset(&rx->hist);
+    rng = 0x2545F491;
+
+    sim_init(on_rx, rx);
+    sim_set_link(&link);
+    conn = sim_connect();
+    sim_exchange_mtu(conn, mtu);
+    sim_subscribe(conn, chr, cfg);
+    /* let the notification sent on subscribe go out */
+    sim_advance(sim_now_us() + 2 * interval_us);
+    rx->enabled = true;
+    return conn;
+}
+
+/* One sample every 100 ms at a random phase, one central on temperature */
+static void
+bench_latency(const char *stack, const char *scenario, uint16_t cfg,
+              uint8_t tx_queue, int samples)
+{
+    const uint32_t period_us = 100000;
+    struct bench_hist cpu = {0};
+    struct bench_rx rx = {0};
+    struct bench_row row;
+    uint64_t base, t, t0;
+    unsigned i;
+    int n;
+
+    for (i = 0; i < ARRAY_SIZE(intervals_us); i++) {
+        bench_setup(&rx, tx_queue, intervals_us[i], BLETEMP_DEFAULT_MTU,
+                    BLETEMP_CHR_TEMP, cfg, &phys[0]);
+        hist_reset(&cpu);
+
+        base = sim_now_us();
+        for (n = 0; n < samples; n++) {
+            t = base + (uint64_t)n * period_us + bench_rand() % period_us;
+            sim_advance(t);
+            t0 = bench_clock_ns();
+            sim_sample(t / 1000, 2000 + n % 50);
+            hist_add(&cpu, bench_clock_ns() - t0);
+        }
+        sim_advance(sim_now_us() + period_us);
+
+        row = (struct bench_row){ stack, scenario, "temp", BLETEMP_DEFAULT_MTU,
+                                  intervals_us[i], "us", &rx.hist,
+                                  0, 0, sim_drop_count() };
+        emit(&row);
+        if (cfg == BLETEMP_SUB_NOTIFY) {
+            row = (struct bench_row){ stack, "publish", "temp", BLETEMP_DEFAULT_MTU,
+                                      intervals_us[i], "ns", &cpu,
+                                      0, 0, 0 };
+            emit(&row);
+        }
+    }
+    free(cpu.v);
+    free(rx.hist.v);
+}
+
+/* Samples at rate_hz for ten simulated seconds, one central per characteristic */
+static void
+bench_throughput(const char *stack, const char *scenario, uint16_t cfg,
+                 uint8_t tx_queue, uint32_t rate_hz)
+{
+    static const enum bletemp_chr chrs[] = { BLETEMP_CHR_TEMP, BLETEMP_CHR_HIST };
+    const uint64_t duration_us = 10000000;
+    struct bench_rx rx = {0};
+    struct bench_row row;
+    uint64_t base, t, step;
+    unsigned c, m, i;
+
+    step = 1000000 / rate_hz;
+    for (c = 0; c < ARRAY_SIZE(chrs); c++) {
+        for (m = 0; m < ARRAY_SIZE(mtus); m++) {
+            for (i = 0; i < ARRAY_SIZE(intervals_us); i++) {
+                bench_setup(&rx, tx_queue, intervals_us[i], mtus[m], chrs[c],
+                            cfg, &phys[0]);
+
+                base = sim_now_us();
+                for (t = 0; t < duration_us; t += step) {
+                    sim_advance(base + t);
+                    sim_sample((base + t) / 1000, 2000 + (t / step) % 50);
+                }
+                sim_advance(base + duration_us);
+                rx.enabled = false;
+
+                row = (struct bench_row){ stack, scenario, chr_name[chrs[c]],
+                                          mtus[m], intervals_us[i], "us", &rx.hist,
+                                          rx.count * 1e6 / duration_us,
+                                          rx.bytes * 1e6 / duration_us,
+                                          sim_drop_count() };
+                emit(&row);
+            }
+        }
+    }
+    free(rx.hist.v);
+}
+
+static void
+bench_read(const char *stack, int samples)
+{
+    static const enum bletemp_chr chrs[] = {
+        BLETEMP_CHR_TEMP, BLETEMP_CHR_UNIT, BLETEMP_CHR_HIST,
+    };
+    static const uint16_t read_mtus[] = { BLETEMP_DEFAULT_MTU, 512 };
+    uint8_t buf[TEMP_HISTORY_MAX_PAYLOAD];
+    struct bench_hist h = {0};
+    struct bench_row row;
+    uint64_t t0, total;
+    uint16_t conn, len;
+    unsigned c, m;
+    int n;
+
+    for (m = 0; m < ARRAY_SIZE(read_mtus); m++) {
+        sim_init(NULL, NULL);
+        conn = sim_connect();
+        sim_exchange_mtu(conn, read_mtus[m]);
+        for (n = 0; n < TEMP_HISTORY_LEN; n++) {
+            sim_sample(n * 1000, 2000 + n % 50);
+        }
+
+        for (c = 0; c < ARRAY_SIZE(chrs); c++) {
+            hist_reset(&h);
+            total = 0;
+            for (n = 0; n < samples; n++) {
+                t0 = bench_clock_ns();
+                sim_read(conn, chrs[c], buf, sizeof(buf), &len);
+                t0 = bench_clock_ns() - t0;
+                total += t0;
+                hist_add(&h, t0);
+            }
+
+            row = (struct bench_row){ stack, "read", chr_name[chrs[c]],
+                                      read_mtus[m], 0, "ns", &h,
+                                      total ? samples * 1e9 / total : 0, 0, 0 };
+            emit(&row);
+        }
+    }
+    free(h.v);
+}
+
+/* One hour of 1 s samples around 4 C, a slow random walk plus sensor noise */
+static void
+bench_deadband(const char *stack, uint8_t tx_queue)
+{
+    static const deadband_struct settings[] = { {0, 0}, {50, 300} };
+    const uint32_t period_us = 1000000, samples = 3600;
+    struct bench_rx rx = {0};
+    struct bench_row row;
+    uint64_t base, t;
+    uint32_t n;
+    int walk;
+    unsigned i;
+
+    for (i = 0; i < ARRAY_SIZE(settings); i++) {
+        uint16_t conn = bench_setup(&rx, tx_queue, intervals_us[2], BLETEMP_DEFAULT_MTU,
+                                    BLETEMP_CHR_TEMP, BLETEMP_SUB_NOTIFY, &phys[0]);
+
+        sim_write(conn, BLETEMP_CHR_DEADBAND, (const uint8_t *)&settings[i],
+                  sizeof(settings[i]));
+        walk = 400;
+        base = sim_now_us();
+        for (n = 0; n < samples; n++) {
+            t = base + (uint64_t)n * period_us;
+            sim_advance(t);
+            walk += (int)(bench_rand() % 3) - 1;
+            sim_sample(t / 1000, walk + (int)(bench_rand() % 11) - 5);
+        }
+        sim_advance(base + (uint64_t)samples * period_us);
+
+        row = (struct bench_row){ stack, settings[i].threshold ? "deadband" : "deadband_off",
+                                  "temp", BLETEMP_DEFAULT_MTU, intervals_us[2], "us", &rx.hist,
+                                  rx.count * 1e6 / ((uint64_t)samples * period_us),
+                                  rx.bytes * 1e6 / ((uint64_t)samples * period_us),
+                                  sim_drop_count() };
+        emit(&row);
+    }
+    free(rx.hist.v);
+}
+
+/*
+ * Fills the history, then times subscribe to last batch acknowledged over
+ * repeated downloads at the largest MTUs and a 30 ms interval
+ */
+static void
+bench_download(const char *stack, uint8_t tx_queue)
+{
+    static const uint16_t download_mtus[] = { 247, 512 };
+    const int rounds = 100;
+    struct bench_hist h = {0};
+    struct bench_rx rx = {0};
+    struct bench_row row;
+    uint64_t t0, total;
+    uint32_t count;
+    uint16_t conn;
+    unsigned p, m;
+    int n;
+
+    for (p = 0; p < ARRAY_SIZE(phys); p++) {
+        for (m = 0; m < ARRAY_SIZE(download_mtus); m++) {
+            conn = bench_setup(&rx, tx_queue, intervals_us[2], download_mtus[m],
+                               BLETEMP_CHR_HIST, BLETEMP_SUB_NOTIFY, &phys[p]);
+            sim_subscribe(conn, BLETEMP_CHR_HIST, 0);
+            for (n = 0; n < TEMP_HISTORY_LEN; n++) {
+                sim_sample(n * 1000, 2000 + n % 50);
+            }
+
+            hist_reset(&h);
+            total = 0;
+            count = rx.count;
+            for (n = 0; n < rounds; n++) {
+                t0 = sim_now_us();
+                sim_subscribe(conn, BLETEMP_CHR_HIST, BLETEMP_SUB_NOTIFY);
+                sim_advance(t0 + 2000000);
+                sim_subscribe(conn, BLETEMP_CHR_HIST, 0);
+                hist_add(&h, rx.last_rx_us - t0);
+                total += rx.last_rx_us - t0;
+            }
+
+            row = (struct bench_row){ stack, phys[p].name, "hist", download_mtus[m],
+                                      intervals_us[2], "us", &h,
+                                      total ? (rx.count - count) * 1e6 / total : 0,
+                                      total ? rx.bytes * 1e6 / total : 0,
+                                      sim_drop_count() };
+            emit(&row);
+        }
+    }
+    free(h.v);
+    free(rx.hist.v);
+}
+
+static void
+usage(const char *argv0)
+{
+    fprintf(stderr, "usage: %s [-f csv|json] [-s nimble|bluedroid] [-q depth] "
+            "[-n samples] [-r rate_hz] [-o file]\n", argv0);
+    exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+    const char *only = NULL;
+    uint32_t rate_hz = 10000;
+    int samples = 10000;
+    int tx_queue = 0;
+    unsigned i;
+    int opt;
+
+    out = stdout;
+    while ((opt = getopt(argc, argv, "f:s:q:n:r:o:")) != -1) {
+        switch (opt) {
+        case 'f':
+            json = strcmp(optarg, "json") == 0;
+            break;
+        case 's':
+            only = optarg;
+            break;
+        case 'q':
+            tx_queue = atoi(optarg);
+            break;
+        case 'n':
+            samples = atoi(optarg);
+            break;
+        case 'r':
+            rate_hz = atoi(optarg);
+            break;
+        case 'o':
+            out = fopen(optarg, "w");
+            if (out == NULL) {
+                perror(optarg);
+                return 1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (samples <= 0 || rate_hz == 0 || rate_hz > 1000000 ||
+        tx_queue < 0 || tx_queue > 32) {
+        usage(argv[0]);
+    }
+
+    for (i = 0; i < ARRAY_SIZE(stacks); i++) {
+        if (only != NULL && strcmp(only, stacks[i].name) != 0) {
+            continue;
+        }
+        bench_latency(stacks[i].name, "latency", BLETEMP_SUB_NOTIFY,
+                      tx_queue ? tx_queue : stacks[i].tx_queue, samples);
+        bench_latency(stacks[i].name, "latency_indicate", BLETEMP_SUB_INDICATE,
+                      tx_queue ? tx_queue : stacks[i].tx_queue, samples);
+        bench_throughput(stacks[i].name, "throughput", BLETEMP_SUB_NOTIFY,
+                         tx_queue ? tx_queue : stacks[i].tx_queue, rate_hz);
+        bench_throughput(stacks[i].name, "throughput_indicate", BLETEMP_SUB_INDICATE,
+                         tx_queue ? tx_queue : stacks[i].tx_queue, rate_hz);
+        bench_read(stacks[i].name, samples);
+        bench_deadband(stacks[i].name, tx_queue ? tx_queue : stacks[i].tx_queue);
+        bench_download(stacks[i].name, tx_queue ? tx_queue : stacks[i].tx_queue);
+    }
+
+    if (json) {
+        fprintf(out, rows ? "\n]\n" : "[]\n");
+    }
+    if (out != stdout) {
+        fclose(out);
+    }
+    return 0;
+}
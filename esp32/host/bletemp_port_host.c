@@ -0,0 +1,44 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <time.h>
+#include "bletemp_port.h"
+
+static pthread_mutex_t lock;
+static pthread_once_t lock_once = PTHREAD_ONCE_INIT;
+static struct timespec boot;
+
+static void lock_create(void) {
+    pthread_mutexattr_t attr;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    clock_gettime(CLOCK_MONOTONIC, &boot);
+}
+
+void bletemp_port_init(void) {
+    pthread_once(&lock_once, lock_create);
+}
+
+uint32_t bletemp_port_time_ms(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - boot.tv_sec) * 1000 + (now.tv_nsec - boot.tv_nsec) / 1000000;
+}
+
+void bletemp_port_lock(void) {
+    pthread_mutex_lock(&lock);
+}
+
+void bletemp_port_unlock(void) {
+    pthread_mutex_unlock(&lock);
+}
+
+/* The host never sleeps, nor slows its clock down */
+void bletemp_port_power(power_struct *power) {
+    power->active = bletemp_port_time_ms();
+    power->modem = 0;
+    power->sleep = 0;
+}
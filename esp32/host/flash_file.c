@@ -0,0 +1,118 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "flash_file.h"
+
+static int
+flash_file_read(void *ctx, uint32_t offset, void *buf, size_t len)
+{
+    struct flash_file *ff = ctx;
+
+    if (offset + len > ff->flash.size) {
+        return -1;
+    }
+    return pread(ff->fd, buf, len, offset) == (ssize_t)len ? 0 : -1;
+}
+
+static int
+flash_file_write(void *ctx, uint32_t offset, const void *buf, size_t len)
+{
+    struct flash_file *ff = ctx;
+    const uint8_t *src = buf;
+    uint8_t cur[256];
+    size_t n, i;
+
+    if (offset + len > ff->flash.size) {
+        return -1;
+    }
+    ff->writes++;
+
+    while (len > 0) {
+        n = (len < sizeof(cur)) ? len : sizeof(cur);
+        if (pread(ff->fd, cur, n, offset) != (ssize_t)n) {
+            return -1;
+        }
+        for (i = 0; i < n; i++) {
+            if (src[i] & ~cur[i]) {
+                ff->bad_writes++;
+                return -1;
+            }
+            cur[i] &= src[i];
+        }
+        if (pwrite(ff->fd, cur, n, offset) != (ssize_t)n) {
+            return -1;
+        }
+        src += n;
+        offset += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int
+flash_file_erase(void *ctx, uint32_t offset)
+{
+    struct flash_file *ff = ctx;
+    uint8_t erased[256];
+    uint32_t n;
+
+    if (offset % ff->flash.sector_size != 0 || offset >= ff->flash.size) {
+        return -1;
+    }
+    memset(erased, 0xFF, sizeof(erased));
+    for (n = 0; n < ff->flash.sector_size; n += sizeof(erased)) {
+        if (pwrite(ff->fd, erased, sizeof(erased), offset + n) != sizeof(erased)) {
+            return -1;
+        }
+    }
+    ff->erase_count[offset / ff->flash.sector_size]++;
+    return 0;
+}
+
+int
+flash_file_open(struct flash_file *ff, const char *path,
+                uint32_t size, uint32_t sector_size)
+{
+    struct stat st;
+    uint32_t off;
+
+    memset(ff, 0, sizeof(*ff));
+    if (sector_size % 256 != 0 || size % sector_size != 0) {
+        return -1;
+    }
+
+    ff->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (ff->fd < 0) {
+        return -1;
+    }
+    ff->flash.size = size;
+    ff->flash.sector_size = sector_size;
+    ff->flash.read = flash_file_read;
+    ff->flash.write = flash_file_write;
+    ff->flash.erase = flash_file_erase;
+    ff->flash.ctx = ff;
+    ff->erase_count = calloc(size / sector_size, sizeof(uint32_t));
+    if (ff->erase_count == NULL) {
+        close(ff->fd);
+        return -1;
+    }
+
+    /* a new file starts out erased, like flash from the factory */
+    if (fstat(ff->fd, &st) == 0 && st.st_size < size) {
+        for (off = 0; off < size; off += sector_size) {
+            flash_file_erase(ff, off);
+        }
+        memset(ff->erase_count, 0, size / sector_size * sizeof(uint32_t));
+    }
+    return 0;
+}
+
+void
+flash_file_close(struct flash_file *ff)
+{
+    close(ff->fd);
+    free(ff->erase_count);
+}
@@ -0,0 +1,35 @@
+#ifndef H_BLETEMP_FLASH_FILE_
+#define H_BLETEMP_FLASH_FILE_
+
+#include <stdint.h>
+#include "temp_log.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * NOR flash kept in a file, standing in for the log partition on the
+ * host. Programming can only clear bits: a write that would set one
+ * fails, the way it silently corrupts data on real flash. Erases are
+ * counted per sector.
+ */
+
+struct flash_file {
+    struct temp_log_flash flash;
+    int fd;
+    uint32_t *erase_count;  /* per sector */
+    uint32_t writes;
+    uint32_t bad_writes;    /* writes that needed an erase first */
+};
+
+/* Opens or creates path with size bytes, erased when created */
+int flash_file_open(struct flash_file *ff, const char *path,
+                    uint32_t size, uint32_t sector_size);
+void flash_file_close(struct flash_file *ff);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,220 @@
+/*
+ * Cost of finding the characteristic an attribute access is for, as the
+ * service grows. A synthetic service of n 128-bit characteristics, each a
+ * declaration, a value and a CCCD, is looked up at random value handles
+ * three ways:
+ *
+ *   uuid   comparing the accessed UUID with each characteristic's in turn,
+ *          as the NimBLE access callback did
+ *   scan   comparing the handle with each value handle in turn, as the
+ *          Bluedroid handler did
+ *   map    the handle map both stacks fill at registration
+ *
+ * Prints one CSV row per characteristic count with the nanoseconds per
+ * lookup of each.
+ *
+ *   gatt_dispatch_bench [-n lookups]
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "bletemp.h"
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+/* Largest service measured, within the map's 7-bit characteristic index */
+#define BENCH_CHR_MAX   112
+
+/* Service declaration, then declaration, value and CCCD per characteristic */
+#define BENCH_BASE      40
+#define BENCH_ATTRS     (1 + BENCH_CHR_MAX * 3)
+#define VAL_HANDLE(i)   (BENCH_BASE + 1 + 3 * (i) + 1)
+
+static const uint16_t counts[] = { 1, 2, 4, 8, 16, 32, 50, 64, 96, BENCH_CHR_MAX };
+
+static uint8_t uuids[BENCH_CHR_MAX][16];
+static uint16_t val_handles[BENCH_CHR_MAX];
+static uint8_t map_slot[BENCH_ATTRS];
+static struct bletemp_gatt_map map;
+
+/* Characteristic accessed by each lookup, the same for every method */
+static uint16_t *targets;
+
+/* Defeats the optimiser, every lookup's result is summed in */
+static volatile uint32_t sink;
+
+static uint32_t rng = 0x2545F491;
+
+static uint32_t
+bench_rand(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+static uint64_t
+clock_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+build(uint16_t n)
+{
+    uint16_t i;
+
+    bletemp_gatt_map_init(&map, BENCH_BASE, map_slot, BENCH_ATTRS);
+    for (i = 0; i < n; i++) {
+        bletemp_gatt_uuid128(BLETEMP_UUID128(0xF000 + i), uuids[i]);
+        val_handles[i] = VAL_HANDLE(i);
+        bletemp_gatt_map_add(&map, val_handles[i], i);
+        bletemp_gatt_map_add(&map, val_handles[i] + 1, i | BLETEMP_GATT_MAP_CFG);
+    }
+}
+
+static int
+find_uuid(uint16_t n, const uint8_t *uuid)
+{
+    uint16_t i;
+
+    for (i = 0; i < n; i++) {
+        if (memcmp(uuids[i], uuid, sizeof(uuids[i])) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int
+find_scan(uint16_t n, uint16_t handle)
+{
+    uint16_t i;
+
+    for (i = 0; i < n; i++) {
+        if (val_handles[i] == handle) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static double
+run_uuid(uint16_t n, uint32_t lookups)
+{
+    uint64_t t0 = clock_ns();
+    uint32_t i, sum = 0;
+
+    for (i = 0; i < lookups; i++) {
+        sum += find_uuid(n, uuids[targets[i]]);
+    }
+    sink += sum;
+    return (double)(clock_ns() - t0) / lookups;
+}
+
+static double
+run_scan(uint16_t n, uint32_t lookups)
+{
+    uint64_t t0 = clock_ns();
+    uint32_t i, sum = 0;
+
+    for (i = 0; i < lookups; i++) {
+        sum += find_scan(n, val_handles[targets[i]]);
+    }
+    sink += sum;
+    return (double)(clock_ns() - t0) / lookups;
+}
+
+static double
+run_map(uint16_t n, uint32_t lookups)
+{
+    uint64_t t0 = clock_ns();
+    uint32_t i, sum = 0;
+
+    for (i = 0; i < lookups; i++) {
+        sum += bletemp_gatt_map_get(&map, val_handles[targets[i]]);
+    }
+    sink += sum;
+    return (double)(clock_ns() - t0) / lookups;
+}
+
+/* All three must find the characteristic that was accessed */
+static int
+check(uint16_t n)
+{
+    uint16_t i;
+
+    for (i = 0; i < n; i++) {
+        if (find_uuid(n, uuids[i]) != i || find_scan(n, val_handles[i]) != i ||
+            bletemp_gatt_map_get(&map, val_handles[i]) != i ||
+            bletemp_gatt_map_get(&map, val_handles[i] + 1) != (i | BLETEMP_GATT_MAP_CFG)) {
+            fprintf(stderr, "characteristic %u of %u not found\n", i, n);
+            return -1;
+        }
+    }
+    if (bletemp_gatt_map_get(&map, BENCH_BASE) != -1 ||
+        bletemp_gatt_map_get(&map, BENCH_BASE - 1) != -1) {
+        fprintf(stderr, "handle outside the characteristics mapped\n");
+        return -1;
+    }
+    return 0;
+}
+
+static void
+usage(const char *argv0)
+{
+    fprintf(stderr, "usage: %s [-n lookups]\n", argv0);
+    exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+    uint32_t lookups = 1000000, i;
+    double uuid_ns, scan_ns, map_ns;
+    unsigned c;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        switch (opt) {
+        case 'n':
+            lookups = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (lookups == 0) {
+        usage(argv[0]);
+    }
+
+    targets = calloc(lookups, sizeof(*targets));
+    if (targets == NULL) {
+        return 1;
+    }
+
+    printf("characteristics,uuid_ns,scan_ns,map_ns\n");
+    for (c = 0; c < ARRAY_SIZE(counts); c++) {
+        build(counts[c]);
+        if (check(counts[c]) != 0) {
+            return 1;
+        }
+        for (i = 0; i < lookups; i++) {
+            targets[i] = bench_rand() % counts[c];
+        }
+        uuid_ns = run_uuid(counts[c], lookups);
+        scan_ns = run_scan(counts[c], lookups);
+        map_ns = run_map(counts[c], lookups);
+        printf("%u,%.1f,%.1f,%.1f\n", counts[c], uuid_ns, scan_ns, map_ns);
+    }
+
+    free(targets);
+    return 0;
+}
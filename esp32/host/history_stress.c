@@ -0,0 +1,210 @@
+/*
+ * Concurrent stress test of the sample history ring: one thread pushes a
+ * monotonic sequence the way the sampling task does while another reads
+ * it back through temp_history_encode() and temp_history_latest() the way
+ * the publishing task does.
+ *
+ * Sample n is stamped n and carries a temperature derived from n, so a
+ * slot copied while the writer rewrote it shows up as a mismatched pair.
+ * In the first pass the writer never laps the reader and every sample
+ * must arrive once and in order; in the second it runs free, the reader
+ * may lose samples to overwrites but never see them out of order or torn.
+ *
+ *   history_stress [-n samples]
+ *
+ * Exits non-zero on the first violation.
+ */
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "temp_codec.h"
+#include "temp_history.h"
+
+#define STRESS_SAMPLES (1u << 20)
+
+struct stress_pass {
+    const char *name;
+    uint32_t first, end;        /* sequence numbers pushed */
+    bool paced;                 /* writer waits for the reader */
+    atomic_uint_least32_t read; /* reader cursor, for pacing */
+    atomic_bool done;           /* writer finished */
+    uint32_t batches, lost;
+};
+
+static atomic_bool failed;
+
+static int16_t
+stress_temperature(uint32_t seq)
+{
+    return (int16_t)(seq * 37 + 11);
+}
+
+static void
+stress_fail(const struct stress_pass *p, const char *what, uint32_t seq,
+            const temp_sample *s)
+{
+    fprintf(stderr, "%s: %s at %u: sample %u, %d\n", p->name, what, seq,
+            s->timestamp, s->temperature);
+    atomic_store(&failed, true);
+}
+
+static void *
+stress_writer(void *arg)
+{
+    struct stress_pass *p = arg;
+    uint32_t seq;
+
+    for (seq = p->first; seq < p->end && !atomic_load(&failed); seq++) {
+        /* stay clear of the slots the reader has yet to copy */
+        while (p->paced && !atomic_load(&failed) &&
+               seq - atomic_load(&p->read) >= TEMP_HISTORY_LEN - 1) {
+            sched_yield();
+        }
+        temp_history_push(seq, stress_temperature(seq));
+        /* let the reader in now and then, to race it and to lap it */
+        if (seq % (2 * TEMP_HISTORY_LEN) == 0) {
+            sched_yield();
+        }
+    }
+    atomic_store(&p->done, true);
+    return NULL;
+}
+
+/* Checks the newest sample is whole and not older than the last one seen */
+static bool
+stress_latest(struct stress_pass *p, uint32_t *newest)
+{
+    temp_sample s;
+
+    if (!temp_history_latest(&s)) {
+        return true;
+    }
+    if (s.temperature != stress_temperature(s.timestamp)) {
+        stress_fail(p, "torn latest sample", *newest, &s);
+        return false;
+    }
+    if (s.timestamp < *newest) {
+        stress_fail(p, "latest sample went back", *newest, &s);
+        return false;
+    }
+    *newest = s.timestamp;
+    return true;
+}
+
+static void
+stress_reader(struct stress_pass *p)
+{
+    uint8_t buf[TEMP_HISTORY_MAX_PAYLOAD], unit;
+    temp_sample out[UINT8_MAX];
+    uint32_t cursor = p->first, expect = p->first, newest = 0;
+    uint16_t len;
+    int n, i;
+
+    while (expect < p->end && !atomic_load(&failed)) {
+        if (!stress_latest(p, &newest)) {
+            return;
+        }
+        len = temp_history_encode(&cursor, 'C', buf, sizeof(buf));
+        if (len == 0) {
+            if (atomic_load(&p->done) && temp_history_pending(cursor) == 0) {
+                break;
+            }
+            sched_yield();
+            continue;
+        }
+        n = temp_codec_decode(buf, len, &unit, out, UINT8_MAX);
+        if (n <= 0 || unit != 'C') {
+            fprintf(stderr, "%s: undecodable batch of %u bytes at %u\n",
+                    p->name, len, expect);
+            atomic_store(&failed, true);
+            return;
+        }
+        for (i = 0; i < n; i++) {
+            if (out[i].temperature != stress_temperature(out[i].timestamp)) {
+                stress_fail(p, "torn sample", expect, &out[i]);
+                return;
+            }
+            if (out[i].timestamp < expect) {
+                stress_fail(p, "sample out of order", expect, &out[i]);
+                return;
+            }
+            if (out[i].timestamp > expect) {
+                if (p->paced) {
+                    stress_fail(p, "gap", expect, &out[i]);
+                    return;
+                }
+                p->lost += out[i].timestamp - expect;
+            }
+            expect = out[i].timestamp + 1;
+        }
+        if (cursor != expect) {
+            fprintf(stderr, "%s: cursor %u past the last sample %u\n",
+                    p->name, cursor, expect - 1);
+            atomic_store(&failed, true);
+            return;
+        }
+        p->batches++;
+        atomic_store(&p->read, cursor);
+    }
+    if (!atomic_load(&failed) && expect != p->end) {
+        fprintf(stderr, "%s: stopped at %u of %u\n", p->name, expect, p->end);
+        atomic_store(&failed, true);
+    }
+}
+
+static int
+stress_run(struct stress_pass *p)
+{
+    pthread_t writer;
+
+    if (pthread_create(&writer, NULL, stress_writer, p) != 0) {
+        perror("pthread_create");
+        return -1;
+    }
+    stress_reader(p);
+    pthread_join(writer, NULL);
+    if (atomic_load(&failed)) {
+        return -1;
+    }
+    printf("%s: %u samples in %u batches, %u overwritten before read\n",
+           p->name, p->end - p->first, p->batches, p->lost);
+    return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+    uint32_t samples = STRESS_SAMPLES;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        switch (opt) {
+        case 'n':
+            samples = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n samples]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    temp_history_init();
+
+    struct stress_pass paced = {
+        .name = "paced", .first = 0, .end = samples, .paced = true,
+    };
+    struct stress_pass free_running = {
+        .name = "free", .first = samples, .end = 2 * samples, .paced = false,
+    };
+    atomic_init(&paced.read, paced.first);
+    atomic_init(&free_running.read, free_running.first);
+
+    if (stress_run(&paced) != 0 || stress_run(&free_running) != 0) {
+        return 1;
+    }
+    return 0;
+}
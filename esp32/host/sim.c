@@ -0,0 +1,410 @@
+#include <string.h>
+#include "sim.h"
+#include "temp_sampler.h"
+
+#define SIM_MAX_TX_QUEUE 32
+
+/* Inter frame space and LL overhead (preamble, access address, header, CRC) */
+#define SIM_T_IFS_US        150
+#define SIM_LL_OVERHEAD     10
+
+/* L2CAP basic header plus ATT opcode and attribute handle */
+#define SIM_ATT_OVERHEAD    7
+
+/* Handle value confirmation: L2CAP basic header and ATT opcode */
+#define SIM_ATT_CONFIRM     5
+
+/* A notification queued in the stack */
+struct sim_tx {
+    uint8_t data[TEMP_HISTORY_MAX_PAYLOAD];
+    uint16_t len;
+    uint16_t left;          /* L2CAP bytes not yet on air */
+    enum bletemp_chr chr;
+    bool indicate;
+    uint64_t tx_us;
+};
+
+struct sim_conn {
+    bool connected;
+    struct sim_link link;
+    struct bletemp_conn_params params;  /* last parameters the central accepted */
+    uint64_t next_event_us;
+    struct sim_tx queue[SIM_MAX_TX_QUEUE];
+    uint8_t q_head, q_len;
+    bool refused;           /* a notification was refused since the queue last drained */
+    bool confirm_due;       /* the central received confirm, an indication, and confirms it next */
+    struct sim_tx confirm;
+};
+
+static struct sim_conn conns[BLETEMP_MAX_CONN];
+static struct sim_link link_cfg;
+static uint64_t now_us;
+static sim_rx_cb rx_cb;
+static void *rx_arg;
+static uint32_t rx_count;
+static uint32_t drop_count;
+static uint32_t sample_period_ms;
+static uint32_t sample_last_ms;
+static bool sample_started;
+
+static void
+sim_deliver(uint16_t conn_handle, const struct sim_tx *tx, uint64_t rx_us)
+{
+    struct sim_packet pkt;
+
+    pkt.conn_handle = conn_handle;
+    pkt.chr = tx->chr;
+    pkt.len = tx->len;
+    pkt.data = tx->data;
+    pkt.indication = tx->indicate;
+    pkt.tx_us = tx->tx_us;
+    pkt.rx_us = rx_us;
+    rx_count++;
+    if (rx_cb) {
+        rx_cb(&pkt, rx_arg);
+    }
+}
+
+/* Air time of one PDU exchange: an empty PDU from the central and our reply */
+static uint32_t
+sim_exchange_us(const struct sim_link *link, uint16_t octets)
+{
+    return (SIM_LL_OVERHEAD * 8 + (SIM_LL_OVERHEAD + octets) * 8) / link->phy_mbps +
+           2 * SIM_T_IFS_US;
+}
+
+/* Received in full by the central: a notification is done, an indication awaits its confirmation */
+static void
+sim_received(uint16_t conn_handle, struct sim_conn *conn, const struct sim_tx *tx,
+             uint64_t rx_us)
+{
+    if (tx->indicate) {
+        conn->confirm = *tx;
+        conn->confirm_due = true;
+    } else {
+        sim_deliver(conn_handle, tx, rx_us);
+    }
+}
+
+/* Hands the central's confirmation at rx_us to the core */
+static void
+sim_confirm(uint16_t conn_handle, struct sim_conn *conn, uint64_t rx_us)
+{
+    conn->confirm_due = false;
+    sim_deliver(conn_handle, &conn->confirm, rx_us);
+    bletemp_on_confirm(conn_handle, conn->confirm.chr, 0);
+}
+
+/* Confirms indications on connections without the timing model */
+static void
+sim_confirm_now(void)
+{
+    uint16_t i;
+
+    for (i = 0; i < BLETEMP_MAX_CONN; i++) {
+        if (conns[i].connected && conns[i].link.interval_us == 0 && conns[i].confirm_due) {
+            sim_confirm(i, &conns[i], now_us);
+        }
+    }
+}
+
+static int
+sim_queue(uint16_t conn_handle, enum bletemp_chr chr, const uint8_t *data,
+          uint16_t len, bool indicate)
+{
+    struct sim_conn *conn;
+    struct sim_tx *tx;
+
+    if (conn_handle >= BLETEMP_MAX_CONN || !conns[conn_handle].connected) {
+        return -1;
+    }
+    conn = &conns[conn_handle];
+
+    if (conn->link.interval_us == 0) {
+        struct sim_tx now = { .len = len, .chr = chr, .indicate = indicate, .tx_us = now_us };
+
+        memcpy(now.data, data, len);
+        sim_received(conn_handle, conn, &now, now_us);
+        return 0;
+    }
+
+    if (conn->q_len >= conn->link.tx_queue) {
+        drop_count++;
+        conn->refused = true;
+        return -1;
+    }
+
+    tx = &conn->queue[(conn->q_head + conn->q_len) % SIM_MAX_TX_QUEUE];
+    memcpy(tx->data, data, len);
+    tx->len = len;
+    tx->left = len + SIM_ATT_OVERHEAD;
+    tx->chr = chr;
+    tx->indicate = indicate;
+    tx->tx_us = now_us;
+    conn->q_len++;
+    return 0;
+}
+
+static int
+sim_notify(uint16_t conn_handle, enum bletemp_chr chr,
+           const uint8_t *data, uint16_t len)
+{
+    return sim_queue(conn_handle, chr, data, len, false);
+}
+
+static int
+sim_indicate(uint16_t conn_handle, enum bletemp_chr chr,
+             const uint8_t *data, uint16_t len)
+{
+    return sim_queue(conn_handle, chr, data, len, true);
+}
+
+/* The simulated central accepts every request with the shortest interval */
+static int
+sim_update_params(uint16_t conn_handle, const struct bletemp_conn_params *params)
+{
+    if (conn_handle >= BLETEMP_MAX_CONN || !conns[conn_handle].connected) {
+        return -1;
+    }
+    conns[conn_handle].params = *params;
+    bletemp_on_conn_params(conn_handle, params->itvl_min, params->latency,
+                           params->timeout);
+    return 0;
+}
+
+static const struct bletemp_transport sim_transport = {
+    .notify = sim_notify,
+    .indicate = sim_indicate,
+    .update_params = sim_update_params,
+};
+
+/* Sends queued PDUs until the event runs out of time */
+static void
+sim_conn_event(uint16_t conn_handle, struct sim_conn *conn)
+{
+    uint64_t t = conn->next_event_us;
+    uint64_t end = t + conn->link.interval_us - SIM_T_IFS_US;
+    struct sim_tx *tx;
+    uint16_t octets;
+    uint32_t air;
+
+    /* the confirmation leads the event, it may release the next indication */
+    if (conn->confirm_due) {
+        t += sim_exchange_us(&conn->link, SIM_ATT_CONFIRM);
+        sim_confirm(conn_handle, conn, t);
+    }
+
+    while (conn->q_len > 0) {
+        tx = &conn->queue[conn->q_head];
+        octets = (tx->left < conn->link.ll_octets) ? tx->left : conn->link.ll_octets;
+        air = sim_exchange_us(&conn->link, octets);
+        if (t + air > end) {
+            break;
+        }
+        t += air;
+        tx->left -= octets;
+
+        if (tx->left == 0) {
+            conn->q_head = (conn->q_head + 1) % SIM_MAX_TX_QUEUE;
+            conn->q_len--;
+            sim_received(conn_handle, conn, tx, t);
+        }
+    }
+    conn->next_event_us += conn->link.interval_us;
+
+    /* like the stack handing buffers back: retry what was refused */
+    if (conn->refused && conn->q_len < conn->link.tx_queue) {
+        conn->refused = false;
+        bletemp_resume();
+    }
+}
+
+int
+sim_init(sim_rx_cb cb, void *arg)
+{
+    memset(conns, 0, sizeof(conns));
+    memset(&link_cfg, 0, sizeof(link_cfg));
+    now_us = 0;
+    rx_cb = cb;
+    rx_arg = arg;
+    rx_count = 0;
+    drop_count = 0;
+    sample_period_ms = BLETEMP_INTERVAL_DEFAULT_MS;
+    sample_started = false;
+
+    temp_history_init();
+    temp_filter_init();
+    temp_jitter_reset(sample_period_ms * 1000);
+    return bletemp_init(&sim_transport);
+}
+
+void
+sim_set_link(const struct sim_link *link)
+{
+    link_cfg = *link;
+    if (link_cfg.ll_octets == 0) {
+        link_cfg.ll_octets = 27;
+    }
+    if (link_cfg.phy_mbps == 0) {
+        link_cfg.phy_mbps = 1;
+    }
+    if (link_cfg.tx_queue == 0 || link_cfg.tx_queue > SIM_MAX_TX_QUEUE) {
+        link_cfg.tx_queue = SIM_MAX_TX_QUEUE;
+    }
+}
+
+void
+sim_advance(uint64_t until_us)
+{
+    struct sim_conn *next;
+    uint16_t i;
+
+    sim_confirm_now();
+    for (;;) {
+        next = NULL;
+        for (i = 0; i < BLETEMP_MAX_CONN; i++) {
+            if (conns[i].connected && conns[i].link.interval_us != 0 &&
+                conns[i].next_event_us <= until_us &&
+                (next == NULL || conns[i].next_event_us < next->next_event_us)) {
+                next = &conns[i];
+            }
+        }
+        if (next == NULL) {
+            break;
+        }
+        now_us = next->next_event_us;
+        sim_conn_event(next - conns, next);
+    }
+
+    if (until_us > now_us) {
+        now_us = until_us;
+    }
+}
+
+uint64_t
+sim_now_us(void)
+{
+    return now_us;
+}
+
+uint16_t
+sim_connect(void)
+{
+    struct sim_conn *conn;
+    uint16_t conn_handle;
+
+    for (conn_handle = 0; conn_handle < BLETEMP_MAX_CONN; conn_handle++) {
+        if (!conns[conn_handle].connected) {
+            break;
+        }
+    }
+    if (conn_handle == BLETEMP_MAX_CONN) {
+        return BLETEMP_CONN_NONE;
+    }
+
+    conn = &conns[conn_handle];
+    memset(conn, 0, sizeof(*conn));
+    conn->connected = true;
+    conn->link = link_cfg;
+    /* first anchor point after the minimum transmit window offset */
+    conn->next_event_us = now_us + 1250;
+    if (bletemp_on_connect(conn_handle) != 0) {
+        conn->connected = false;
+        return BLETEMP_CONN_NONE;
+    }
+    /* the link comes up with what the stacks negotiate right after connecting */
+    bletemp_on_phy(conn_handle, conn->link.phy_mbps == 2 ? BLETEMP_PHY_2M : BLETEMP_PHY_1M,
+                   conn->link.phy_mbps == 2 ? BLETEMP_PHY_2M : BLETEMP_PHY_1M);
+    bletemp_on_data_len(conn_handle, conn->link.ll_octets, conn->link.ll_octets);
+    return conn_handle;
+}
+
+void
+sim_disconnect(uint16_t conn_handle)
+{
+    if (conn_handle < BLETEMP_MAX_CONN) {
+        conns[conn_handle].connected = false;
+        bletemp_on_disconnect(conn_handle);
+    }
+}
+
+void
+sim_exchange_mtu(uint16_t conn_handle, uint16_t mtu)
+{
+    bletemp_on_mtu(conn_handle, mtu);
+}
+
+int
+sim_subscribe(uint16_t conn_handle, enum bletemp_chr chr, uint16_t cfg)
+{
+    return bletemp_on_subscribe(conn_handle, chr, cfg);
+}
+
+int
+sim_read(uint16_t conn_handle, enum bletemp_chr chr,
+         uint8_t *buf, uint16_t buf_len, uint16_t *out_len)
+{
+    return bletemp_read(conn_handle, chr, buf, buf_len, out_len);
+}
+
+int
+sim_write(uint16_t conn_handle, enum bletemp_chr chr,
+          const uint8_t *data, uint16_t len)
+{
+    return bletemp_write(conn_handle, chr, data, len);
+}
+
+int
+sim_sample(uint32_t timestamp_ms, int16_t celsius)
+{
+    sim_confirm_now();
+    if (sample_started) {
+        temp_jitter_add((timestamp_ms - sample_last_ms) * 1000);
+    }
+    sample_last_ms = timestamp_ms;
+    sample_started = true;
+    temp_history_push(timestamp_ms, celsius);
+    temp_aggregate_add(timestamp_ms, celsius);
+    return bletemp_publish();
+}
+
+/* The simulator is the sampling task, the core reprograms it through here */
+int
+temp_sampler_set_period(uint32_t period_ms)
+{
+    if (period_ms == 0) {
+        return -1;
+    }
+    sample_period_ms = period_ms;
+    sample_started = false;
+    temp_jitter_reset(period_ms * 1000);
+    return 0;
+}
+
+uint32_t
+sim_sample_period_ms(void)
+{
+    return sample_period_ms;
+}
+
+int
+sim_conn_params(uint16_t conn_handle, struct bletemp_conn_params *params)
+{
+    if (conn_handle >= BLETEMP_MAX_CONN || !conns[conn_handle].connected) {
+        return -1;
+    }
+    *params = conns[conn_handle].params;
+    return 0;
+}
+
+uint32_t
+sim_rx_count(void)
+{
+    return rx_count;
+}
+
+uint32_t
+sim_drop_count(void)
+{
+    return drop_count;
+}
@@ -0,0 +1,91 @@
+#ifndef H_BLETEMP_SIM_
+#define H_BLETEMP_SIM_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "bletemp.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * In-process stand-in for the BLE controller and the central. GAP and
+ * GATT events are injected directly into the core and every notification
+ * the core sends is handed to the rx callback instead of going on air.
+ */
+
+struct sim_packet {
+    uint16_t conn_handle;
+    enum bletemp_chr chr;
+    uint16_t len;
+    const uint8_t *data;
+    bool indication;
+    uint64_t tx_us;     /* simulated time the stack accepted the notification */
+    uint64_t rx_us;     /* simulated time the last fragment was acknowledged, or
+                           for an indication when its confirmation came back */
+};
+
+/*
+ * Link layer timing model. With interval_us set to 0 (the default) every
+ * notification is delivered as soon as the core sends it. Otherwise each
+ * notification waits in the stack's queue and goes on air as LL PDUs in
+ * the connection events of the simulated clock; notifications beyond the
+ * queue depth are refused the way a congested stack refuses them, and
+ * bletemp_resume() is called after the next connection event with room.
+ * The central confirms an indication at the start of the connection event
+ * after the one that completed it; without the timing model, on the next
+ * sim_advance() or sim_sample().
+ */
+struct sim_link {
+    uint32_t interval_us;   /* connection interval */
+    uint16_t ll_octets;     /* LL payload per PDU, 27 without DLE */
+    uint8_t phy_mbps;       /* 1 or 2 */
+    uint8_t tx_queue;       /* notifications held per connection, max 32 */
+};
+
+typedef void (*sim_rx_cb)(const struct sim_packet *pkt, void *arg);
+
+int sim_init(sim_rx_cb cb, void *arg);
+
+/* Returns the new connection handle, BLETEMP_CONN_NONE when all slots are taken */
+uint16_t sim_connect(void);
+void sim_disconnect(uint16_t conn_handle);
+void sim_exchange_mtu(uint16_t conn_handle, uint16_t mtu);
+/* cfg is the CCCD value, BLETEMP_SUB_* */
+int sim_subscribe(uint16_t conn_handle, enum bletemp_chr chr, uint16_t cfg);
+int sim_read(uint16_t conn_handle, enum bletemp_chr chr,
+             uint8_t *buf, uint16_t buf_len, uint16_t *out_len);
+int sim_write(uint16_t conn_handle, enum bletemp_chr chr,
+              const uint8_t *data, uint16_t len);
+
+/* Applies to connections made afterwards */
+void sim_set_link(const struct sim_link *link);
+
+/* Runs connection events up to the given simulated time */
+void sim_advance(uint64_t until_us);
+uint64_t sim_now_us(void);
+
+/* Acts as the sampling task: pushes one sample and publishes it */
+int sim_sample(uint32_t timestamp_ms, int16_t celsius);
+
+/* Period the core last asked the sampling task to use */
+uint32_t sim_sample_period_ms(void);
+
+/*
+ * Parameters the central last accepted from the core's policy, all zero
+ * before the first request. The link timing model is not affected.
+ */
+int sim_conn_params(uint16_t conn_handle, struct bletemp_conn_params *params);
+
+/* Number of notifications delivered since sim_init() */
+uint32_t sim_rx_count(void);
+
+/* Number of notifications refused because the queue was full */
+uint32_t sim_drop_count(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,278 @@
+/*
+ * Round trip and compression benchmark of the history batch format. Every
+ * trace is cut into batches the way a central with the given ATT payload
+ * receives them, decoded again and compared sample by sample; any
+ * difference is reported and fails the run. Prints one CSV row per trace
+ * and payload with the bytes per sample of the compact and the raw
+ * 6-byte format and the CPU time to encode and decode a sample.
+ *
+ *   temp_codec_bench [-n samples] [-x]
+ *
+ * With -x the first batch of every trace is also dumped in hex, for
+ * checking other decoders against this one.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "temp_codec.h"
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+/* Size of a batch before the compact format: unit, count and raw samples */
+#define RAW_HDR_SIZE 2
+
+struct bench_trace {
+    const char *name;
+    void (*gen)(temp_sample *s, uint32_t n);
+};
+
+static uint32_t rng = 0x2545F491;
+
+static uint32_t
+bench_rand(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+static uint64_t
+clock_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* 1 s samples around 4 C, a slow random walk plus sensor noise */
+static void
+gen_fridge(temp_sample *s, uint32_t n)
+{
+    int walk = 400;
+    uint32_t i;
+
+    for (i = 0; i < n; i++) {
+        walk += (int)(bench_rand() % 3) - 1;
+        s[i].timestamp = 1000 * (i + 1);
+        s[i].temperature = walk + (int)(bench_rand() % 11) - 5;
+    }
+}
+
+/* The fridge with the door opened every few minutes, decaying back */
+static void
+gen_door(temp_sample *s, uint32_t n)
+{
+    int walk = 400, door = 0;
+    uint32_t i;
+
+    for (i = 0; i < n; i++) {
+        walk += (int)(bench_rand() % 3) - 1;
+        door = (bench_rand() % 300 == 0) ? 600 : door * 15 / 16;
+        s[i].timestamp = 1000 * (i + 1);
+        s[i].temperature = walk + door + (int)(bench_rand() % 11) - 5;
+    }
+}
+
+/* 5 s samples of a room, quiet sensor, on a 10 ms scheduler tick */
+static void
+gen_room(temp_sample *s, uint32_t n)
+{
+    int walk = 2150;
+    uint32_t i;
+
+    for (i = 0; i < n; i++) {
+        if (bench_rand() % 8 == 0) {
+            walk += (int)(bench_rand() % 3) - 1;
+        }
+        s[i].timestamp = 5000 * (i + 1) + ((bench_rand() % 4 == 0) ? 10 : 0);
+        s[i].temperature = walk;
+    }
+}
+
+/* The sampling period switched from 1 s to 60 s and back every 100 samples */
+static void
+gen_interval(temp_sample *s, uint32_t n)
+{
+    uint32_t i, ts = 0;
+    int walk = 2000;
+
+    for (i = 0; i < n; i++) {
+        ts += ((i / 100) % 2) ? 60000 : 1000;
+        walk += (int)(bench_rand() % 5) - 2;
+        s[i].timestamp = ts;
+        s[i].temperature = walk;
+    }
+}
+
+/* Worst case: any temperature at any time within the longest period */
+static void
+gen_random(temp_sample *s, uint32_t n)
+{
+    uint32_t i, ts = 0;
+
+    for (i = 0; i < n; i++) {
+        ts += 50 + bench_rand() % 60000;
+        s[i].timestamp = ts;
+        s[i].temperature = (int16_t)bench_rand();
+    }
+}
+
+static const struct bench_trace traces[] = {
+    { "fridge", gen_fridge },
+    { "door", gen_door },
+    { "room", gen_room },
+    { "interval", gen_interval },
+    { "random", gen_random },
+};
+
+/* ATT payloads of the default, a common and the largest MTU */
+static const uint16_t payloads[] = { 20, 244, TEMP_HISTORY_MAX_PAYLOAD };
+
+/* Bytes the raw format needs for n samples in batches of payload bytes */
+static uint64_t
+raw_bytes(uint32_t n, uint16_t payload)
+{
+    uint32_t batch = (payload - RAW_HDR_SIZE) / sizeof(temp_sample);
+    uint32_t batches;
+
+    if (batch > UINT8_MAX) {
+        batch = UINT8_MAX;
+    }
+    batches = (n + batch - 1) / batch;
+    return (uint64_t)batches * RAW_HDR_SIZE + (uint64_t)n * sizeof(temp_sample);
+}
+
+static void
+hexdump(const char *name, const uint8_t *buf, uint16_t len)
+{
+    uint16_t i;
+
+    printf("# %s ", name);
+    for (i = 0; i < len; i++) {
+        printf("%02x", buf[i]);
+    }
+    printf("\n");
+}
+
+/*
+ * Encodes the trace into batches, decodes them back and compares. Returns
+ * the encoded size, 0 on a mismatch.
+ */
+static uint64_t
+round_trip(const struct bench_trace *t, const temp_sample *s, uint32_t n, uint16_t payload,
+           bool dump, uint64_t *enc_ns, uint64_t *dec_ns, uint32_t *batches)
+{
+    static uint8_t buf[TEMP_HISTORY_MAX_PAYLOAD];
+    static temp_sample out[UINT8_MAX];
+    struct temp_codec_enc enc;
+    uint64_t bytes = 0, t0;
+    uint32_t i = 0, first;
+    uint16_t len;
+    uint8_t unit;
+    int got, k;
+
+    while (i < n) {
+        first = i;
+        t0 = clock_ns();
+        temp_codec_begin(&enc, 'C', buf, payload);
+        while (i < n && temp_codec_put(&enc, s[i].timestamp, s[i].temperature)) {
+            i++;
+        }
+        len = temp_codec_end(&enc);
+        *enc_ns += clock_ns() - t0;
+        if (i == first) {
+            fprintf(stderr, "%s: payload %d holds no sample\n", t->name, payload);
+            return 0;
+        }
+        if (dump && first == 0) {
+            hexdump(t->name, buf, len);
+        }
+
+        t0 = clock_ns();
+        got = temp_codec_decode(buf, len, &unit, out, ARRAY_SIZE(out));
+        *dec_ns += clock_ns() - t0;
+        if (got != (int)(i - first) || unit != 'C') {
+            fprintf(stderr, "%s: batch at %u decoded %d of %u samples\n", t->name,
+                    first, got, i - first);
+            return 0;
+        }
+        for (k = 0; k < got; k++) {
+            if (out[k].timestamp != s[first + k].timestamp ||
+                out[k].temperature != s[first + k].temperature) {
+                fprintf(stderr, "%s: sample %u decoded as %u/%d, was %u/%d\n", t->name,
+                        first + k, out[k].timestamp, out[k].temperature,
+                        s[first + k].timestamp, s[first + k].temperature);
+                return 0;
+            }
+        }
+        bytes += len;
+        (*batches)++;
+    }
+    return bytes;
+}
+
+static void
+usage(const char *argv0)
+{
+    fprintf(stderr, "usage: %s [-n samples] [-x]\n", argv0);
+    exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+    uint64_t bytes, raw, enc_ns, dec_ns;
+    uint32_t samples = 100000, batches;
+    temp_sample *s;
+    bool dump = false;
+    unsigned i, p;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:x")) != -1) {
+        switch (opt) {
+        case 'n':
+            samples = atoi(optarg);
+            break;
+        case 'x':
+            dump = true;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (samples == 0) {
+        usage(argv[0]);
+    }
+
+    s = calloc(samples, sizeof(*s));
+    if (s == NULL) {
+        return 1;
+    }
+
+    printf("trace,payload,batches,bytes_per_sample,raw_bytes_per_sample,ratio,"
+           "encode_ns,decode_ns\n");
+    for (i = 0; i < ARRAY_SIZE(traces); i++) {
+        traces[i].gen(s, samples);
+        for (p = 0; p < ARRAY_SIZE(payloads); p++) {
+            enc_ns = dec_ns = 0;
+            batches = 0;
+            bytes = round_trip(&traces[i], s, samples, payloads[p], dump && p == 1,
+                               &enc_ns, &dec_ns, &batches);
+            if (bytes == 0) {
+                return 1;
+            }
+            raw = raw_bytes(samples, payloads[p]);
+            printf("%s,%d,%u,%.2f,%.2f,%.1f,%.1f,%.1f\n", traces[i].name, payloads[p],
+                   batches, (double)bytes / samples, (double)raw / samples,
+                   (double)raw / bytes, (double)enc_ns / samples, (double)dec_ns / samples);
+        }
+    }
+
+    free(s);
+    return 0;
+}
@@ -0,0 +1,150 @@
+/*
+ * Celsius to Fahrenheit, the integer temp_convert() against the floating
+ * point expression it replaced. Checks temp_convert() over every 16-bit
+ * input against an exact reference, and counts the inputs the old code
+ * got wrong, then times both on the same random readings.
+ *
+ * Prints one CSV row per method: nanoseconds per conversion and inputs
+ * off the reference. Exits non-zero if temp_convert() is ever off.
+ *
+ *   temp_convert_bench [-n conversions]
+ */
+#define _GNU_SOURCE
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "bletemp.h"
+
+/* Defeats the optimiser, every conversion is summed in */
+static volatile int32_t sink;
+
+static uint32_t rng = 0x2545F491;
+
+static uint32_t
+bench_rand(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+static uint64_t
+clock_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* What temp_convert() did before, in double precision */
+static int16_t
+convert_float(int16_t celsius, uint8_t unit)
+{
+    if (unit == 'F') {
+        return (celsius * 1.8) + 32;
+    }
+    return celsius;
+}
+
+/* Hundredths of a degree Fahrenheit, rounded to nearest and saturated */
+static int16_t
+convert_ref(int16_t celsius)
+{
+    long f = lround(celsius * 9.0 / 5.0) + 3200;
+
+    if (f > INT16_MAX) {
+        return INT16_MAX;
+    }
+    if (f < INT16_MIN) {
+        return INT16_MIN;
+    }
+    return f;
+}
+
+/* Inputs the conversion gets wrong in either unit */
+static unsigned
+mismatches(int16_t (*convert)(int16_t, uint8_t))
+{
+    unsigned n = 0;
+    int32_t c;
+
+    for (c = INT16_MIN; c <= INT16_MAX; c++) {
+        if (convert(c, 'F') != convert_ref(c)) {
+            n++;
+        }
+        if (convert(c, 'C') != c) {
+            n++;
+        }
+    }
+    return n;
+}
+
+static double
+run(int16_t (*convert)(int16_t, uint8_t), const int16_t *in, uint32_t n)
+{
+    uint64_t t0 = clock_ns();
+    int32_t sum = 0;
+    uint32_t i;
+
+    for (i = 0; i < n; i++) {
+        sum += convert(in[i], 'F');
+    }
+    sink += sum;
+    return (double)(clock_ns() - t0) / n;
+}
+
+static void
+usage(const char *argv0)
+{
+    fprintf(stderr, "usage: %s [-n conversions]\n", argv0);
+    exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+    uint32_t conversions = 10000000, i;
+    unsigned float_off, fixed_off;
+    int16_t *in;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        switch (opt) {
+        case 'n':
+            conversions = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (conversions == 0) {
+        usage(argv[0]);
+    }
+
+    in = calloc(conversions, sizeof(*in));
+    if (in == NULL) {
+        return 1;
+    }
+    /* readings a thermometer could give, -40 to 125 C */
+    for (i = 0; i < conversions; i++) {
+        in[i] = (int16_t)(bench_rand() % 16501) - 4000;
+    }
+
+    float_off = mismatches(convert_float);
+    fixed_off = mismatches(temp_convert);
+
+    printf("method,ns_per_conversion,mismatches\n");
+    printf("float,%.2f,%u\n", run(convert_float, in, conversions), float_off);
+    printf("fixed,%.2f,%u\n", run(temp_convert, in, conversions), fixed_off);
+
+    free(in);
+    if (fixed_off != 0) {
+        fprintf(stderr, "temp_convert off the reference for %u inputs\n", fixed_off);
+        return 1;
+    }
+    return 0;
+}
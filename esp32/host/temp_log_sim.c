@@ -0,0 +1,269 @@
+/*
+ * Exercises the flash sample log on a file standing in for the partition.
+ * Appends a random walk of samples with a reboot every few thousand, half
+ * of them clean (flushed) and half power losses, and after each one checks
+ * the log against what was appended: a full scan, random range queries
+ * and the oldest sample. Prints wear and density figures at the end and
+ * exits non-zero on the first mismatch.
+ *
+ *   temp_log_sim [-f file] [-k size_kb] [-n samples] [-p period_ms] [-r reboot_every]
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "flash_file.h"
+#include "temp_log.h"
+
+#define SECTOR_SIZE 4096
+#define QUERY_CHUNK 100
+#define RANGE_QUERIES 200
+
+/* Everything appended, with the timestamps the log is expected to assign */
+static temp_sample *truth;
+static size_t truth_len;
+
+static uint32_t rng = 0x2545F491;
+
+static uint32_t
+sim_rand(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+static uint64_t
+clock_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Index of the first truth sample at or after ts */
+static size_t
+truth_find(uint32_t ts)
+{
+    size_t lo = 0, hi = truth_len, mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (truth[mid].timestamp < ts) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/* Reads [from, to] in chunks, returns the number of samples, -1 on mismatch */
+static long
+check_range(uint32_t from, uint32_t to, uint64_t *query_ns, uint32_t *queries)
+{
+    temp_sample buf[QUERY_CHUNK];
+    size_t i, n, expect = truth_find(from);
+    long total = 0;
+    uint64_t t0;
+
+    for (;;) {
+        t0 = clock_ns();
+        n = temp_log_query(from, to, buf, QUERY_CHUNK);
+        *query_ns += clock_ns() - t0;
+        (*queries)++;
+
+        for (i = 0; i < n; i++, expect++) {
+            if (expect >= truth_len || truth[expect].timestamp > to ||
+                buf[i].timestamp != truth[expect].timestamp ||
+                buf[i].temperature != truth[expect].temperature) {
+                fprintf(stderr, "mismatch in [%u, %u] at %zu: got %u/%d\n", from, to,
+                        expect, buf[i].timestamp, buf[i].temperature);
+                return -1;
+            }
+        }
+        total += n;
+        if (n < QUERY_CHUNK || buf[n - 1].timestamp == to) {
+            break;
+        }
+        from = buf[n - 1].timestamp + 1;
+    }
+
+    if (expect < truth_len && truth[expect].timestamp <= to) {
+        fprintf(stderr, "range [%u, %u] ends early at %zu\n", from, to, expect);
+        return -1;
+    }
+    return total;
+}
+
+/* Full scan plus random ranges over what the log still holds */
+static long
+check_log(uint64_t *query_ns, uint32_t *queries)
+{
+    uint32_t oldest, a, b, span;
+    long held;
+    int i;
+
+    if (!temp_log_oldest(&oldest)) {
+        return truth_len == 0 ? 0 : -1;
+    }
+    /* anything older was dropped with its sector */
+    if (truth_find(oldest) >= truth_len || truth[truth_find(oldest)].timestamp != oldest) {
+        fprintf(stderr, "oldest %u not appended\n", oldest);
+        return -1;
+    }
+
+    held = check_range(oldest, UINT32_MAX, query_ns, queries);
+    if (held < 0) {
+        return -1;
+    }
+
+    span = truth[truth_len - 1].timestamp - oldest + 1;
+    for (i = 0; i < RANGE_QUERIES; i++) {
+        a = oldest + sim_rand() % span;
+        b = a + sim_rand() % (span / 16 + 1);
+        if (check_range(a, b, query_ns, queries) < 0) {
+            return -1;
+        }
+    }
+    return held;
+}
+
+static void
+usage(const char *argv0)
+{
+    fprintf(stderr, "usage: %s [-f file] [-k size_kb] [-n samples] [-p period_ms] "
+            "[-r reboot_every]\n", argv0);
+    exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+    const char *path = "temp_log.bin";
+    uint32_t size_kb = 64, samples = 100000, period_ms = 5000, reboot_every = 7919;
+    uint32_t n, boot_ms = 0, base = 0, queries = 0, reboots = 0, lost = 0;
+    uint32_t i, min_erase = UINT32_MAX, max_erase = 0;
+    temp_sample last;
+    uint32_t newest = 0;
+    struct flash_file ff;
+    uint64_t query_ns = 0;
+    int temp = 2000;
+    long held = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "f:k:n:p:r:")) != -1) {
+        switch (opt) {
+        case 'f':
+            path = optarg;
+            break;
+        case 'k':
+            size_kb = atoi(optarg);
+            break;
+        case 'n':
+            samples = atoi(optarg);
+            break;
+        case 'p':
+            period_ms = atoi(optarg);
+            break;
+        case 'r':
+            reboot_every = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (size_kb == 0 || samples == 0 || period_ms == 0 || reboot_every == 0) {
+        usage(argv[0]);
+    }
+
+    unlink(path);
+    truth = calloc(samples, sizeof(*truth));
+    if (truth == NULL || flash_file_open(&ff, path, size_kb * 1024, SECTOR_SIZE) != 0 ||
+        temp_log_init(&ff.flash) != 0) {
+        fprintf(stderr, "cannot set up %u KB log in %s\n", size_kb, path);
+        return 1;
+    }
+
+    for (n = 1; n <= samples; n++) {
+        /* slow drift, sensor noise and the odd door opening */
+        temp += (int)(sim_rand() % 5) - 2;
+        if (sim_rand() % 500 == 0) {
+            temp += (int)(sim_rand() % 2001) - 1000;
+        }
+        boot_ms += period_ms;
+        temp_log_append(boot_ms, temp);
+        truth[truth_len].timestamp = base + boot_ms;
+        truth[truth_len].temperature = temp;
+        truth_len++;
+
+        if (n % reboot_every != 0 && n != samples) {
+            continue;
+        }
+
+        reboots++;
+        if (reboots % 2 == 0) {
+            temp_log_flush();
+        }
+        temp_log_init(&ff.flash);
+
+        /* a power loss drops what was still in RAM, at most one page */
+        if (temp_log_query(truth[truth_len - 1].timestamp, UINT32_MAX, &last, 1) == 0) {
+            size_t kept = 0;
+            temp_sample tail[QUERY_CHUNK];
+            uint32_t from = 0;
+            size_t got;
+
+            if (temp_log_oldest(&from)) {
+                /* walk to the newest sample on flash */
+                while ((got = temp_log_query(from, UINT32_MAX, tail, QUERY_CHUNK)) > 0) {
+                    last = tail[got - 1];
+                    from = last.timestamp + 1;
+                }
+                kept = truth_find(last.timestamp + 1);
+            }
+            if (reboots % 2 == 0 || truth_len - kept > TEMP_LOG_PAGE_SIZE / 2) {
+                fprintf(stderr, "reboot %u lost %zu samples\n", reboots, truth_len - kept);
+                return 1;
+            }
+            lost += truth_len - kept;
+            truth_len = kept;
+        }
+
+        held = check_log(&query_ns, &queries);
+        if (held < 0) {
+            fprintf(stderr, "check failed after reboot %u, sample %u\n", reboots, n);
+            return 1;
+        }
+        /* the log carries on from its newest sample */
+        base = truth_len ? truth[truth_len - 1].timestamp : 0;
+        boot_ms = 0;
+        if (temp_log_time_base() != base ||
+            (truth_len > 0 && (!temp_log_newest(&newest) || newest != base))) {
+            fprintf(stderr, "reboot %u resumes at %u, newest %u, expected %u\n", reboots,
+                    temp_log_time_base(), newest, base);
+            return 1;
+        }
+    }
+
+    for (i = 0; i < size_kb * 1024 / SECTOR_SIZE; i++) {
+        min_erase = (ff.erase_count[i] < min_erase) ? ff.erase_count[i] : min_erase;
+        max_erase = (ff.erase_count[i] > max_erase) ? ff.erase_count[i] : max_erase;
+    }
+
+    printf("appended=%u held=%ld lost_on_power_loss=%u reboots=%u\n",
+           samples, held, lost, reboots);
+    printf("bytes_per_sample=%.2f span_h=%.1f\n",
+           (double)size_kb * 1024 / held,
+           held ? (truth[truth_len - 1].timestamp - truth[truth_len - held].timestamp) / 3.6e6 : 0);
+    printf("page_writes=%u bad_writes=%u erases_per_sector=%u..%u\n",
+           ff.writes, ff.bad_writes, min_erase, max_erase);
+    printf("queries=%u avg_query_us=%.1f\n", queries, query_ns / 1e3 / queries);
+
+    flash_file_close(&ff);
+    return ff.bad_writes ? 1 : 0;
+}
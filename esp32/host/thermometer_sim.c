@@ -0,0 +1,218 @@
+/*
+ * Drives the thermometer core through a scripted session on the host:
+ * three centrals connect, one subscribes to temperature notifications,
+ * one to the history with a larger MTU and one to temperature
+ * indications, and the unit and the sampling interval are switched
+ * halfway. The connection parameters the policy requested are printed
+ * after each phase, the advertising interval whenever it changes tier and
+ * the indication round trips at the end.
+ *
+ *   thermometer_sim [samples]
+ *
+ * Checks along the way what every central must see: each request
+ * accepted, temperatures in range for the unit they carry, history
+ * batches that decode and leave no gap before what a final read returns,
+ * each temperature subscriber served and every indication confirmed.
+ * Exits non-zero if any check failed.
+ */
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "sim.h"
+#include "temp_codec.h"
+
+static const char *chr_name[BLETEMP_CHR_COUNT] = {
+    [BLETEMP_CHR_TEMP] = "temp",
+    [BLETEMP_CHR_UNIT] = "unit",
+    [BLETEMP_CHR_HIST] = "hist",
+    [BLETEMP_CHR_INTERVAL] = "interval",
+};
+
+/* Notifications and indications received per connection */
+static uint32_t rx_count[BLETEMP_MAX_CONN];
+/* Unit of the last temperature each connection received */
+static uint8_t rx_unit[BLETEMP_MAX_CONN];
+/* Newest sample notified in a history batch, 0 if none */
+static uint32_t hist_last;
+static int failures;
+
+static void
+check(bool ok, const char *fmt, ...)
+{
+    va_list ap;
+
+    if (ok) {
+        return;
+    }
+    va_start(ap, fmt);
+    fprintf(stderr, "FAIL: ");
+    vfprintf(stderr, fmt, ap);
+    fprintf(stderr, "\n");
+    va_end(ap);
+    failures++;
+}
+
+static void
+print_params(uint16_t conn_handle)
+{
+    struct bletemp_conn_params params;
+
+    if (sim_conn_params(conn_handle, &params) == 0) {
+        printf("conn=%d params itvl=%d-%d latency=%d timeout=%d\n", conn_handle,
+               params.itvl_min, params.itvl_max, params.latency, params.timeout);
+    }
+}
+
+static void
+on_rx(const struct sim_packet *pkt, void *arg)
+{
+    temp_sample hist[UINT8_MAX];
+    const temp_struct *temp;
+    uint8_t unit;
+    int16_t value;
+    int n;
+
+    if (pkt->conn_handle < BLETEMP_MAX_CONN) {
+        rx_count[pkt->conn_handle]++;
+    }
+    switch (pkt->chr) {
+    case BLETEMP_CHR_TEMP:
+        temp = (const temp_struct *)pkt->data;
+        value = temp->temperature;
+        printf("conn=%d %s %d %c%s\n", pkt->conn_handle, chr_name[pkt->chr],
+               value, temp->unit, pkt->indication ? " confirmed" : "");
+        /*
+         * the script samples 20.00 to 23.04 C, 68.00 to 73.47 F; subscribing
+         * before the first sample gets a 0
+         */
+        check(pkt->len == sizeof(*temp), "conn=%d temp len=%d", pkt->conn_handle, pkt->len);
+        check((value == 0 && pkt->conn_handle < BLETEMP_MAX_CONN && rx_unit[pkt->conn_handle] == 0) ||
+              (temp->unit == 'C' && value >= 2000 && value <= 2304) ||
+              (temp->unit == 'F' && value >= 6800 && value <= 7347),
+              "conn=%d temp %d %c out of range", pkt->conn_handle, value, temp->unit);
+        if (pkt->conn_handle < BLETEMP_MAX_CONN) {
+            rx_unit[pkt->conn_handle] = temp->unit;
+        }
+        break;
+    case BLETEMP_CHR_HIST:
+        n = temp_codec_decode(pkt->data, pkt->len, &unit, hist, UINT8_MAX);
+        check(n > 0, "conn=%d hist len=%d does not decode", pkt->conn_handle, pkt->len);
+        if (n <= 0) {
+            printf("conn=%d %s len=%d samples=%d\n", pkt->conn_handle,
+                   chr_name[pkt->chr], pkt->len, n);
+            break;
+        }
+        printf("conn=%d %s len=%d samples=%d unit=%c %u..%u ms\n", pkt->conn_handle,
+               chr_name[pkt->chr], pkt->len, n, unit, hist[0].timestamp,
+               hist[n - 1].timestamp);
+        check(hist[0].timestamp > hist_last, "conn=%d hist %u ms sent again",
+              pkt->conn_handle, hist[0].timestamp);
+        hist_last = hist[n - 1].timestamp;
+        break;
+    default:
+        printf("conn=%d %s len=%d\n", pkt->conn_handle, chr_name[pkt->chr], pkt->len);
+        break;
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    static const uint8_t interval[2] = { 1000 & 0xFF, 1000 >> 8 };
+    uint8_t buf[TEMP_HISTORY_MAX_PAYLOAD], unit;
+    temp_sample hist[UINT8_MAX];
+    rtt_struct rtt;
+    jitter_struct jitter;
+    aggregate_struct aggregate;
+    adv_svc_data adv;
+    uint16_t a, b, c, len, itvl_min, itvl_max;
+    uint32_t t, ts = 0, first = 0, period, period_max = 0;
+    int samples = (argc > 1) ? atoi(argv[1]) : 100;
+    int rc;
+
+    if (samples < 10) {
+        fprintf(stderr, "usage: %s [samples], at least 10\n", argv[0]);
+        return 2;
+    }
+
+    sim_init(on_rx, NULL);
+
+    a = sim_connect();
+    b = sim_connect();
+    c = sim_connect();
+    if (a == BLETEMP_CONN_NONE || b == BLETEMP_CONN_NONE || c == BLETEMP_CONN_NONE) {
+        fprintf(stderr, "FAIL: connect %d %d %d\n", a, b, c);
+        return 1;
+    }
+    sim_exchange_mtu(b, 247);
+    rc = sim_subscribe(a, BLETEMP_CHR_TEMP, BLETEMP_SUB_NOTIFY);
+    check(rc == 0, "subscribe temp notifications rc=%d", rc);
+    rc = sim_subscribe(b, BLETEMP_CHR_HIST, BLETEMP_SUB_NOTIFY);
+    check(rc == 0, "subscribe hist notifications rc=%d", rc);
+    rc = sim_subscribe(c, BLETEMP_CHR_TEMP, BLETEMP_SUB_INDICATE);
+    check(rc == 0, "subscribe temp indications rc=%d", rc);
+    print_params(a);
+    print_params(b);
+
+    for (t = 0; t < (uint32_t)samples; t++) {
+        if (t == (uint32_t)samples / 2) {
+            rc = sim_write(a, BLETEMP_CHR_UNIT, (const uint8_t *)"F", 1);
+            printf("write unit F rc=%d\n", rc);
+            check(rc == 0, "write unit rc=%d", rc);
+            rc = sim_write(a, BLETEMP_CHR_INTERVAL, interval, sizeof(interval));
+            printf("write interval 1000 ms rc=%d\n", rc);
+            check(rc == 0, "write interval rc=%d", rc);
+            print_params(a);
+            print_params(b);
+        }
+        period = sim_sample_period_ms();
+        period_max = (period > period_max) ? period : period_max;
+        ts += period;
+        first = (first == 0) ? ts : first;
+        /* sensor noise and a 3 degree step a quarter of the way in */
+        sim_sample(ts, 2000 + (t % 5) + ((t < (uint32_t)samples / 4) ? 0 : 300));
+        if (bletemp_adv_update(ts) & BLETEMP_ADV_ITVL) {
+            bletemp_adv_get(&adv, &itvl_min, &itvl_max);
+            printf("t=%u ms adv %d %c itvl=%d-%d\n", ts, adv.temperature, adv.unit,
+                   itvl_min, itvl_max);
+        }
+    }
+
+    rc = sim_read(b, BLETEMP_CHR_HIST, buf, sizeof(buf), &len);
+    printf("read hist rc=%d len=%d\n", rc, len);
+    check(rc == 0 && temp_codec_decode(buf, len, &unit, hist, UINT8_MAX) > 0 && unit == 'F',
+          "read hist rc=%d len=%d", rc, len);
+    /* what was not notified yet is short of a batch, a read holds at least one */
+    check(hist[0].timestamp <= ((hist_last != 0) ? hist_last + period_max : first),
+          "read hist from %u ms, notified up to %u ms", hist[0].timestamp, hist_last);
+    rc = sim_read(c, BLETEMP_CHR_RTT, (uint8_t *)&rtt, sizeof(rtt), &len);
+    printf("read rtt rc=%d lost=%u max=%u ms buckets", rc, rtt.lost, rtt.max);
+    for (t = 0; t < BLETEMP_RTT_BUCKETS; t++) {
+        printf(" %u", rtt.count[t]);
+    }
+    printf("\n");
+    check(rc == 0 && rtt.lost == 0, "read rtt rc=%d lost=%u", rc, rtt.lost);
+    rc = sim_read(c, BLETEMP_CHR_JITTER, (uint8_t *)&jitter, sizeof(jitter), &len);
+    printf("read jitter rc=%d count=%u period=%u min=%u max=%u stddev=%u us\n", rc,
+           jitter.count, jitter.period, jitter.min, jitter.max, jitter.stddev);
+    rc = sim_read(c, BLETEMP_CHR_AGGREGATE, (uint8_t *)&aggregate, sizeof(aggregate), &len);
+    printf("read aggregate rc=%d start=%u ms count=%u min=%d max=%d mean=%d stddev=%u %c\n", rc,
+           aggregate.start, aggregate.count, aggregate.min, aggregate.max, aggregate.mean,
+           aggregate.stddev, aggregate.unit);
+    check(rc == 0 && aggregate.unit == 'F', "read aggregate rc=%d unit=%c", rc, aggregate.unit);
+
+    /* every temperature subscriber was served, in the unit it was switched to */
+    check(rx_count[a] > 0 && rx_unit[a] == 'F', "conn=%d rx=%u unit=%c", a, rx_count[a], rx_unit[a]);
+    check(rx_count[c] > 0 && rx_unit[c] == 'F', "conn=%d rx=%u unit=%c", c, rx_count[c], rx_unit[c]);
+
+    sim_disconnect(a);
+    print_params(b);
+    sim_disconnect(b);
+    sim_disconnect(c);
+    printf("notifications=%u\n", sim_rx_count());
+    if (failures > 0) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,236 @@
+#include <string.h>
+#include "esp_log.h"
+#include "host/ble_hs.h"
+#include "bletemp.h"
+#include "temp_codec.h"
+#include "temp_log.h"
+#include "coc.h"
+
+#if MYNEWT_VAL(BLE_L2CAP_COC_MAX_NUM) > 0
+
+/* One history dump per open channel */
+struct bletemp_coc_stream {
+    struct ble_l2cap_chan *chan;
+    uint16_t sdu_len;       /* largest SDU the peer accepts */
+    uint8_t from_log;       /* dumping the flash log rather than the RAM history */
+    uint32_t cursor;        /* next sample to send, its log timestamp or history sequence */
+    uint32_t end;           /* the newest one when the dump started */
+    uint8_t done;           /* end marker sent */
+    uint8_t stalled;        /* waiting for credits */
+};
+
+static struct bletemp_coc_stream streams[MYNEWT_VAL(BLE_L2CAP_COC_MAX_NUM)];
+
+static struct bletemp_coc_stream *
+bletemp_coc_find(const struct ble_l2cap_chan *chan)
+{
+    int i;
+
+    for (i = 0; i < MYNEWT_VAL(BLE_L2CAP_COC_MAX_NUM); i++) {
+        if (streams[i].chan == chan) {
+            return &streams[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Packs the log samples from *cursor up to the end of the dump that fit
+ * in buf, restamped since boot, and advances *cursor past them. Returns
+ * the batch length, 0 when nothing is left.
+ */
+static uint16_t
+bletemp_coc_encode_log(const struct bletemp_coc_stream *s, uint32_t *cursor, uint8_t *buf)
+{
+    /* a batch counts its samples in a byte */
+    static temp_sample samples[UINT8_MAX];
+    struct temp_codec_enc enc;
+    uint32_t base = temp_log_time_base();
+    size_t n, i;
+
+    if (*cursor > s->end) {
+        return 0;
+    }
+    n = temp_log_query(*cursor, s->end, samples, UINT8_MAX);
+    if (n == 0) {
+        return 0;
+    }
+
+    temp_codec_begin(&enc, bletemp_unit(), buf, s->sdu_len);
+    for (i = 0; i < n; i++) {
+        if (!temp_codec_put(&enc, samples[i].timestamp - base,
+                            temp_convert(samples[i].temperature, bletemp_unit()))) {
+            break;
+        }
+    }
+    if (i == 0) {
+        return 0;
+    }
+    *cursor = samples[i - 1].timestamp + 1;
+    return temp_codec_end(&enc);
+}
+
+/*
+ * Sends SDUs until the history up to the start of the dump is out, the
+ * peer runs out of credits or the host runs out of mbufs
+ */
+static void
+bletemp_coc_pump(struct bletemp_coc_stream *s)
+{
+    static uint8_t buf[BLETEMP_COC_MTU];
+    struct temp_codec_enc enc;
+    struct os_mbuf *om;
+    uint32_t cursor;
+    uint16_t len;
+    bool last;
+    int rc;
+
+    while (!s->done && !s->stalled) {
+        cursor = s->cursor;
+        len = 0;
+        if (s->from_log) {
+            len = bletemp_coc_encode_log(s, &cursor, buf);
+        } else if (cursor < s->end) {
+            len = temp_history_encode(&cursor, bletemp_unit(), buf, s->sdu_len);
+            if (len == 0 && cursor != s->cursor) {
+                /* the sampler overwrote the batch while it was copied */
+                s->cursor = cursor;
+                continue;
+            }
+        }
+        last = (len == 0);
+        if (last) {
+            /* nothing left: an empty batch marks the end of the dump */
+            temp_codec_begin(&enc, bletemp_unit(), buf, sizeof(buf));
+            len = temp_codec_end(&enc);
+        }
+
+        om = ble_hs_mbuf_from_flat(buf, len);
+        if (om == NULL) {
+            return;
+        }
+
+        rc = ble_l2cap_send(s->chan, om);
+        if (rc != 0 && rc != BLE_HS_ESTALLED) {
+            /* not queued; retried on unstall or by bletemp_coc_resume() */
+            os_mbuf_free_chain(om);
+            if (rc != BLE_HS_EBUSY && rc != BLE_HS_ENOMEM) {
+                ESP_LOGE("BLE", "coc send failed; rc=%d", rc);
+                ble_l2cap_disconnect(s->chan);
+            }
+            return;
+        }
+
+        /* queued, possibly waiting for credits */
+        s->stalled = (rc == BLE_HS_ESTALLED);
+        s->done = last;
+        s->cursor = cursor;
+    }
+}
+
+static int
+bletemp_coc_event(struct ble_l2cap_event *event, void *arg)
+{
+    struct ble_l2cap_chan_info info;
+    struct bletemp_coc_stream *s;
+    struct os_mbuf *sdu_rx;
+
+    switch (event->type) {
+    case BLE_L2CAP_EVENT_COC_ACCEPT:
+        /* the central does not send anything, but the channel needs an rx buffer */
+        sdu_rx = os_msys_get_pkthdr(BLETEMP_COC_MTU, 0);
+        if (sdu_rx == NULL) {
+            return BLE_HS_ENOMEM;
+        }
+        return ble_l2cap_recv_ready(event->accept.chan, sdu_rx);
+
+    case BLE_L2CAP_EVENT_COC_CONNECTED:
+        if (event->connect.status != 0) {
+            return 0;
+        }
+        s = bletemp_coc_find(NULL);
+        if (s == NULL || ble_l2cap_get_chan_info(event->connect.chan, &info) != 0) {
+            ble_l2cap_disconnect(event->connect.chan);
+            return 0;
+        }
+        memset(s, 0, sizeof(*s));
+        s->chan = event->connect.chan;
+        s->sdu_len = (info.peer_coc_mtu < BLETEMP_COC_MTU) ?
+                     info.peer_coc_mtu : BLETEMP_COC_MTU;
+        /* the log also holds what was sampled before the reboot and while no one listened */
+        s->from_log = temp_log_oldest(&s->cursor) && temp_log_newest(&s->end);
+        if (s->from_log) {
+            ESP_LOGI("BLE", "coc dump; conn_handle=%d sdu=%d log %u..%u ms",
+                     event->connect.conn_handle, s->sdu_len, (unsigned)s->cursor,
+                     (unsigned)s->end);
+        } else {
+            s->cursor = temp_history_oldest();
+            s->end = temp_history_head();
+            ESP_LOGI("BLE", "coc dump; conn_handle=%d sdu=%d samples=%d",
+                     event->connect.conn_handle, s->sdu_len, (int)(s->end - s->cursor));
+        }
+        bletemp_coc_pump(s);
+        return 0;
+
+    case BLE_L2CAP_EVENT_COC_TX_UNSTALLED:
+        s = bletemp_coc_find(event->tx_unstalled.chan);
+        if (s != NULL) {
+            s->stalled = 0;
+            bletemp_coc_pump(s);
+        }
+        return 0;
+
+    case BLE_L2CAP_EVENT_COC_DATA_RECEIVED:
+        /* ignored, hand the buffer back for the next SDU */
+        os_mbuf_free_chain(event->receive.sdu_rx);
+        sdu_rx = os_msys_get_pkthdr(BLETEMP_COC_MTU, 0);
+        if (sdu_rx != NULL) {
+            ble_l2cap_recv_ready(event->receive.chan, sdu_rx);
+        }
+        return 0;
+
+    case BLE_L2CAP_EVENT_COC_DISCONNECTED:
+        s = bletemp_coc_find(event->disconnect.chan);
+        if (s != NULL) {
+            s->chan = NULL;
+        }
+        return 0;
+
+    default:
+        return 0;
+    }
+}
+
+int
+bletemp_coc_init(void)
+{
+    return ble_l2cap_create_server(BLETEMP_COC_PSM, BLETEMP_COC_MTU,
+                                   bletemp_coc_event, NULL);
+}
+
+void
+bletemp_coc_resume(void)
+{
+    int i;
+
+    for (i = 0; i < MYNEWT_VAL(BLE_L2CAP_COC_MAX_NUM); i++) {
+        if (streams[i].chan != NULL) {
+            bletemp_coc_pump(&streams[i]);
+        }
+    }
+}
+
+#else
+
+int
+bletemp_coc_init(void)
+{
+    return 0;
+}
+
+void
+bletemp_coc_resume(void)
+{
+}
+
+#endif
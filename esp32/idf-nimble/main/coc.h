@@ -0,0 +1,39 @@
+#ifndef H_BLETEMP_COC_
+#define H_BLETEMP_COC_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Bulk history download over an LE credit based L2CAP channel. A central
+ * connects to BLETEMP_COC_PSM and receives the stored samples as a stream
+ * of SDUs, each a temp_codec batch like a history notification. An SDU
+ * with count 0 ends the dump; the central closes the channel.
+ *
+ * The samples come from the flash log when there is one, so the dump
+ * reaches back past the RAM history and across reboots, and from the RAM
+ * history otherwise. Either way they are stamped in ms since this boot
+ * like notifications; samples from earlier boots come out negative when
+ * the timestamp is read as an int32, by the time logged since, not
+ * counting the time the device was off.
+ */
+
+/* Dynamic LE PSM, also readable from the CoC PSM characteristic */
+#define BLETEMP_COC_PSM 0x0081
+
+/* Largest SDU in either direction */
+#define BLETEMP_COC_MTU 512
+
+int bletemp_coc_init(void);
+
+/* Resumes dumps that ran out of mbufs; called from the host task */
+void bletemp_coc_resume(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
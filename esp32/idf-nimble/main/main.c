@@ -10,13 +10,17 @@
 #include "console/console.h"
 #include "services/gap/ble_svc_gap.h"
 #include "service.h"
+#include "coc.h"
+#include "periodic.h"
+#include "bletemp_pm.h"
+#include "temp_sampler.h"
+#include "temp_log.h"
+#include "temp_convert_cycles.h"
 
 static const char *device_name = "Thermometer";
 
-static xTimerHandle timer_handle;
-static const int timer_period = pdMS_TO_TICKS(5000);
+static struct ble_npl_event tx_ev;
 
-static bool notify_state;
 static const char *tag = "BLE";
 
 static int bletemp_gap_event(struct ble_gap_event *event, void *arg);
@@ -45,24 +49,54 @@ print_addr(const void *addr)
 }
 
 
+#if MYNEWT_VAL(BLE_EXT_ADV)
 /*
- * Enables advertising with parameters:
- *     o General discoverable mode
- *     o Undirected connectable mode
+ * With extended advertising the legacy calls are unavailable; the
+ * connectable advertising runs on its own set with legacy PDUs so every
+ * central still finds it, next to the periodic train of periodic.h.
  */
-static void
-bletemp_advertise(void)
+#define BLETEMP_ADV_INSTANCE 0
+
+static int
+bletemp_ext_adv_set(const struct ble_hs_adv_fields *fields, bool rsp)
 {
-    struct ble_gap_adv_params adv_params;
-    struct ble_hs_adv_fields fields;
+    struct os_mbuf *om;
     int rc;
 
-    /*
-     *  Set the advertisement data included in our advertisements:
-     *     o Flags (indicates advertisement type and other general info)
-     *     o Advertising tx power
-     *     o Device name
-     */
+    om = os_msys_get_pkthdr(BLE_HS_ADV_MAX_SZ, 0);
+    if (om == NULL) {
+        return BLE_HS_ENOMEM;
+    }
+    rc = ble_hs_adv_set_fields_mbuf(fields, om);
+    if (rc != 0) {
+        os_mbuf_free_chain(om);
+        return rc;
+    }
+    if (rsp) {
+        return ble_gap_ext_adv_rsp_set_data(BLETEMP_ADV_INSTANCE, om); //frees om
+    }
+    return ble_gap_ext_adv_set_data(BLETEMP_ADV_INSTANCE, om); //frees om
+}
+#endif
+
+/*
+ * Sets the advertisement data:
+ *     o Flags (indicates advertisement type and other general info)
+ *     o Service UUID
+ *     o The latest reading as Environmental Sensing service data, for
+ *       scanners that never connect
+ * The tx power and device name go in the scan response, as the reading
+ * would not fit in 31 bytes with them.
+ */
+static int
+bletemp_adv_set_data(void)
+{
+    struct ble_hs_adv_fields fields;
+    adv_svc_data svc_data;
+    uint16_t itvl_min, itvl_max;
+
+    bletemp_adv_get(&svc_data, &itvl_min, &itvl_max);
+
     memset(&fields, 0, sizeof(fields));
 
     /*
@@ -73,90 +107,245 @@ bletemp_advertise(void)
     fields.flags = BLE_HS_ADV_F_DISC_GEN |
                    BLE_HS_ADV_F_BREDR_UNSUP;
 
-    /*
-     * Indicate that the TX power level field should be included; have the
-     * stack fill this value automatically.  This is done by assigning the
-     * special value BLE_HS_ADV_TX_PWR_LVL_AUTO.
-     */
-    fields.tx_pwr_lvl_is_present = 1;
-    fields.tx_pwr_lvl = BLE_HS_ADV_TX_PWR_LVL_AUTO;
-
     fields.uuids128 = (ble_uuid128_t[]) {
         BLE_UUID128_INIT(0x03,0x00,0x13,0xAC,0x42,0x02,0xCD,0x8D,0xEB,0x11,0x3E,0x8E,0x56,0xF6,0x41,0x99)
     };
     fields.num_uuids128 = 1;
     fields.uuids128_is_complete = 1;
 
-    rc = ble_gap_adv_set_fields(&fields);
+    /* UUID first, little endian like the rest */
+    fields.svc_data_uuid16 = (const uint8_t *)&svc_data;
+    fields.svc_data_uuid16_len = sizeof(svc_data);
+
+#if MYNEWT_VAL(BLE_EXT_ADV)
+    return bletemp_ext_adv_set(&fields, false);
+#else
+    return ble_gap_adv_set_fields(&fields);
+#endif
+}
+
+/*
+ * Enables advertising with parameters:
+ *     o General discoverable mode
+ *     o Undirected connectable mode
+ *     o Interval from bletemp_adv_get(), fast while the reading moves
+ */
+static void
+bletemp_advertise(void)
+{
+#if MYNEWT_VAL(BLE_EXT_ADV)
+    struct ble_gap_ext_adv_params adv_params;
+#else
+    struct ble_gap_adv_params adv_params;
+#endif
+    struct ble_hs_adv_fields fields;
+    adv_svc_data svc_data;
+    uint16_t itvl_min, itvl_max;
+    int rc;
+
+    /* Keep advertising only while a connection slot is free */
+#if MYNEWT_VAL(BLE_EXT_ADV)
+    if (ble_gap_ext_adv_active(BLETEMP_ADV_INSTANCE) ||
+        bletemp_conn_count() >= BLETEMP_MAX_CONN) {
+        return;
+    }
+#else
+    if (ble_gap_adv_active() || bletemp_conn_count() >= BLETEMP_MAX_CONN) {
+        return;
+    }
+#endif
+
+    bletemp_adv_get(&svc_data, &itvl_min, &itvl_max);
+
+#if MYNEWT_VAL(BLE_EXT_ADV)
+    memset(&adv_params, 0, sizeof(adv_params));
+    adv_params.connectable = 1;
+    adv_params.scannable = 1;
+    adv_params.legacy_pdu = 1;
+    adv_params.own_addr_type = bletemp_addr_type;
+    adv_params.primary_phy = BLE_HCI_LE_PHY_1M;
+    adv_params.secondary_phy = BLE_HCI_LE_PHY_1M;
+    adv_params.itvl_min = itvl_min;
+    adv_params.itvl_max = itvl_max;
+    adv_params.sid = BLETEMP_ADV_INSTANCE;
+    rc = ble_gap_ext_adv_configure(BLETEMP_ADV_INSTANCE, &adv_params, NULL,
+                                   bletemp_gap_event, NULL);
+    if (rc != 0) {
+        MODLOG_DFLT(ERROR, "error configuring advertisement; rc=%d\n", rc);
+        return;
+    }
+#endif
+    rc = bletemp_adv_set_data();
     if (rc != 0) {
         MODLOG_DFLT(ERROR, "error setting advertisement data; rc=%d\n", rc);
         return;
     }
 
+    memset(&fields, 0, sizeof(fields));
     fields.name = (uint8_t *)device_name;
     fields.name_len = strlen(device_name);
     fields.name_is_complete = 1;
-    fields.uuids128 = 0;
-    fields.num_uuids128 = 0;
-    fields.uuids128_is_complete = 0;
 
+    /*
+     * Indicate that the TX power level field should be included; have the
+     * stack fill this value automatically.  This is done by assigning the
+     * special value BLE_HS_ADV_TX_PWR_LVL_AUTO.
+     */
+    fields.tx_pwr_lvl_is_present = 1;
+    fields.tx_pwr_lvl = BLE_HS_ADV_TX_PWR_LVL_AUTO;
+
+#if MYNEWT_VAL(BLE_EXT_ADV)
+    rc = bletemp_ext_adv_set(&fields, true);
+#else
     rc = ble_gap_adv_rsp_set_fields(&fields);
+#endif
     if (rc != 0) {
         MODLOG_DFLT(ERROR, "error setting advertisement rsp data; rc=%d\n", rc);
         return;
     }
 
     /* Begin advertising */
+#if MYNEWT_VAL(BLE_EXT_ADV)
+    rc = ble_gap_ext_adv_start(BLETEMP_ADV_INSTANCE, 0, 0);
+#else
     memset(&adv_params, 0, sizeof(adv_params));
     adv_params.conn_mode = BLE_GAP_CONN_MODE_UND;
     adv_params.disc_mode = BLE_GAP_DISC_MODE_GEN;
+    adv_params.itvl_min = itvl_min;
+    adv_params.itvl_max = itvl_max;
     rc = ble_gap_adv_start(bletemp_addr_type, NULL, BLE_HS_FOREVER,
                            &adv_params, bletemp_gap_event, NULL);
+#endif
     if (rc != 0) {
         MODLOG_DFLT(ERROR, "error enabling advertisement; rc=%d\n", rc);
         return;
     }
 }
 
+/*
+ * Puts the latest reading in the advertising data, which the controller
+ * takes while advertising, and restarts advertising when the interval
+ * moves to another tier, as parameters only change while stopped
+ */
 static void
-bletemp_tx_temp_stop(void)
+bletemp_adv_refresh(void)
 {
-    xTimerStop( timer_handle, timer_period);
+    int changed;
+    int rc;
+
+    changed = bletemp_adv_update(bletemp_port_time_ms());
+#if MYNEWT_VAL(BLE_EXT_ADV)
+    if (!ble_gap_ext_adv_active(BLETEMP_ADV_INSTANCE)) {
+        return;
+    }
+    if (changed & BLETEMP_ADV_ITVL) {
+        ble_gap_ext_adv_stop(BLETEMP_ADV_INSTANCE);
+        bletemp_advertise();
+        return;
+    }
+#else
+    if (!ble_gap_adv_active()) {
+        /* picked up when advertising starts again */
+        return;
+    }
+    if (changed & BLETEMP_ADV_ITVL) {
+        ble_gap_adv_stop();
+        bletemp_advertise();
+        return;
+    }
+#endif
+    if (changed & BLETEMP_ADV_DATA) {
+        rc = bletemp_adv_set_data();
+        if (rc != 0) {
+            MODLOG_DFLT(ERROR, "error refreshing advertisement data; rc=%d\n", rc);
+        }
+    }
 }
 
+/* Runs in the host task once the sampler has published a new sample */
 static void
-bletemp_tx_temp_reset(void)
+bletemp_tx_temp(struct ble_npl_event *ev)
 {
-    int rc;
+    bletemp_pm_acquire();
+    /* refused notifications are counted and retried by the transport */
+    bletemp_publish();
 
-    if (xTimerReset(timer_handle, timer_period) == pdPASS) {
-        rc = 0;
-    } else {
-        rc = 1;
-    }
-    assert(rc == 0);
+    /* history dumps that ran out of mbufs pick up again */
+    bletemp_coc_resume();
+
+    /* and the scanners that do not connect see the sample */
+    bletemp_adv_refresh();
+    bletemp_periodic_update();
+    bletemp_pm_release();
 }
 
+/* Called from the sampling task; hands the send over to the host task */
 static void
-bletemp_tx_temp(xTimerHandle ev)
+bletemp_sample_ready(void)
 {
-    int rc;
+    ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &tx_ev);
+}
+
+static void
+bletemp_notify_stats(void)
+{
+    struct gatt_svr_notify_stats stats;
 
-    if (!notify_state) {
-        bletemp_tx_temp_stop();
+    gatt_svr_notify_stats(&stats);
+    MODLOG_DFLT(INFO, "notifications sent=%lu refused=%lu pool empty temp=%lu "
+                "hist=%lu\n", (unsigned long)stats.sent, (unsigned long)stats.refused,
+                (unsigned long)stats.temp_exhausted, (unsigned long)stats.hist_exhausted);
+}
+
+/* Hands the parameters the link runs with to the core */
+static void
+bletemp_conn_params(uint16_t conn_handle)
+{
+    struct ble_gap_conn_desc desc;
+
+    if (ble_gap_conn_find(conn_handle, &desc) != 0) {
         return;
     }
+    MODLOG_DFLT(INFO, "conn params; conn_handle=%d itvl=%d latency=%d "
+                "supervision_timeout=%d\n", conn_handle, desc.conn_itvl,
+                desc.conn_latency, desc.supervision_timeout);
+    bletemp_on_conn_params(conn_handle, desc.conn_itvl, desc.conn_latency,
+                           desc.supervision_timeout);
+}
 
-    rc = send_temp_update();
-  
-    assert(rc == 0);
+/*
+ * Asks for 251 byte LL payloads and, where the controller has it, the 2M
+ * PHY, so an MTU-sized history batch goes out in a few PDUs instead of
+ * twenty 27 byte fragments. The central may decline either.
+ */
+static void
+bletemp_link_setup(uint16_t conn_handle)
+{
+    int rc;
 
-    bletemp_tx_temp_reset();
+    rc = ble_gap_set_data_len(conn_handle, BLETEMP_LL_OCTETS_MAX,
+                              BLETEMP_LL_TIME_MAX);
+    if (rc != 0) {
+        MODLOG_DFLT(ERROR, "data length request failed; rc=%d\n", rc);
+    }
+
+#if MYNEWT_VAL(BLE_LL_CFG_FEAT_LE_2M_PHY)
+    rc = ble_gap_set_prefered_le_phy(conn_handle, BLE_GAP_LE_PHY_2M_MASK,
+                                     BLE_GAP_LE_PHY_2M_MASK,
+                                     BLE_GAP_LE_PHY_CODED_ANY);
+    if (rc != 0) {
+        MODLOG_DFLT(ERROR, "2M PHY request failed; rc=%d\n", rc);
+    }
+#endif
 }
 
 static int
 bletemp_gap_event(struct ble_gap_event *event, void *arg)
 {
+    uint16_t cfg;
+    int chr;
+    int rc;
+
     switch (event->type) {
     case BLE_GAP_EVENT_CONNECT:
         /* A new connection was established or a connection attempt failed */
@@ -164,44 +353,93 @@ bletemp_gap_event(struct ble_gap_event *event, void *arg)
                     event->connect.status == 0 ? "established" : "failed",
                     event->connect.status);
 
-        if (event->connect.status != 0) {
-            /* Connection failed; resume advertising */
-            bletemp_advertise();
+        if (event->connect.status == 0) {
+            bletemp_on_connect(event->connect.conn_handle);
+            bletemp_conn_params(event->connect.conn_handle);
+            bletemp_link_setup(event->connect.conn_handle);
         }
-        conn_handle = event->connect.conn_handle;
+        /* Connection failed or slots remain; resume advertising */
+        bletemp_advertise();
         break;
 
     case BLE_GAP_EVENT_DISCONNECT:
         MODLOG_DFLT(INFO, "disconnect; reason=%d\n", event->disconnect.reason);
 
+        bletemp_on_disconnect(event->disconnect.conn.conn_handle);
+        bletemp_notify_stats();
+
         /* Connection terminated; resume advertising */
         bletemp_advertise();
         break;
 
+    case BLE_GAP_EVENT_CONN_UPDATE:
+        /* The central accepted, rejected or replaced our parameters */
+        MODLOG_DFLT(INFO, "connection updated; status=%d\n",
+                    event->conn_update.status);
+        bletemp_conn_params(event->conn_update.conn_handle);
+        break;
+
     case BLE_GAP_EVENT_ADV_COMPLETE:
         MODLOG_DFLT(INFO, "adv complete\n");
         bletemp_advertise();
         break;
 
     case BLE_GAP_EVENT_SUBSCRIBE:
-        MODLOG_DFLT(INFO, "subscribe event; cur_notify=%d\n value handle; "
-                    "val_handle=%d\n",
-                    event->subscribe.cur_notify, tmp_temperature_handle);
-        if (event->subscribe.attr_handle == tmp_temperature_handle) {
-            notify_state = event->subscribe.cur_notify;
-            send_temp_update();
-            bletemp_tx_temp_reset();
-        } else if (event->subscribe.attr_handle != tmp_temperature_handle) {
-            notify_state = event->subscribe.cur_notify;
-            bletemp_tx_temp_stop();
+        MODLOG_DFLT(INFO, "subscribe event; conn_handle=%d cur_notify=%d "
+                    "cur_indicate=%d\n value handle; val_handle=%d\n",
+                    event->subscribe.conn_handle, event->subscribe.cur_notify,
+                    event->subscribe.cur_indicate, event->subscribe.attr_handle);
+        cfg = (event->subscribe.cur_notify ? BLETEMP_SUB_NOTIFY : 0) |
+              (event->subscribe.cur_indicate ? BLETEMP_SUB_INDICATE : 0);
+        chr = gatt_svr_chr_from_handle(event->subscribe.attr_handle);
+        if (chr >= 0) {
+            bletemp_on_subscribe(event->subscribe.conn_handle, chr, cfg);
+        }
+        ESP_LOGI("BLE_GAP_SUBSCRIBE_EVENT", "subscribers=%d", bletemp_subscriber_count());
+        break;
+
+    case BLE_GAP_EVENT_NOTIFY_TX:
+        /* 0 only means an indication went out, EDONE that it was confirmed */
+        if (!event->notify_tx.indication || event->notify_tx.status == 0) {
+            break;
+        }
+        rc = (event->notify_tx.status == BLE_HS_EDONE) ? 0 : event->notify_tx.status;
+        if (rc != 0) {
+            MODLOG_DFLT(INFO, "indication failed; conn_handle=%d status=%d\n",
+                        event->notify_tx.conn_handle, event->notify_tx.status);
+        }
+        chr = gatt_svr_chr_from_handle(event->notify_tx.attr_handle);
+        if (chr >= 0) {
+            bletemp_on_confirm(event->notify_tx.conn_handle, chr, rc);
         }
-        ESP_LOGI("BLE_GAP_SUBSCRIBE_EVENT", "conn_handle from subscribe=%d", conn_handle);
         break;
 
+    case BLE_GAP_EVENT_PHY_UPDATE_COMPLETE:
+        MODLOG_DFLT(INFO, "phy update; status=%d tx_phy=%d rx_phy=%d\n",
+                    event->phy_updated.status, event->phy_updated.tx_phy,
+                    event->phy_updated.rx_phy);
+        if (event->phy_updated.status == 0) {
+            bletemp_on_phy(event->phy_updated.conn_handle,
+                           event->phy_updated.tx_phy, event->phy_updated.rx_phy);
+        }
+        break;
+
+#ifdef BLE_GAP_EVENT_DATA_LEN_CHG
+    case BLE_GAP_EVENT_DATA_LEN_CHG:
+        MODLOG_DFLT(INFO, "data length change; tx_octets=%d rx_octets=%d\n",
+                    event->data_len_chg.max_tx_octets,
+                    event->data_len_chg.max_rx_octets);
+        bletemp_on_data_len(event->data_len_chg.conn_handle,
+                            event->data_len_chg.max_tx_octets,
+                            event->data_len_chg.max_rx_octets);
+        break;
+#endif
+
     case BLE_GAP_EVENT_MTU:
         MODLOG_DFLT(INFO, "mtu update event; conn_handle=%d mtu=%d\n",
                     event->mtu.conn_handle,
                     event->mtu.value);
+        bletemp_on_mtu(event->mtu.conn_handle, event->mtu.value);
         break;
 
     }
@@ -226,6 +464,9 @@ bletemp_on_sync(void)
 
     /* Begin advertising */
     bletemp_advertise();
+
+    /* Connectionless readings, alongside the connectable advertising */
+    bletemp_periodic_start(bletemp_addr_type);
 }
 
 static void
@@ -255,15 +496,19 @@ void app_main(void)
     }
     ESP_ERROR_CHECK(ret);
 
+    /* no-op unless CONFIG_BLETEMP_POWER_SAVE is set */
+    bletemp_pm_init();
+
     ESP_ERROR_CHECK(esp_nimble_hci_and_controller_init());
 
     nimble_port_init();
     /* Initialize the NimBLE host configuration */
     ble_hs_cfg.sync_cb = bletemp_on_sync;
     ble_hs_cfg.reset_cb = bletemp_on_reset;
+    /* fills the handle map gatt_svr_chr_from_handle() reads */
+    ble_hs_cfg.gatts_register_cb = gatt_svr_register_cb;
 
-    /* name, period/time,  auto reload, timer ID, callback */
-    timer_handle = xTimerCreate("periodic_task", timer_period, pdTRUE, (void *)0, bletemp_tx_temp);
+    ble_npl_event_init(&tx_ev, bletemp_tx_temp, NULL);
 
     rc = gatt_svr_init();
     assert(rc == 0);
@@ -275,4 +520,16 @@ void app_main(void)
     /* Start the task */
     nimble_port_freertos_init(bletemp_host_task);
 
+    /* Keep every sample on flash as well, also while no central is connected */
+    if (temp_log_init(temp_log_partition("templog")) != 0) {
+        ESP_LOGW(tag, "sample log disabled");
+    }
+
+    /* Sampling runs in its own task, independent of BLE activity */
+    rc = temp_sampler_start(bletemp_interval(), bletemp_sample_ready);
+    assert(rc == 0);
+
+    /* no-op unless CONFIG_BLETEMP_CONVERT_CYCLES is set */
+    temp_convert_cycles_log();
+
 }
@@ -0,0 +1,182 @@
+#include <string.h>
+#include "esp_log.h"
+#include "host/ble_hs.h"
+#include "bletemp.h"
+#include "temp_codec.h"
+#include "periodic.h"
+
+#if MYNEWT_VAL(BLE_PERIODIC_ADV)
+
+/* Service data AD type with a 128-bit UUID */
+#define AD_TYPE_SVC_DATA128 0x21
+
+/*
+ * Largest batch of the latest samples, small enough for the whole field to
+ * go out in one AUX_SYNC_IND without chaining
+ */
+#define PERIODIC_BATCH_MAX  96
+
+/* Length and type, the service UUID and the sequence number ahead of the batch */
+#define PERIODIC_HDR_LEN    (2 + 16 + sizeof(uint32_t))
+
+static const ble_uuid128_t periodic_svc_uuid =
+    BLE_UUID128_INIT(0x03,0x00,0x13,0xAC,0x42,0x02,0xCD,0x8D,0xEB,0x11,0x3E,0x8E,0x56,0xF6,0x41,0x99);
+
+static const char *periodic_name = "Thermometer";
+
+static bool periodic_started;
+
+/* Extended advertising data: the service UUID and name, so scanners know what to sync to */
+static int
+bletemp_periodic_set_adv_data(void)
+{
+    struct ble_hs_adv_fields fields;
+    struct os_mbuf *om;
+    int rc;
+
+    memset(&fields, 0, sizeof(fields));
+    fields.uuids128 = &periodic_svc_uuid;
+    fields.num_uuids128 = 1;
+    fields.uuids128_is_complete = 1;
+    fields.name = (const uint8_t *)periodic_name;
+    fields.name_len = strlen(periodic_name);
+    fields.name_is_complete = 1;
+
+    om = os_msys_get_pkthdr(BLE_HS_ADV_MAX_SZ, 0);
+    if (om == NULL) {
+        return BLE_HS_ENOMEM;
+    }
+    rc = ble_hs_adv_set_fields_mbuf(&fields, om);
+    if (rc != 0) {
+        os_mbuf_free_chain(om);
+        return rc;
+    }
+    return ble_gap_ext_adv_set_data(BLETEMP_PERIODIC_INSTANCE, om); //frees om
+}
+
+int
+bletemp_periodic_start(uint8_t own_addr_type)
+{
+    struct ble_gap_ext_adv_params params;
+    struct ble_gap_periodic_adv_params pparams;
+    int rc;
+
+    if (periodic_started) {
+        return 0;
+    }
+
+    /* Periodic advertising needs a set that is neither connectable nor scannable */
+    memset(&params, 0, sizeof(params));
+    params.own_addr_type = own_addr_type;
+    params.primary_phy = BLE_HCI_LE_PHY_1M;
+    params.secondary_phy = BLE_HCI_LE_PHY_1M;
+    params.sid = BLETEMP_PERIODIC_INSTANCE;
+    /* scanners only need the sync info once, 0.625 ms units */
+    params.itvl_min = BLETEMP_PERIODIC_ITVL_MS * 8 / 5;
+    params.itvl_max = BLETEMP_PERIODIC_ITVL_MS * 8 / 5;
+
+    rc = ble_gap_ext_adv_configure(BLETEMP_PERIODIC_INSTANCE, &params, NULL, NULL, NULL);
+    if (rc != 0) {
+        MODLOG_DFLT(ERROR, "periodic adv set configure failed; rc=%d\n", rc);
+        return rc;
+    }
+    rc = bletemp_periodic_set_adv_data();
+    if (rc != 0) {
+        MODLOG_DFLT(ERROR, "periodic adv set data failed; rc=%d\n", rc);
+        return rc;
+    }
+
+    /* 1.25 ms units */
+    memset(&pparams, 0, sizeof(pparams));
+    pparams.itvl_min = BLETEMP_PERIODIC_ITVL_MS * 4 / 5;
+    pparams.itvl_max = BLETEMP_PERIODIC_ITVL_MS * 4 / 5;
+    rc = ble_gap_periodic_adv_configure(BLETEMP_PERIODIC_INSTANCE, &pparams);
+    if (rc != 0) {
+        MODLOG_DFLT(ERROR, "periodic adv configure failed; rc=%d\n", rc);
+        return rc;
+    }
+
+    /* the train needs data before it starts, even without a sample yet */
+    periodic_started = true;
+    bletemp_periodic_update();
+
+    rc = ble_gap_periodic_adv_start(BLETEMP_PERIODIC_INSTANCE);
+    if (rc == 0) {
+        rc = ble_gap_ext_adv_start(BLETEMP_PERIODIC_INSTANCE, 0, 0);
+    }
+    if (rc != 0) {
+        MODLOG_DFLT(ERROR, "periodic adv start failed; rc=%d\n", rc);
+        periodic_started = false;
+        return rc;
+    }
+    ESP_LOGI("BLE", "periodic adv started; itvl=%d ms", BLETEMP_PERIODIC_ITVL_MS);
+    return 0;
+}
+
+void
+bletemp_periodic_update(void)
+{
+    static uint8_t buf[PERIODIC_HDR_LEN + PERIODIC_BATCH_MAX];
+    struct temp_codec_enc enc;
+    uint32_t head, start, cursor;
+    struct os_mbuf *om;
+    uint16_t len = 0;
+    int rc;
+
+    if (!periodic_started) {
+        return;
+    }
+
+    /* the latest samples, dropping the oldest until the newest fits */
+    head = temp_history_head();
+    start = head - temp_history_pending(head >= BLETEMP_PERIODIC_SAMPLES ?
+                                        head - BLETEMP_PERIODIC_SAMPLES : 0);
+    for (; start < head; start++) {
+        cursor = start;
+        len = temp_history_encode(&cursor, bletemp_unit(), &buf[PERIODIC_HDR_LEN], PERIODIC_BATCH_MAX);
+        if (cursor == head) {
+            break;
+        }
+    }
+    if (start == head) {
+        /* nothing sampled yet, an empty batch */
+        temp_codec_begin(&enc, bletemp_unit(), &buf[PERIODIC_HDR_LEN], PERIODIC_BATCH_MAX);
+        len = temp_codec_end(&enc);
+    }
+
+    buf[0] = PERIODIC_HDR_LEN - 1 + len;
+    buf[1] = AD_TYPE_SVC_DATA128;
+    memcpy(&buf[2], periodic_svc_uuid.value, 16);
+    buf[18] = start & 0xFF;
+    buf[19] = (start >> 8) & 0xFF;
+    buf[20] = (start >> 16) & 0xFF;
+    buf[21] = start >> 24;
+
+    om = os_msys_get_pkthdr(1 + buf[0], 0);
+    if (om == NULL) {
+        return;
+    }
+    if (os_mbuf_append(om, buf, 1 + buf[0]) != 0) {
+        os_mbuf_free_chain(om);
+        return;
+    }
+    rc = ble_gap_periodic_adv_set_data(BLETEMP_PERIODIC_INSTANCE, om); //frees om
+    if (rc != 0) {
+        MODLOG_DFLT(ERROR, "periodic adv data update failed; rc=%d\n", rc);
+    }
+}
+
+#else
+
+int
+bletemp_periodic_start(uint8_t own_addr_type)
+{
+    return 0;
+}
+
+void
+bletemp_periodic_update(void)
+{
+}
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef H_BLETEMP_PERIODIC_
+#define H_BLETEMP_PERIODIC_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Connectionless readings for gateways. A non-connectable extended
+ * advertising set points scanners at a periodic advertising train whose
+ * data is one service data field (AD type 0x21) of the thermometer
+ * service UUID:
+ *
+ *   uint32_t seq       sequence number of the first sample, little endian
+ *   temp_codec batch   the latest samples in the active unit
+ *
+ * Sample i of the batch has sequence number seq + i, so a scanner that
+ * synced once drops repeats and sees gaps without ever connecting. The
+ * connectable advertising of the configuration service runs alongside on
+ * its own set.
+ */
+
+/* Advertising set of the train, set 0 is the connectable one */
+#define BLETEMP_PERIODIC_INSTANCE   1
+
+/* Period of the train, each sample is repeated until the next one */
+#define BLETEMP_PERIODIC_ITVL_MS    1000
+
+/* Samples carried in the train */
+#define BLETEMP_PERIODIC_SAMPLES    8
+
+/* Starts the train; called once the host is in sync */
+int bletemp_periodic_start(uint8_t own_addr_type);
+
+/* Puts the latest samples in the train; called from the host task */
+void bletemp_periodic_update(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -20,92 +20,64 @@
 #include <assert.h>
 #include <stdio.h>
 #include <string.h>
+#include "nimble/hci_common.h"
 #include "host/ble_hs.h"
 #include "host/ble_uuid.h"
+#include "nimble/nimble_port.h"
 #include "services/gap/ble_svc_gap.h"
 #include "services/gatt/ble_svc_gatt.h"
 #include "service.h"
-#include "freertos/semphr.h"
+#include "coc.h"
 
-uint16_t tmp_temperature_handle;
-uint16_t conn_handle;
+uint16_t gatt_svr_val_handles[BLETEMP_CHR_COUNT];
 
-SemaphoreHandle_t xSemaphore = NULL; 
+/* Value handle to core characteristic, filled by gatt_svr_register_cb() */
+static uint8_t gatt_svr_map_slot[BLETEMP_GATT_MAP_MAX];
+static struct bletemp_gatt_map gatt_svr_map;
 
 /* Service UUID */
 static const ble_uuid128_t gatt_svr_svc_sec_test_uuid =
     BLE_UUID128_INIT(0x03,0x00,0x13,0xAC,0x42,0x02,0xCD,0x8D,0xEB,0x11,0x3E,0x8E,0x56,0xF6,0x41,0x99); 
 
-/* Unit Characteristic UUID */
-static const ble_uuid128_t gatt_svr_char_unit_uuid =
-    BLE_UUID128_INIT(0x03,0x00,0x13,0xAC,0x42,0x02,0xCD,0x8D,0xEB,0x11,0x3E,0x8E,0x38,0xFB,0x41,0x99); 
-static const char *unit_descr = "Temperature unit"; 
-static const char temp_descr[7] = {0x0E, 0xFE, //signed 16-bit
-                                   0x2F, 0x27, //GATT Unit, temperature celsius 0x272F,  
-                                   //0xAC, 0x27, //GATT Unit,0x27AC thermodynamic temperature (degree Fahrenheit)
-                                   0x01, 0x00, 0x00};
+/* History Download PSM Characteristic UUID */
+static const ble_uuid128_t gatt_svr_char_coc_psm_uuid =
+    BLE_UUID128_INIT(0x03,0x00,0x13,0xAC,0x42,0x02,0xCD,0x8D,0xEB,0x11,0x3E,0x8E,0x5C,0xFE,0x41,0x99);
 
-
-/* Temperature Characteristic UUID */
-static const ble_uuid16_t gatt_svr_char_temp_uuid = 
-    BLE_UUID16_INIT(0x2A6E); 
-
-
-temp_struct temp_char_value    = {0, 'C'};
-unit_struct unit_char_value    = {'C'};
+static const ble_uuid16_t gatt_svr_dsc_desc_uuid = BLE_UUID16_INIT(0x2901);
+static const ble_uuid16_t gatt_svr_dsc_fmt_uuid = BLE_UUID16_INIT(0x2904);
+static const ble_uuid16_t gatt_svr_dsc_range_uuid = BLE_UUID16_INIT(0x2906);
 
 
 static int
-ble_gatts_descriptor_access(uint16_t conn_handle,
-                                     uint16_t attr_handle,
-                                     struct ble_gatt_access_ctxt *ctxt,
-                                     void *arg);
-
+gatt_svr_dsc_access(uint16_t conn_handle, uint16_t attr_handle,
+                    struct ble_gatt_access_ctxt *ctxt, void *arg);
 
 static int
 gatt_svr_chr_access(uint16_t conn_handle, uint16_t attr_handle,
                                 struct ble_gatt_access_ctxt *ctxt, void *arg);
 
-static void get_temp(void);
+static int
+gatt_svr_coc_psm_access(uint16_t conn_handle, uint16_t attr_handle,
+                        struct ble_gatt_access_ctxt *ctxt, void *arg);
 
-static const struct ble_gatt_svc_def gatt_svr_svcs[] = {
+/*
+ * The service is generated from the description in bletemp_gatt.h by
+ * gatt_svr_build(): one characteristic per core characteristic, with the
+ * user description, presentation format and valid range it lists (NimBLE
+ * adds the CCCD itself), then the L2CAP PSM, which only this build serves.
+ * Each definition carries its enum bletemp_chr in arg, so an access goes
+ * straight to the core without matching UUIDs.
+ */
+static ble_uuid_any_t gatt_svr_chr_uuids[BLETEMP_CHR_COUNT];
+static struct ble_gatt_dsc_def gatt_svr_dscs[BLETEMP_CHR_COUNT][4];
+static struct ble_gatt_chr_def gatt_svr_chrs[BLETEMP_CHR_COUNT + 2];
+
+static struct ble_gatt_svc_def gatt_svr_svcs[] = {
     {
         /* Service: Thermometer */
         .type = BLE_GATT_SVC_TYPE_PRIMARY,
         .uuid =  &gatt_svr_svc_sec_test_uuid.u, 
-        .characteristics = (struct ble_gatt_chr_def[])
-        { {
-                /* Characteristic: Temperature measurement */
-                .uuid = &gatt_svr_char_temp_uuid.u, 
-                .access_cb = gatt_svr_chr_access,
-                .val_handle = &tmp_temperature_handle,
-                .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_NOTIFY,
-                .descriptors = (struct ble_gatt_dsc_def[]) { {
-                    .uuid = BLE_UUID16_DECLARE(0x2904), //Characteristic User Descriptor
-                    .att_flags = BLE_ATT_F_READ,
-                    .access_cb = ble_gatts_descriptor_access,
-                    }, 
-                    {
-                    0 /* no more descriptors */
-                    } 
-                }, 
-            }, {
-                /* Characteristic: Temperature Unit */
-                .uuid = &gatt_svr_char_unit_uuid.u,
-                .access_cb = gatt_svr_chr_access,
-                .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE,
-                .descriptors = (struct ble_gatt_dsc_def[]) { {
-                    .uuid = BLE_UUID16_DECLARE(0x2901), //Characteristic User Descriptor
-                    .att_flags = BLE_ATT_F_READ, // | BLE_ATT_F_WRITE,
-                    .access_cb = ble_gatts_descriptor_access,
-                    }, {
-                    0 /* no more descriptors */
-                    } 
-                }, 
-            }, {
-                0, /* No more characteristics in this service */
-            },
-        }
+        .characteristics = gatt_svr_chrs,
     },
 
 
@@ -114,6 +86,75 @@ static const struct ble_gatt_svc_def gatt_svr_svcs[] = {
     },
 };
 
+static void
+gatt_svr_build(void)
+{
+    const struct bletemp_gatt_chr *def;
+    struct ble_gatt_chr_def *chr_def;
+    struct ble_gatt_dsc_def *dsc;
+    int chr;
+
+    for (chr = 0; chr < BLETEMP_CHR_COUNT; chr++) {
+        def = &bletemp_gatt_chrs[chr];
+        chr_def = &gatt_svr_chrs[chr];
+
+        if (def->uuid > 0xFFFF) {
+            gatt_svr_chr_uuids[chr].u128.u.type = BLE_UUID_TYPE_128;
+            bletemp_gatt_uuid128(def->uuid, gatt_svr_chr_uuids[chr].u128.value);
+        } else {
+            gatt_svr_chr_uuids[chr].u16.u.type = BLE_UUID_TYPE_16;
+            gatt_svr_chr_uuids[chr].u16.value = def->uuid;
+        }
+        chr_def->uuid = &gatt_svr_chr_uuids[chr].u;
+        chr_def->access_cb = gatt_svr_chr_access;
+        chr_def->arg = (void *)(uintptr_t)chr;
+        chr_def->val_handle = &gatt_svr_val_handles[chr];
+
+        chr_def->flags = 0;
+        if (def->flags & BLETEMP_GATT_F_READ) {
+            chr_def->flags |= BLE_GATT_CHR_F_READ;
+        }
+        if (def->flags & BLETEMP_GATT_F_WRITE) {
+            chr_def->flags |= BLE_GATT_CHR_F_WRITE;
+        }
+        if (def->flags & BLETEMP_GATT_F_NOTIFY) {
+            chr_def->flags |= BLE_GATT_CHR_F_NOTIFY;
+        }
+        if (def->flags & BLETEMP_GATT_F_INDICATE) {
+            chr_def->flags |= BLE_GATT_CHR_F_INDICATE;
+        }
+
+        /* the descriptors read from the same row, zero terminated */
+        dsc = gatt_svr_dscs[chr];
+        if (def->desc != NULL) {
+            dsc->uuid = &gatt_svr_dsc_desc_uuid.u;
+            dsc++;
+        }
+        if (def->fmt != NULL) {
+            dsc->uuid = &gatt_svr_dsc_fmt_uuid.u;
+            dsc++;
+        }
+        if (def->range != NULL) {
+            dsc->uuid = &gatt_svr_dsc_range_uuid.u;
+            dsc++;
+        }
+        for (dsc = gatt_svr_dscs[chr]; dsc->uuid != NULL; dsc++) {
+            dsc->att_flags = BLE_ATT_F_READ;
+            dsc->access_cb = gatt_svr_dsc_access;
+            dsc->arg = (void *)def;
+        }
+        chr_def->descriptors = gatt_svr_dscs[chr][0].uuid != NULL ? gatt_svr_dscs[chr] : NULL;
+    }
+
+    /* Characteristic: L2CAP PSM of the bulk history download */
+    chr_def = &gatt_svr_chrs[BLETEMP_CHR_COUNT];
+    chr_def->uuid = &gatt_svr_char_coc_psm_uuid.u;
+    chr_def->access_cb = gatt_svr_coc_psm_access;
+    chr_def->flags = BLE_GATT_CHR_F_READ;
+
+    /* gatt_svr_chrs[BLETEMP_CHR_COUNT + 1] stays zero: no more characteristics */
+}
+
 static int
 gatt_svr_chr_write(struct os_mbuf *om, uint16_t min_len, uint16_t max_len,
                    void *dst, uint16_t *len)
@@ -139,118 +180,258 @@ static int
 gatt_svr_chr_access(uint16_t conn_handle, uint16_t attr_handle,
                                 struct ble_gatt_access_ctxt *ctxt, void *arg)
 {
-    const ble_uuid_t *uuid;
-    unit_struct tmpdata;
+    uint8_t buf[TEMP_HISTORY_MAX_PAYLOAD];
+    enum bletemp_chr chr;
+    uint16_t len;
     int rc;
 
-    uuid = ctxt->chr->uuid; 
+    /* set by gatt_svr_build() */
+    chr = (enum bletemp_chr)(uintptr_t)arg;
 
-    /* Determine which characteristic is being accessed by examining its
-     * 128-bit UUID.
-     */
-    if (ble_uuid_cmp(uuid, &gatt_svr_char_unit_uuid.u) == 0) {
+    switch (ctxt->op) {
+    case BLE_GATT_ACCESS_OP_READ_CHR:
+        rc = bletemp_read(conn_handle, chr, buf, sizeof buf, &len);
+        if (rc != 0) {
+            return rc;
+        }
+        rc = os_mbuf_append(ctxt->om, buf, len);
+        return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+
+    case BLE_GATT_ACCESS_OP_WRITE_CHR:
+        rc = gatt_svr_chr_write(ctxt->om, 0, sizeof buf, buf, &len);
+        if (rc != 0) {
+            return rc;
+        }
+        return bletemp_write(conn_handle, chr, buf, len);
+
+    default:
+        assert(0);
+        return BLE_ATT_ERR_UNLIKELY;
+    }
+}
 
-        switch (ctxt->op) {
-        case BLE_GATT_ACCESS_OP_READ_CHR:
-            rc = os_mbuf_append(ctxt->om, &unit_char_value, sizeof unit_char_value);
-            return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+/* Read-only descriptors, arg is the characteristic's row in bletemp_gatt_chrs */
+static int
+gatt_svr_dsc_access(uint16_t conn_handle, uint16_t attr_handle,
+                    struct ble_gatt_access_ctxt *ctxt, void *arg)
+{
+    const struct bletemp_gatt_chr *def = arg;
+    uint8_t fmt[BLETEMP_GATT_FMT_LEN];
+    int rc;
 
-        case BLE_GATT_ACCESS_OP_WRITE_CHR:
+    if (ctxt->op != BLE_GATT_ACCESS_OP_READ_DSC) {
+        return BLE_ATT_ERR_UNLIKELY;
+    }
 
-            rc = gatt_svr_chr_write(ctxt->om,
-                                    sizeof unit_char_value,
-                                    sizeof unit_char_value,
-                                    &tmpdata, NULL);
+    switch (ble_uuid_u16(ctxt->dsc->uuid)) {
+    case 0x2901:
+        rc = os_mbuf_append(ctxt->om, def->desc, strlen(def->desc));
+        break;
+    case 0x2904:
+        bletemp_gatt_fmt(def, bletemp_unit(), fmt);
+        rc = os_mbuf_append(ctxt->om, fmt, sizeof(fmt));
+        break;
+    case 0x2906:
+        rc = os_mbuf_append(ctxt->om, def->range->data, def->range->len);
+        break;
+    default:
+        return BLE_ATT_ERR_UNLIKELY;
+    }
+    return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+}
 
-            if (unit_char_value.unit != tmpdata.unit) {
-                //unit changed
-                unit_char_value.unit = tmpdata.unit;
-                send_temp_update();
-            }
+/* Only the NimBLE build serves the L2CAP download, so the PSM is not a core characteristic */
+static int
+gatt_svr_coc_psm_access(uint16_t conn_handle, uint16_t attr_handle,
+                        struct ble_gatt_access_ctxt *ctxt, void *arg)
+{
+    static const uint8_t psm[2] = {BLETEMP_COC_PSM & 0xFF, BLETEMP_COC_PSM >> 8};
+    int rc;
 
-            return rc;
+    if (ctxt->op != BLE_GATT_ACCESS_OP_READ_CHR) {
+        return BLE_ATT_ERR_UNLIKELY;
+    }
+    rc = os_mbuf_append(ctxt->om, psm, sizeof(psm));
+    return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+}
 
-        default:
-            assert(0);
-            return BLE_ATT_ERR_UNLIKELY;
-        }
+/*
+ * Notifications are built in pools of their own instead of msys, so a burst
+ * of history batches can neither take the buffers the host needs to
+ * receive nor starve the temperature notifications. Each block holds a
+ * whole notification, with room in front for the ATT, L2CAP and HCI
+ * headers, so the value is copied once and never chained or pulled up.
+ * A refused notification is not queued: the core coalesces it, and a
+ * retry shortly after hands it the blocks the controller has released.
+ * Indications come from the same pools.
+ */
+#define NOTIFY_LEADING      (BLE_HCI_DATA_HDR_SZ + BLE_L2CAP_HDR_SZ + 3)
+#define NOTIFY_BLOCK(len)   (sizeof(struct os_mbuf) + sizeof(struct os_mbuf_pkthdr) + \
+                             NOTIFY_LEADING + (len))
 
+/*
+ * In flight: three temperature notifications per connection, which is all
+ * a 7.5 ms connection event fits at 1M, and two history batches
+ */
+#define TEMP_NOTIFY_NUM     (3 * BLETEMP_MAX_CONN)
+#define TEMP_NOTIFY_BLOCK   NOTIFY_BLOCK(sizeof(temp_struct))
+#define HIST_NOTIFY_NUM     (2 * BLETEMP_MAX_CONN)
+#define HIST_NOTIFY_BLOCK   NOTIFY_BLOCK(TEMP_HISTORY_MAX_PAYLOAD)
+
+/* Wait before a retry, about a connection event */
+#define NOTIFY_RETRY_MS     30
+
+struct notify_pool {
+    struct os_mempool mempool;
+    struct os_mbuf_pool mbuf_pool;
+    uint16_t block_len;     /* payload a block holds */
+};
 
-    } else if (ble_uuid_cmp(uuid, &gatt_svr_char_temp_uuid.u) == 0) {
+static os_membuf_t temp_notify_mem[OS_MEMPOOL_SIZE(TEMP_NOTIFY_NUM, TEMP_NOTIFY_BLOCK)];
+static os_membuf_t hist_notify_mem[OS_MEMPOOL_SIZE(HIST_NOTIFY_NUM, HIST_NOTIFY_BLOCK)];
+static struct notify_pool temp_notify_pool;
+static struct notify_pool hist_notify_pool;
 
-        ESP_LOGI("BLE","Read temp");
+static struct gatt_svr_notify_stats notify_stats;
+static struct ble_npl_callout notify_retry;
 
-        assert(ctxt->op == BLE_GATT_ACCESS_OP_READ_CHR);
-        get_temp();
+static int
+notify_pool_init(struct notify_pool *pool, os_membuf_t *mem, uint16_t num,
+                 uint16_t block_size, const char *name)
+{
+    int rc;
 
-        rc = os_mbuf_append(ctxt->om, &temp_char_value, sizeof temp_char_value);
-        return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+    rc = os_mempool_init(&pool->mempool, num, block_size, mem, name);
+    if (rc != 0) {
+        return rc;
     }
+    pool->block_len = block_size - NOTIFY_BLOCK(0);
+    return os_mbuf_pool_init(&pool->mbuf_pool, &pool->mempool, block_size, num);
+}
 
-    assert(0);
-    return BLE_ATT_ERR_UNLIKELY;
+/* A notification holding data, NULL when the pool is empty */
+static struct os_mbuf *
+notify_pool_get(struct notify_pool *pool, const uint8_t *data, uint16_t len)
+{
+    struct os_mbuf *om;
+
+    if (len > pool->block_len) {
+        return NULL;
+    }
+    om = os_mbuf_get_pkthdr(&pool->mbuf_pool, 0);
+    if (om == NULL) {
+        return NULL;
+    }
+    om->om_data += NOTIFY_LEADING;
+    if (os_mbuf_append(om, data, len) != 0) {
+        os_mbuf_free_chain(om);
+        return NULL;
+    }
+    return om;
 }
 
 static int
-ble_gatts_descriptor_access(uint16_t conn_handle,
-                                     uint16_t attr_handle,
-                                     struct ble_gatt_access_ctxt *ctxt,
-                                     void *arg)
+gatt_svr_send(uint16_t conn_handle, enum bletemp_chr chr,
+              const uint8_t *data, uint16_t len, bool indicate)
 {
+    struct os_mbuf *om;
     int rc;
-    uint16_t uuid;
-    uuid = ble_uuid_u16(ctxt->chr->uuid);
-     
 
-    if (ctxt->op != BLE_GATT_ACCESS_OP_READ_DSC) {
-        ESP_LOGE("BLE", "Invalid operation on Read-only Descriptor");
-        return BLE_ATT_ERR_UNLIKELY;
+    if (chr == BLETEMP_CHR_TEMP) {
+        om = notify_pool_get(&temp_notify_pool, data, len);
+        if (om == NULL) {
+            notify_stats.temp_exhausted++;
+        }
+    } else {
+        om = notify_pool_get(&hist_notify_pool, data, len);
+        if (om == NULL) {
+            notify_stats.hist_exhausted++;
+        }
+    }
+    if (om == NULL) {
+        rc = BLE_HS_ENOMEM;
+        goto refused;
     }
 
-    //ESP_LOGI("BLE", "ble_gatts_descriptor_access OP:%d", ctxt->op);
+    if (indicate) {
+        rc = ble_gattc_indicate_custom(conn_handle, gatt_svr_val_handles[chr], om); //frees om
+    } else {
+        rc = ble_gattc_notify_custom(conn_handle, gatt_svr_val_handles[chr], om); //frees om
+    }
+    if (rc == BLE_HS_ENOTCONN) {
+        /* peer went away while the core was publishing */
+        return 0;
+    }
+    if (rc == 0) {
+        notify_stats.sent++;
+        return 0;
+    }
+    notify_stats.refused++;
 
-    if (uuid == 0x2901) {
-        rc = os_mbuf_append(ctxt->om, unit_descr, strlen(unit_descr));
-        return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
-    } else if (uuid == 0x2904) {
-        rc = os_mbuf_append(ctxt->om, temp_descr, sizeof(temp_descr));
-        return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+refused:
+    if (!ble_npl_callout_is_active(&notify_retry)) {
+        ble_npl_callout_reset(&notify_retry, ble_npl_time_ms_to_ticks32(NOTIFY_RETRY_MS));
     }
+    return rc;
+}
 
-    return BLE_ATT_ERR_UNLIKELY;
+/* Core transport: puts a notification on air */
+static int
+gatt_svr_notify(uint16_t conn_handle, enum bletemp_chr chr,
+                const uint8_t *data, uint16_t len)
+{
+    return gatt_svr_send(conn_handle, chr, data, len, false);
 }
 
-static void get_temp(void) {
-    if( xSemaphoreTake( xSemaphore, ( TickType_t ) 100 ) == pdTRUE )
-    {
+/* Core transport: puts an indication on air, BLE_GAP_EVENT_NOTIFY_TX reports the confirmation */
+static int
+gatt_svr_indicate(uint16_t conn_handle, enum bletemp_chr chr,
+                  const uint8_t *data, uint16_t len)
+{
+    return gatt_svr_send(conn_handle, chr, data, len, true);
+}
 
-        uint8_t unit = unit_char_value.unit;
-        temp_char_value.unit = unit;
-        //temp_char_value.temperature = temprature_sens_read()*10;
-        temp_char_value.temperature = esp_random() % 10000;
-        if (unit == 'F') {
-            temp_char_value.temperature = (temp_char_value.temperature * 1.8) + 32;
-        }
+/* Runs in the host task; anything refused again re-arms the retry */
+static void
+gatt_svr_notify_retry(struct ble_npl_event *ev)
+{
+    bletemp_resume();
+}
 
-        xSemaphoreGive( xSemaphore );
-    }
+void
+gatt_svr_notify_stats(struct gatt_svr_notify_stats *stats)
+{
+    *stats = notify_stats;
 }
 
-int send_temp_update(void) {
-    struct os_mbuf *om;
+/* Core transport: asks the central for the parameters the policy picked */
+static int
+gatt_svr_update_params(uint16_t conn_handle,
+                       const struct bletemp_conn_params *params)
+{
+    struct ble_gap_upd_params upd = {
+        .itvl_min = params->itvl_min,
+        .itvl_max = params->itvl_max,
+        .latency = params->latency,
+        .supervision_timeout = params->timeout,
+        .min_ce_len = 0,
+        .max_ce_len = 0,
+    };
     int rc;
 
-    get_temp();
-    if( xSemaphoreTake( xSemaphore, ( TickType_t ) 100 /* blocks at most 100 ticks */ ) == pdTRUE ) //portMAX_DELAY 
-    {
-        om = ble_hs_mbuf_from_flat((void *)&temp_char_value, sizeof(temp_char_value));
-        xSemaphoreGive( xSemaphore );
-        rc = ble_gattc_notify_custom(conn_handle, tmp_temperature_handle, om); //frees om
-    } else {
-        return 0;
+    rc = ble_gap_update_params(conn_handle, &upd);
+    if (rc != 0) {
+        MODLOG_DFLT(ERROR, "conn param update failed; conn_handle=%d rc=%d\n",
+                    conn_handle, rc);
     }
     return rc;
-} 
+}
+
+static const struct bletemp_transport gatt_svr_transport = {
+    .notify = gatt_svr_notify,
+    .indicate = gatt_svr_indicate,
+    .update_params = gatt_svr_update_params,
+};
 
 
 void
@@ -263,6 +444,11 @@ gatt_svr_register_cb(struct ble_gatt_register_ctxt *ctxt, void *arg)
         ESP_LOGI("BLE", "registered service %s with handle=%d\n",
                     ble_uuid_to_str(ctxt->svc.svc_def->uuid, buf),
                     ctxt->svc.handle);
+        if (ctxt->svc.svc_def == &gatt_svr_svcs[0]) {
+            /* its characteristics follow */
+            bletemp_gatt_map_init(&gatt_svr_map, ctxt->svc.handle, gatt_svr_map_slot,
+                                  sizeof(gatt_svr_map_slot));
+        }
         break;
 
     case BLE_GATT_REGISTER_OP_CHR:
@@ -271,6 +457,10 @@ gatt_svr_register_cb(struct ble_gatt_register_ctxt *ctxt, void *arg)
                     ble_uuid_to_str(ctxt->chr.chr_def->uuid, buf),
                     ctxt->chr.def_handle,
                     ctxt->chr.val_handle);
+        if (ctxt->chr.chr_def->access_cb == gatt_svr_chr_access) {
+            bletemp_gatt_map_add(&gatt_svr_map, ctxt->chr.val_handle,
+                                 (uintptr_t)ctxt->chr.chr_def->arg);
+        }
         break;
 
     case BLE_GATT_REGISTER_OP_DSC:
@@ -285,16 +475,41 @@ gatt_svr_register_cb(struct ble_gatt_register_ctxt *ctxt, void *arg)
     }
 }
 
+int
+gatt_svr_chr_from_handle(uint16_t attr_handle)
+{
+    return bletemp_gatt_map_get(&gatt_svr_map, attr_handle);
+}
+
 int
 gatt_svr_init(void)
 {
     int rc;
 
-    xSemaphore = xSemaphoreCreateMutex(); 
+    rc = notify_pool_init(&temp_notify_pool, temp_notify_mem, TEMP_NOTIFY_NUM,
+                          TEMP_NOTIFY_BLOCK, "temp_notify");
+    if (rc != 0) {
+        return rc;
+    }
+    rc = notify_pool_init(&hist_notify_pool, hist_notify_mem, HIST_NOTIFY_NUM,
+                          HIST_NOTIFY_BLOCK, "hist_notify");
+    if (rc != 0) {
+        return rc;
+    }
+
+    ble_npl_callout_init(&notify_retry, nimble_port_get_dflt_eventq(),
+                         gatt_svr_notify_retry, NULL);
+
+    rc = bletemp_init(&gatt_svr_transport);
+    if (rc != 0) {
+        return rc;
+    }
 
     ble_svc_gap_init();
     ble_svc_gatt_init();
 
+    gatt_svr_build();
+
     rc = ble_gatts_count_cfg(gatt_svr_svcs);
     if (rc != 0) {
         return rc;
@@ -305,6 +520,10 @@ gatt_svr_init(void)
         return rc;
     }
 
+    rc = bletemp_coc_init();
+    if (rc != 0) {
+        return rc;
+    }
+
     return 0;
 }
-
@@ -2,34 +2,31 @@
 #define H_BLETEMP_SENSOR_
 
 #include "nimble/ble.h"
+#include "bletemp.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-extern uint16_t tmp_temperature_handle;
-extern uint16_t conn_handle;
-
-/* Data */
-typedef struct {
-    uint16_t temperature;
-    uint8_t unit;
-} __attribute__ ((packed)) temp_struct;
-
-typedef struct {
-    uint8_t unit;
-} __attribute__ ((packed)) unit_struct;
-
-extern temp_struct temp_char_value;
-extern unit_struct unit_char_value; 
+/* Value handle of each core characteristic, valid once registered */
+extern uint16_t gatt_svr_val_handles[BLETEMP_CHR_COUNT];
 
 struct ble_hs_cfg;
 struct ble_gatt_register_ctxt;
 
+/* Notification counters since boot */
+struct gatt_svr_notify_stats {
+    uint32_t sent;
+    uint32_t temp_exhausted;    /* temperature notification pool was empty */
+    uint32_t hist_exhausted;    /* history notification pool was empty */
+    uint32_t refused;           /* the host would not queue it */
+};
+
 void gatt_svr_register_cb(struct ble_gatt_register_ctxt *ctxt, void *arg);
 int gatt_svr_init(void);
-
-int send_temp_update(void);
+/* Core characteristic whose value has attr_handle, -1 if none */
+int gatt_svr_chr_from_handle(uint16_t attr_handle);
+void gatt_svr_notify_stats(struct gatt_svr_notify_stats *stats);
 
 #ifdef __cplusplus
 }
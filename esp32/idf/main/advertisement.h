@@ -1,42 +1,50 @@
 #define ESP_BLE_APPEARANCE_GENERIC_SENSOR 1344
 
-/* The length of adv data must be less than 31 bytes */
+/* Latest reading, refreshed after every sample (see bletemp_adv.h) */
+static adv_svc_data adv_svc_value = {BLETEMP_ADV_SVC_UUID, 0, 'C', 0};
+
+/*
+ * The length of adv data must be less than 31 bytes: flags (3), tx power
+ * (3), appearance (4) and the reading (8) leave the 128-bit service UUID
+ * to the scan response, which passive scanners never see
+ */
 static esp_ble_adv_data_t adv_data = {
     .set_scan_rsp        = false,
     .include_name        = false,
     .include_txpower     = true,
-    .min_interval        = 0x0006, //slave connection min interval, Time = min_interval * 1.25 msec
-    .max_interval        = 0x0010, //slave connection max interval, Time = max_interval * 1.25 msec
+    .min_interval        = 0, //slave connection interval range left out for room
+    .max_interval        = 0,
     .appearance          = ESP_BLE_APPEARANCE_GENERIC_THERMOMETER,
     .manufacturer_len    = 0,    //TEST_MANUFACTURER_DATA_LEN,
     .p_manufacturer_data = NULL, //test_manufacturer,
-    .service_data_len    = 0,
-    .p_service_data      = NULL,
-    .service_uuid_len    = sizeof(GATTS_SERVICE_UUID),
-    .p_service_uuid      = (uint8_t *)&GATTS_SERVICE_UUID,
+    .service_data_len    = sizeof(adv_svc_value),
+    .p_service_data      = (uint8_t *)&adv_svc_value,
+    .service_uuid_len    = 0,
+    .p_service_uuid      = NULL,
     .flag = (ESP_BLE_ADV_FLAG_GEN_DISC | ESP_BLE_ADV_FLAG_BREDR_NOT_SPT),
 };
 
-// scan response data
+// scan response data: name (13) and service UUID (18)
 static esp_ble_adv_data_t scan_rsp_data = {
     .set_scan_rsp        = true,
     .include_name        = true,
-    .include_txpower     = true,
-    .min_interval        = 0x0006,
-    .max_interval        = 0x0010,
-    .appearance          = ESP_BLE_APPEARANCE_GENERIC_THERMOMETER,
+    .include_txpower     = false,
+    .min_interval        = 0,
+    .max_interval        = 0,
+    .appearance          = 0,
     .manufacturer_len    = 0, //TEST_MANUFACTURER_DATA_LEN,
     .p_manufacturer_data = NULL, //&test_manufacturer[0],
     .service_data_len    = 0,
     .p_service_data      = NULL,
-    .service_uuid_len    = 0, //sizeof(GATTS_SERVICE_UUID),
-    .p_service_uuid      = 0, //(uint8_t *)&GATTS_SERVICE_UUID,
+    .service_uuid_len    = sizeof(GATTS_SERVICE_UUID),
+    .p_service_uuid      = (uint8_t *)&GATTS_SERVICE_UUID,
     .flag = (ESP_BLE_ADV_FLAG_GEN_DISC | ESP_BLE_ADV_FLAG_BREDR_NOT_SPT),
 };
 
+/* The interval follows bletemp_adv_get(), fast from boot */
 static esp_ble_adv_params_t adv_params = {
     .adv_int_min         = 0x20,
-    .adv_int_max         = 0x40,
+    .adv_int_max         = 0x30,
     .adv_type            = ADV_TYPE_IND,
     .own_addr_type       = BLE_ADDR_TYPE_PUBLIC,
     .channel_map         = ADV_CHNL_ALL,
@@ -48,20 +56,29 @@ static esp_ble_adv_params_t adv_params = {
 #define SCAN_RSP_CONFIG_FLAG        (1 << 1)
 static uint8_t adv_config_done       = 0;
 
+/* Advertising was stopped to take a new interval and starts again once stopped */
+static bool adv_restart              = false;
+
 
 static void gap_event_handler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param)
 {
     switch (event) {
+        /* only the initial configuration starts advertising, refreshes of
+           the reading go out with whatever advertising is running */
         case ESP_GAP_BLE_ADV_DATA_SET_COMPLETE_EVT:
-            adv_config_done &= (~ADV_CONFIG_FLAG);
-            if (adv_config_done == 0){
-                esp_ble_gap_start_advertising(&adv_params);
+            if (adv_config_done & ADV_CONFIG_FLAG){
+                adv_config_done &= (~ADV_CONFIG_FLAG);
+                if (adv_config_done == 0 && bletemp_conn_count() < BLETEMP_MAX_CONN){
+                    esp_ble_gap_start_advertising(&adv_params);
+                }
             }
             break;
         case ESP_GAP_BLE_SCAN_RSP_DATA_SET_COMPLETE_EVT:
-            adv_config_done &= (~SCAN_RSP_CONFIG_FLAG);
-            if (adv_config_done == 0){
-                esp_ble_gap_start_advertising(&adv_params);
+            if (adv_config_done & SCAN_RSP_CONFIG_FLAG){
+                adv_config_done &= (~SCAN_RSP_CONFIG_FLAG);
+                if (adv_config_done == 0 && bletemp_conn_count() < BLETEMP_MAX_CONN){
+                    esp_ble_gap_start_advertising(&adv_params);
+                }
             }
             break;
         case ESP_GAP_BLE_ADV_START_COMPLETE_EVT:
@@ -79,6 +96,14 @@ static void gap_event_handler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param
             else {
                 ESP_LOGI(GATTS_TABLE_TAG, "Stop adv successfully\n");
             }
+            /* stopped to take a new interval, unless a connection took the last slot meanwhile */
+            if (adv_restart) {
+                adv_restart = false;
+                if (param->adv_stop_cmpl.status == ESP_BT_STATUS_SUCCESS &&
+                    bletemp_conn_count() < BLETEMP_MAX_CONN) {
+                    esp_ble_gap_start_advertising(&adv_params);
+                }
+            }
             break;
         case ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT:
             ESP_LOGI(GATTS_TABLE_TAG, "update connection params status = %d, min_int = %d, max_int = %d,conn_int = %d,latency = %d, timeout = %d",
@@ -88,7 +113,43 @@ static void gap_event_handler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param
                   param->update_conn_params.conn_int,
                   param->update_conn_params.latency,
                   param->update_conn_params.timeout);
+            if (param->update_conn_params.status == ESP_BT_STATUS_SUCCESS) {
+                int conn_id = peer_conn_id(param->update_conn_params.bda);
+                if (conn_id >= 0) {
+                    bletemp_on_conn_params(conn_id, param->update_conn_params.conn_int,
+                                           param->update_conn_params.latency,
+                                           param->update_conn_params.timeout);
+                }
+            }
+            break;
+        case ESP_GAP_BLE_SET_PKT_LENGTH_COMPLETE_EVT: {
+            int conn_id = peer_data_len_done();
+
+            ESP_LOGI(GATTS_TABLE_TAG, "conn_id %d data length status = %d, rx_len = %d, tx_len = %d",
+                  conn_id,
+                  param->pkt_data_lenth_cmpl.status,
+                  param->pkt_data_lenth_cmpl.params.rx_len,
+                  param->pkt_data_lenth_cmpl.params.tx_len);
+            if (param->pkt_data_lenth_cmpl.status == ESP_BT_STATUS_SUCCESS && conn_id >= 0) {
+                bletemp_on_data_len(conn_id, param->pkt_data_lenth_cmpl.params.tx_len,
+                                    param->pkt_data_lenth_cmpl.params.rx_len);
+            }
+            break;
+        }
+#if CONFIG_BT_BLE_50_FEATURES_SUPPORTED
+        case ESP_GAP_BLE_PHY_UPDATE_COMPLETE_EVT:
+            ESP_LOGI(GATTS_TABLE_TAG, "phy update status = %d, tx_phy = %d, rx_phy = %d",
+                  param->phy_update.status,
+                  param->phy_update.tx_phy,
+                  param->phy_update.rx_phy);
+            if (param->phy_update.status == ESP_BT_STATUS_SUCCESS) {
+                int conn_id = peer_conn_id(param->phy_update.bda);
+                if (conn_id >= 0) {
+                    bletemp_on_phy(conn_id, param->phy_update.tx_phy, param->phy_update.rx_phy);
+                }
+            }
             break;
+#endif
         default:
             break;
     }
@@ -10,6 +10,7 @@
 #include "freertos/semphr.h"
 #include "freertos/event_groups.h"
 #include "esp_system.h"
+#include "esp_heap_caps.h"
 #include "esp_log.h"
 #include "nvs_flash.h"
 #include "esp_bt.h"
@@ -19,6 +20,13 @@
 #include "esp_bt_main.h"
 #include "esp_gatt_common_api.h"
 
+#include "bletemp.h"
+#include "bletemp_load.h"
+#include "temp_convert_cycles.h"
+#include "bletemp_pm.h"
+#include "temp_sampler.h"
+#include "temp_log.h"
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>  
@@ -31,7 +39,6 @@
 #define SVC_INST_ID                 0
 
 TaskHandle_t xHandle = NULL;
-SemaphoreHandle_t xSemaphore = NULL;
 
 struct gatts_profile_inst {
     esp_gatts_cb_t gatts_cb;
@@ -59,71 +66,355 @@ static struct gatts_profile_inst thermometer_profile_tab[PROFILE_NUM] = {
     },
 };
 
+/*
+ * Per connection state of the transport: the peer address, as parameter
+ * updates are keyed by it, and the outbound queue. While the stack reports
+ * the link congested, temperature notifications wait in a single slot that
+ * always holds the latest value, and history batches are refused so the
+ * core keeps them; both go out once the link drains. Indications take
+ * the same path and are matched to their ESP_GATTS_CONF_EVT by handle.
+ * Guarded by the port lock, as notifications come from the publishing
+ * task and the BTC task.
+ */
+static struct {
+    bool used;
+    esp_bd_addr_t bda;
+    bool congested;
+    bool temp_pending;      /* temp waits for the link to drain */
+    bool temp_confirm;      /* and goes out as an indication */
+    bool refused;           /* something was refused, resume the core when possible */
+    temp_struct temp;
+    uint16_t confirm_handle;    /* indication awaiting confirmation, 0 if none */
+    uint32_t data_len_req;      /* order of the data length request in flight, 0 if none */
+    uint32_t sent;
+    uint32_t coalesced;     /* pending temperature replaced by a newer one */
+    uint32_t dropped;       /* refused by the stack or failed on air */
+} peers[BLETEMP_MAX_CONN];
+
+static void peer_add(uint16_t conn_id, const esp_bd_addr_t bda) {
+    if (conn_id < BLETEMP_MAX_CONN) {
+        bletemp_port_lock();
+        memset(&peers[conn_id], 0, sizeof(peers[conn_id]));
+        peers[conn_id].used = true;
+        memcpy(peers[conn_id].bda, bda, sizeof(esp_bd_addr_t));
+        bletemp_port_unlock();
+    }
+}
+
+static void peer_remove(uint16_t conn_id) {
+    if (conn_id < BLETEMP_MAX_CONN) {
+        ESP_LOGI(GATTS_TABLE_TAG, "conn_id %d notifications sent %u coalesced %u dropped %u", conn_id,
+                 (unsigned)peers[conn_id].sent, (unsigned)peers[conn_id].coalesced,
+                 (unsigned)peers[conn_id].dropped);
+        bletemp_port_lock();
+        peers[conn_id].used = false;
+        bletemp_port_unlock();
+    }
+}
+
+/* Maps a peer address to its conn_id, -1 if not connected */
+static int peer_conn_id(const esp_bd_addr_t bda) {
+    for (int i = 0; i < BLETEMP_MAX_CONN; i++) {
+        if (peers[i].used && memcmp(peers[i].bda, bda, sizeof(esp_bd_addr_t)) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Data length requests made so far, to order those in flight */
+static uint32_t data_len_reqs;
+
+/*
+ * Takes the connection whose data length request completed, -1 if none.
+ * The completion event carries no address; the controller answers the
+ * requests in the order they were made, so it is the oldest in flight.
+ */
+static int peer_data_len_done(void) {
+    int conn_id = -1;
+
+    bletemp_port_lock();
+    for (int i = 0; i < BLETEMP_MAX_CONN; i++) {
+        if (peers[i].used && peers[i].data_len_req != 0 &&
+            (conn_id < 0 || peers[i].data_len_req < peers[conn_id].data_len_req)) {
+            conn_id = i;
+        }
+    }
+    if (conn_id >= 0) {
+        peers[conn_id].data_len_req = 0;
+    }
+    bletemp_port_unlock();
+    return conn_id;
+}
+
 #include "service.h"
 #include "advertisement.h"
 
 
-extern uint8_t temprature_sens_read();
+/* Attribute handle to core characteristic, filled when the table is created */
+static uint8_t chr_map_slot[GATT_DB_MAX];
+static struct bletemp_gatt_map chr_map;
 
-static void get_temp(void) {
-    if( xSemaphoreTake( xSemaphore, ( TickType_t ) 10 ) == pdTRUE )
-    {
+static void chr_map_build(void) {
+    bletemp_gatt_map_init(&chr_map, thermometer_handle_table[IDX_SVC], chr_map_slot, gatt_db_len);
+    for (int chr = 0; chr < BLETEMP_CHR_COUNT; chr++) {
+        bletemp_gatt_map_add(&chr_map, thermometer_handle_table[chr_val_idx[chr]], chr);
+        if (chr_cfg_idx[chr] != 0) {
+            bletemp_gatt_map_add(&chr_map, thermometer_handle_table[chr_cfg_idx[chr]],
+                                 chr | BLETEMP_GATT_MAP_CFG);
+        }
+    }
+}
 
-        uint8_t unit = unit_char_value;
-        temp_char_value.unit = unit;
-        //temp_char_value.temperature = temprature_sens_read()*10;
-        temp_char_value.temperature = esp_random() % 10000;
-        if (unit == 'F') {
-            temp_char_value.temperature = (temp_char_value.temperature * 1.8) + 32;
+/* Maps the handle of a value, or of a CCCD when cfg is set, to the core characteristic, -1 if unknown */
+static int chr_from_handle(uint16_t handle, bool cfg) {
+    int entry = bletemp_gatt_map_get(&chr_map, handle);
+
+    if (entry < 0 || ((entry & BLETEMP_GATT_MAP_CFG) != 0) != cfg) {
+        return -1;
+    }
+    return entry & ~BLETEMP_GATT_MAP_CFG;
+}
+
+/* The stack answers presentation format reads itself, from the value set here */
+static void gatts_fmt_refresh(void) {
+    uint8_t fmt[BLETEMP_GATT_FMT_LEN];
+    esp_err_t ret;
+
+    for (int chr = 0; chr < BLETEMP_CHR_COUNT; chr++) {
+        if (chr_fmt_idx[chr] == 0) {
+            continue;
         }
+        bletemp_gatt_fmt(&bletemp_gatt_chrs[chr], bletemp_unit(), fmt);
+        ret = esp_ble_gatts_set_attr_value(thermometer_handle_table[chr_fmt_idx[chr]], sizeof(fmt), fmt);
+        if (ret){
+            ESP_LOGE(GATTS_TABLE_TAG, "set format failed, error code = %x", ret);
+        }
+    }
+}
+
+static esp_err_t gatts_send(uint16_t conn_id, enum bletemp_chr chr, const uint8_t *data, uint16_t len, bool confirm) {
+    uint16_t handle = thermometer_handle_table[chr_val_idx[chr]];
+    esp_err_t ret = esp_ble_gatts_send_indicate(thermometer_profile_tab[PROFILE_APP_IDX].gatts_if,
+         conn_id, handle, len, (uint8_t*)data, confirm);
 
-        xSemaphoreGive( xSemaphore );
+    if (ret){
+        ESP_LOGE(GATTS_TABLE_TAG, "Send indication, error code = %x", ret);
+        peers[conn_id].dropped++;
+        peers[conn_id].refused = true;
+    } else {
+        peers[conn_id].sent++;
+        if (confirm) {
+            peers[conn_id].confirm_handle = handle;
+        }
     }
+    return ret;
 }
 
-static void send_temp_update(void) {
-    get_temp();
-    if( xSemaphoreTake( xSemaphore, ( TickType_t ) 10 ) == pdTRUE )
-    {
+/* Puts a notification or indication on air, or queues it while the link is congested */
+static int gatts_queue(uint16_t conn_id, enum bletemp_chr chr, const uint8_t *data, uint16_t len, bool confirm) {
+    esp_err_t ret = ESP_OK;
 
-        esp_err_t ret = esp_ble_gatts_send_indicate(thermometer_profile_tab[PROFILE_APP_IDX].gatts_if, 
-             thermometer_profile_tab[PROFILE_APP_IDX].conn_id,
-             thermometer_handle_table[IDX_CHAR_TEMP_VAL],
-             sizeof(temp_char_value), (uint8_t*)&temp_char_value, false);
-        
-        xSemaphoreGive( xSemaphore );
+    if (conn_id >= BLETEMP_MAX_CONN || !peers[conn_id].used) {
+        return -1;
+    }
 
-        if (ret){
-            ESP_LOGE(GATTS_TABLE_TAG, "Send indication, error code = %x", ret);
+    bletemp_port_lock();
+    if (!peers[conn_id].congested) {
+        ret = gatts_send(conn_id, chr, data, len, confirm);
+    } else if (chr == BLETEMP_CHR_TEMP && len == sizeof(temp_struct)) {
+        /* only the latest reading is worth sending */
+        if (peers[conn_id].temp_pending) {
+            peers[conn_id].coalesced++;
         }
+        memcpy(&peers[conn_id].temp, data, len);
+        peers[conn_id].temp_pending = true;
+        peers[conn_id].temp_confirm = confirm;
+    } else {
+        /* the core keeps the history batch and resends it from the same cursor */
+        peers[conn_id].refused = true;
+        ret = ESP_ERR_INVALID_STATE;
+    }
+    bletemp_port_unlock();
+    return ret;
+}
+
+/* Core transport: puts a notification on air */
+static int gatts_notify(uint16_t conn_id, enum bletemp_chr chr, const uint8_t *data, uint16_t len) {
+    return gatts_queue(conn_id, chr, data, len, false);
+}
+
+/* Core transport: puts an indication on air, ESP_GATTS_CONF_EVT reports the confirmation */
+static int gatts_indicate(uint16_t conn_id, enum bletemp_chr chr, const uint8_t *data, uint16_t len) {
+    return gatts_queue(conn_id, chr, data, len, true);
+}
+
+/* Sends what waited for the link, called once it is no longer congested */
+static void gatts_flush(uint16_t conn_id) {
+    bool resume, indicated = false;
+    esp_err_t ret = ESP_OK;
+
+    if (conn_id >= BLETEMP_MAX_CONN) {
+        return;
+    }
+
+    bletemp_port_lock();
+    if (peers[conn_id].temp_pending && !peers[conn_id].congested) {
+        peers[conn_id].temp_pending = false;
+        indicated = peers[conn_id].temp_confirm;
+        ret = gatts_send(conn_id, BLETEMP_CHR_TEMP, (const uint8_t *)&peers[conn_id].temp,
+                         sizeof(peers[conn_id].temp), indicated);
+    }
+    resume = peers[conn_id].refused && !peers[conn_id].congested;
+    if (resume) {
+        peers[conn_id].refused = false;
+    }
+    bletemp_port_unlock();
+
+    /* the core took a queued indication as sent, tell it when it really was */
+    if (indicated) {
+        if (ret == ESP_OK) {
+            bletemp_on_indicate_sent(conn_id, BLETEMP_CHR_TEMP);
+        } else {
+            bletemp_on_confirm(conn_id, BLETEMP_CHR_TEMP, ret);
+        }
+    }
+    if (resume) {
+        bletemp_resume();
+    }
+}
+
+/* Core transport: asks the central for the parameters the policy picked */
+static int gatts_update_params(uint16_t conn_id, const struct bletemp_conn_params *params) {
+    esp_ble_conn_update_params_t conn_params = {0};
+    esp_err_t ret;
+
+    if (conn_id >= BLETEMP_MAX_CONN || !peers[conn_id].used) {
+        return -1;
+    }
+    memcpy(conn_params.bda, peers[conn_id].bda, sizeof(esp_bd_addr_t));
+    conn_params.min_int = params->itvl_min;
+    conn_params.max_int = params->itvl_max;
+    conn_params.latency = params->latency;
+    conn_params.timeout = params->timeout;
+    ret = esp_ble_gap_update_conn_params(&conn_params);
+    if (ret){
+        ESP_LOGE(GATTS_TABLE_TAG, "Update connection params, error code = %x", ret);
+    }
+    return ret;
+}
+
+/*
+ * Asks for 251 byte LL payloads and, on controllers with BLE 5 features,
+ * the 2M PHY, so an MTU-sized history batch goes out in a few PDUs
+ * instead of twenty 27 byte fragments. The central may decline either.
+ */
+static void gatts_link_setup(uint16_t conn_id, esp_bd_addr_t bda) {
+    esp_err_t ret;
+
+    ret = esp_ble_gap_set_pkt_data_len(bda, BLETEMP_LL_OCTETS_MAX);
+    if (ret){
+        ESP_LOGE(GATTS_TABLE_TAG, "Set data length, error code = %x", ret);
+    } else if (conn_id < BLETEMP_MAX_CONN) {
+        bletemp_port_lock();
+        peers[conn_id].data_len_req = ++data_len_reqs;
+        bletemp_port_unlock();
+    }
+
+#if CONFIG_BT_BLE_50_FEATURES_SUPPORTED
+    ret = esp_ble_gap_set_prefered_phy(bda, 0, ESP_BLE_GAP_PHY_2M_PREF_MASK,
+                                       ESP_BLE_GAP_PHY_2M_PREF_MASK, ESP_BLE_GAP_PHY_OPTIONS_NO_PREF);
+    if (ret){
+        ESP_LOGE(GATTS_TABLE_TAG, "Set preferred PHY, error code = %x", ret);
+    }
+#endif
+}
+
+static const struct bletemp_transport gatts_transport = {
+    .notify = gatts_notify,
+    .indicate = gatts_indicate,
+    .update_params = gatts_update_params,
+};
+
+/*
+ * Puts the latest reading in the advertising data, which the controller
+ * takes while advertising, and restarts advertising when the interval
+ * moves to another tier, as parameters only change while stopped
+ */
+static void gatts_adv_refresh(void) {
+    uint16_t itvl_min, itvl_max;
+    esp_err_t ret;
+    int changed;
 
+    changed = bletemp_adv_update(bletemp_port_time_ms());
+    if (changed == 0) {
+        return;
+    }
+    bletemp_adv_get(&adv_svc_value, &itvl_min, &itvl_max);
+
+    if (changed & BLETEMP_ADV_DATA) {
+        ret = esp_ble_gap_config_adv_data(&adv_data);
+        if (ret){
+            ESP_LOGE(GATTS_TABLE_TAG, "refresh adv data failed, error code = %x", ret);
+        }
+    }
+    if (changed & BLETEMP_ADV_ITVL) {
+        ESP_LOGI(GATTS_TABLE_TAG, "adv interval %d-%d", itvl_min, itvl_max);
+        adv_params.adv_int_min = itvl_min;
+        adv_params.adv_int_max = itvl_max;
+        /* while every slot is taken advertising is off and starts with these */
+        if (bletemp_conn_count() < BLETEMP_MAX_CONN && !adv_restart) {
+            adv_restart = true;
+            esp_ble_gap_stop_advertising();
+        }
     }
 }
 
-// Perform an action every 5 seconds.
+// Publish each new sample to the subscribed characteristics.
 void periodic_task( void * pvParameters )
 {
-    const TickType_t xPeriod =  5000 / portTICK_RATE_MS;
-    uint32_t ulNotifiedValue;
-
     for( ;; )
     {
-        xTaskNotifyWait(  0x00,      /* Don't clear any notification bits on entry. */
-                          0x00,      /* Don't clear any notification bits on exit. */ 
-                          &ulNotifiedValue, /* Notified value pass out in ulNotifiedValue. */
-                          xPeriod );  /* Block up to xPeriod ticks */
-        //ESP_LOGI(GATTS_TABLE_TAG, "notify flags: %d", ulNotifiedValue);
-        if (( ulNotifiedValue & 0x01 ) == 0 ) continue;
+        /* Woken by the sampling task once per period */
+        ulTaskNotifyTake( pdTRUE, portMAX_DELAY );
+        bletemp_pm_acquire();
 
-        // Perform action here.
-        ESP_LOGI(GATTS_TABLE_TAG, "send notification, conn:%d", thermometer_profile_tab[PROFILE_APP_IDX].conn_id);
-        send_temp_update();
+        if (bletemp_subscriber_count() > 0) {
+            ESP_LOGI(GATTS_TABLE_TAG, "send notification, subscribers:%d", bletemp_subscriber_count());
+        }
+        /* also runs without subscribers so the parameter policy sees idle links */
+        if (bletemp_conn_count() > 0) {
+            bletemp_publish();
+        }
+        /* and passive scanners read the sample from the advertising data */
+        gatts_adv_refresh();
+        bletemp_pm_release();
     }
 }
 
+static void on_sample(void) {
+    xTaskNotifyGive( xHandle );
+}
+
+/*
+ * Heap left for the application and the least free stack of our tasks,
+ * to size the stacks and to compare build profiles with
+ */
+static void gatts_mem_report(const char *when) {
+    ESP_LOGI(GATTS_TABLE_TAG, "mem %s: heap free %u min %u largest %u internal %u",
+             when, (unsigned)esp_get_free_heap_size(), (unsigned)esp_get_minimum_free_heap_size(),
+             (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_8BIT),
+             (unsigned)heap_caps_get_free_size(MALLOC_CAP_INTERNAL));
+    ESP_LOGI(GATTS_TABLE_TAG, "mem %s: stack free ble_task %u/%d sampler %u/%d", when,
+             (unsigned)uxTaskGetStackHighWaterMark(xHandle), CONFIG_BLETEMP_PUBLISH_STACK_SIZE,
+             (unsigned)temp_sampler_stack_free(), CONFIG_BLETEMP_SAMPLER_STACK_SIZE);
+}
+
 
 static void gatts_profile_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if, esp_ble_gatts_cb_param_t *param)
 {
+    int chr, status = ESP_GATT_OK;
+
     switch (event) {
         case ESP_GATTS_REG_EVT:{
             esp_err_t set_dev_name_ret = esp_ble_gap_set_device_name(DEVICE_NAME);
@@ -148,7 +439,8 @@ static void gatts_profile_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_
                 ESP_LOGE(GATTS_TABLE_TAG, "config scan response data failed, error code = %x", ret);
             }
             adv_config_done |= SCAN_RSP_CONFIG_FLAG;
-            esp_err_t create_attr_ret = esp_ble_gatts_create_attr_tab(gatt_db, gatts_if, IDX_SVC_END, SVC_INST_ID);
+            gatt_db_build();
+            esp_err_t create_attr_ret = esp_ble_gatts_create_attr_tab(gatt_db, gatts_if, gatt_db_len, SVC_INST_ID);
             if (create_attr_ret){
                 ESP_LOGE(GATTS_TABLE_TAG, "create attr table failed, error code = %x", create_attr_ret);
             }
@@ -156,26 +448,18 @@ static void gatts_profile_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_
        	    break;
         case ESP_GATTS_READ_EVT:
             ESP_LOGI(GATTS_TABLE_TAG, "ESP_GATTS_READ_EVT");
-            if (thermometer_handle_table[IDX_CHAR_TEMP_VAL] == param->read.handle) {
-                get_temp();
-                if (gatt_db[IDX_CHAR_TEMP_VAL].attr_control.auto_rsp == ESP_GATT_RSP_BY_APP) {
-                    //reponse by APP
-                    esp_gatt_rsp_t rsp;
-                    memset(&rsp, 0, sizeof(esp_gatt_rsp_t));
-                    rsp.attr_value.handle = param->read.handle;
-                    rsp.attr_value.len = sizeof(temp_char_value);
-                    memcpy(rsp.attr_value.value, (uint8_t*)&temp_char_value, sizeof(temp_char_value));
-
-                    esp_err_t ret = esp_ble_gatts_send_response(gatts_if, param->read.conn_id, param->read.trans_id, ESP_GATT_OK, &rsp);
-                    if (ret){
-                        ESP_LOGE(GATTS_TABLE_TAG, "set response failed, error code = %x", ret);
-                    }
-                } else {
-                    //autoresponse
-                    esp_err_t ret = esp_ble_gatts_set_attr_value(thermometer_handle_table[IDX_CHAR_TEMP_VAL],sizeof(temp_char_value),(uint8_t*)&temp_char_value);
-                    if (ret){
-                        ESP_LOGE(GATTS_TABLE_TAG, "set attr value failed, error code = %x", ret);
-                    }
+            chr = chr_from_handle(param->read.handle, false);
+            if (chr >= 0) {
+                //reponse by APP, descriptors are answered by the stack
+                esp_gatt_rsp_t rsp;
+                memset(&rsp, 0, sizeof(esp_gatt_rsp_t));
+                rsp.attr_value.handle = param->read.handle;
+                int status = bletemp_read(param->read.conn_id, chr, rsp.attr_value.value,
+                                          sizeof(rsp.attr_value.value), &rsp.attr_value.len);
+
+                esp_err_t ret = esp_ble_gatts_send_response(gatts_if, param->read.conn_id, param->read.trans_id, status, &rsp);
+                if (ret){
+                    ESP_LOGE(GATTS_TABLE_TAG, "set response failed, error code = %x", ret);
                 }
             }
        	    break;
@@ -187,51 +471,35 @@ static void gatts_profile_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_
                 esp_log_buffer_hex(GATTS_TABLE_TAG, param->write.value, param->write.len);
 
                 //handle indication and notification configuration
-                if (thermometer_handle_table[IDX_CHAR_TEMP_CFG] == param->write.handle && param->write.len == 2){
+                chr = chr_from_handle(param->write.handle, true);
+                if (chr >= 0 && param->write.len == 2){
                     uint16_t descr_value = param->write.value[1]<<8 | param->write.value[0];
-                    if (descr_value == 0x0001){
+                    if (descr_value == BLETEMP_SUB_NOTIFY){
                         ESP_LOGI(GATTS_TABLE_TAG, "notify enable");
-                        //the size of notify_data[] need less than MTU size
-
-                        vTaskDelay(100/portTICK_RATE_MS);
-                        send_temp_update();
-                        
-                        xTaskNotify( xHandle, 0x01, eSetValueWithOverwrite );
-//                        vTaskResume(xHandle); //don't use since it can stop withing a critical section => deadlock
-
-                    /*
-                    }else if (descr_value == 0x0002){
+                        bletemp_on_subscribe(param->write.conn_id, chr, descr_value);
+                    }else if ((descr_value & BLETEMP_SUB_INDICATE) && !(descr_value & ~(BLETEMP_SUB_NOTIFY | BLETEMP_SUB_INDICATE))){
+                        //indications win when both are set
                         ESP_LOGI(GATTS_TABLE_TAG, "indicate enable");
-                        uint8_t indicate_data[15];
-                        for (int i = 0; i < sizeof(indicate_data); ++i)
-                        {
-                            indicate_data[i] = i % 0xff;
-                        }
-                        //the size of indicate_data[] need less than MTU size
-                        esp_ble_gatts_send_indicate(gatts_if, param->write.conn_id, thermometer_handle_table[IDX_CHAR_TEMP_VAL],
-                                            sizeof(indicate_data), indicate_data, true);
-                    }*/
+                        bletemp_on_subscribe(param->write.conn_id, chr, descr_value);
                     }else if (descr_value == 0x0000){
                         ESP_LOGI(GATTS_TABLE_TAG, "notify/indicate disable ");
-                        xTaskNotify( xHandle, 0x00, eSetValueWithOverwrite );
-//                        vTaskSuspend(xHandle);
+                        bletemp_on_subscribe(param->write.conn_id, chr, 0);
                     }else{
                         ESP_LOGE(GATTS_TABLE_TAG, "unknown descr value");
                         esp_log_buffer_hex(GATTS_TABLE_TAG, param->write.value, param->write.len);
                     }
 
-                //handle UNIT write
-                } else if (thermometer_handle_table[IDX_CHAR_UNIT_VAL] == param->write.handle && param->write.len == 1){
-                    uint8_t requnit = (param->write.value[0] == 'F') ? 'F' : 'C';
-                    if (requnit != unit_char_value) {
-                        //unit changed
-                        unit_char_value = requnit;
-                        send_temp_update();
+                //handle writes to the core characteristics
+                } else if ((chr = chr_from_handle(param->write.handle, false)) >= 0){
+                    status = bletemp_write(param->write.conn_id, chr, param->write.value, param->write.len);
+                    /* temperatures now go out in the new unit */
+                    if (chr == BLETEMP_CHR_UNIT && status == 0) {
+                        gatts_fmt_refresh();
                     }
                 }
                 /* send response when param->write.need_rsp is true*/
                 if (param->write.need_rsp){
-                    esp_ble_gatts_send_response(gatts_if, param->write.conn_id, param->write.trans_id, ESP_GATT_OK, NULL);
+                    esp_ble_gatts_send_response(gatts_if, param->write.conn_id, param->write.trans_id, status, NULL);
                 }
             }else{
                 /* prepare write not supported */
@@ -244,9 +512,41 @@ static void gatts_profile_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_
             break;
         case ESP_GATTS_MTU_EVT:
             ESP_LOGI(GATTS_TABLE_TAG, "ESP_GATTS_MTU_EVT, MTU %d", param->mtu.mtu);
+            bletemp_on_mtu(param->mtu.conn_id, param->mtu.mtu);
             break;
         case ESP_GATTS_CONF_EVT:
             ESP_LOGI(GATTS_TABLE_TAG, "ESP_GATTS_CONF_EVT, status = %d, attr_handle %d", param->conf.status, param->conf.handle);
+            if (param->conf.conn_id < BLETEMP_MAX_CONN) {
+                bool confirmed;
+
+                bletemp_port_lock();
+                if (param->conf.status != ESP_GATT_OK) {
+                    peers[param->conf.conn_id].dropped++;
+                }
+                /* notifications report here as well, once sent */
+                confirmed = param->conf.handle != 0 &&
+                            param->conf.handle == peers[param->conf.conn_id].confirm_handle;
+                if (confirmed) {
+                    peers[param->conf.conn_id].confirm_handle = 0;
+                }
+                bletemp_port_unlock();
+
+                chr = chr_from_handle(param->conf.handle, false);
+                if (confirmed && chr >= 0) {
+                    bletemp_on_confirm(param->conf.conn_id, chr, param->conf.status);
+                }
+            }
+            /* one left the queue, retry anything the stack refused before */
+            gatts_flush(param->conf.conn_id);
+            break;
+        case ESP_GATTS_CONGEST_EVT:
+            ESP_LOGI(GATTS_TABLE_TAG, "ESP_GATTS_CONGEST_EVT, conn_id %d, congested %d", param->congest.conn_id, param->congest.congested);
+            if (param->congest.conn_id < BLETEMP_MAX_CONN) {
+                bletemp_port_lock();
+                peers[param->congest.conn_id].congested = param->congest.congested;
+                bletemp_port_unlock();
+                gatts_flush(param->congest.conn_id);
+            }
             break;
         case ESP_GATTS_START_EVT:
             ESP_LOGI(GATTS_TABLE_TAG, "SERVICE_START_EVT, status %d, service_handle %d", param->start.status, param->start.service_handle);
@@ -254,33 +554,39 @@ static void gatts_profile_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_
         case ESP_GATTS_CONNECT_EVT:
             ESP_LOGI(GATTS_TABLE_TAG, "ESP_GATTS_CONNECT_EVT, conn_id = %d", param->connect.conn_id);
             esp_log_buffer_hex(GATTS_TABLE_TAG, param->connect.remote_bda, 6);
-            esp_ble_conn_update_params_t conn_params = {0};
-            memcpy(conn_params.bda, param->connect.remote_bda, sizeof(esp_bd_addr_t));
-            /* For the iOS system, please refer to Apple official documents about the BLE connection parameters restrictions. */
-            conn_params.latency = 0;
-            conn_params.max_int = 0x20;    // max_int = 0x20*1.25ms = 40ms
-            conn_params.min_int = 0x10;    // min_int = 0x10*1.25ms = 20ms
-            conn_params.timeout = 400;    // timeout = 400*10ms = 4000ms
-            //start sent the update connection parameters to the peer device.
-            esp_ble_gap_update_conn_params(&conn_params);
+            peer_add(param->connect.conn_id, param->connect.remote_bda);
+            bletemp_on_connect(param->connect.conn_id);
+            /* the parameter policy requests an update once the central subscribes */
+            bletemp_on_conn_params(param->connect.conn_id, param->connect.conn_params.interval,
+                                   param->connect.conn_params.latency, param->connect.conn_params.timeout);
+            gatts_link_setup(param->connect.conn_id, param->connect.remote_bda);
+            gatts_mem_report("connect");
+            /* keep advertising while connection slots remain */
+            if (bletemp_conn_count() < BLETEMP_MAX_CONN) {
+                esp_ble_gap_start_advertising(&adv_params);
+            }
             break;
         case ESP_GATTS_DISCONNECT_EVT:
             ESP_LOGI(GATTS_TABLE_TAG, "ESP_GATTS_DISCONNECT_EVT, reason = 0x%x", param->disconnect.reason);
-            xTaskNotify( xHandle, 0x00, eSetValueWithOverwrite );
-//            vTaskSuspend(xHandle);
-            esp_ble_gap_start_advertising(&adv_params);
+            bletemp_on_disconnect(param->disconnect.conn_id);
+            peer_remove(param->disconnect.conn_id);
+            if (bletemp_conn_count() < BLETEMP_MAX_CONN) {
+                esp_ble_gap_start_advertising(&adv_params);
+            }
             break;
         case ESP_GATTS_CREAT_ATTR_TAB_EVT:{
             if (param->add_attr_tab.status != ESP_GATT_OK){
                 ESP_LOGE(GATTS_TABLE_TAG, "create attribute table failed, error code=0x%x", param->add_attr_tab.status);
             }
-            else if (param->add_attr_tab.num_handle != IDX_SVC_END){
+            else if (param->add_attr_tab.num_handle != gatt_db_len){
                 ESP_LOGE(GATTS_TABLE_TAG, "create attribute table abnormally, num_handle (%d) \
-                        doesn't equal to SVC_IDX_NB(%d)", param->add_attr_tab.num_handle, IDX_SVC_END);
+                        doesn't equal to SVC_IDX_NB(%d)", param->add_attr_tab.num_handle, gatt_db_len);
             }
             else {
                 ESP_LOGI(GATTS_TABLE_TAG, "create attribute table successfully, the number handle = %d\n",param->add_attr_tab.num_handle);
-                memcpy(thermometer_handle_table, param->add_attr_tab.handles, sizeof(thermometer_handle_table));
+                memcpy(thermometer_handle_table, param->add_attr_tab.handles,
+                       gatt_db_len * sizeof(thermometer_handle_table[0]));
+                chr_map_build();
                 esp_ble_gatts_start_service(thermometer_handle_table[IDX_SVC]);
             }
             break;
@@ -290,7 +596,6 @@ static void gatts_profile_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_
         case ESP_GATTS_CANCEL_OPEN_EVT:
         case ESP_GATTS_CLOSE_EVT:
         case ESP_GATTS_LISTEN_EVT:
-        case ESP_GATTS_CONGEST_EVT:
         case ESP_GATTS_UNREG_EVT:
         case ESP_GATTS_DELETE_EVT:
         default:
@@ -330,10 +635,37 @@ void app_main(void)
 {
     esp_err_t ret;
 
-    xSemaphore = xSemaphoreCreateMutex();
-    xTaskCreate(&periodic_task, "ble_task", 2048, NULL, 5, &xHandle);
+    bletemp_init(&gatts_transport);
+    /* no-op unless CONFIG_BLETEMP_POWER_SAVE is set */
+    bletemp_pm_init();
+    /*
+     * The controller and Bluedroid are pinned to core 0 (sdkconfig.defaults),
+     * sampling, filtering and logging to CONFIG_BLETEMP_APP_CORE. Publishing
+     * encodes per connection, so it runs next to the BTC task that owns the
+     * connection table and the port lock stays on that core. The sampler
+     * takes no lock: samples reach the publishing task through the
+     * lock-free history ring and a task notification, and the flash log is
+     * read through its sequence count.
+     */
+    xTaskCreatePinnedToCore(&periodic_task, "ble_task", CONFIG_BLETEMP_PUBLISH_STACK_SIZE, NULL, 5,
+                            &xHandle, CONFIG_BT_BLUEDROID_PINNED_TO_CORE);
 //    vTaskSuspend( xHandle );
 
+    /* Keep every sample on flash as well, also while no central is connected */
+    if (temp_log_init(temp_log_partition("templog")) != 0) {
+        ESP_LOGW(GATTS_TABLE_TAG, "sample log disabled");
+    }
+
+    /* Sampling runs in its own task, independent of BLE activity */
+    if (temp_sampler_start(bletemp_interval(), on_sample)) {
+        ESP_LOGE(GATTS_TABLE_TAG, "%s start sampler failed", __func__);
+        return;
+    }
+    /* no-op unless CONFIG_BLETEMP_TASK_LOAD is set */
+    bletemp_load_start();
+    /* no-op unless CONFIG_BLETEMP_CONVERT_CYCLES is set */
+    temp_convert_cycles_log();
+
 
     ESP_LOGI(GATTS_TABLE_TAG, "Adv data len: %d, Scan resp data len: %d", ESP_BLE_ADV_DATA_LEN_MAX, ESP_BLE_SCAN_RSP_DATA_LEN_MAX); 
 
@@ -395,4 +727,6 @@ void app_main(void)
         ESP_LOGE(GATTS_TABLE_TAG, "set local  MTU failed, error code = %x", local_mtu_ret);
     }
 
+    gatts_mem_report("boot");
+
 }
@@ -1,90 +1,117 @@
 #define DEVICE_NAME          "Thermometer"
 
-/* Attributes State Machine */
-enum
-{
-    IDX_SVC,
-    IDX_CHAR_TEMP,
-    IDX_CHAR_TEMP_VAL,
-    IDX_CHAR_TEMP_CFG,
-    IDX_CHAR_TEMP_FMT,
+/*
+ * The attribute table is generated at registration from the service
+ * description in bletemp_gatt.h: a declaration and a value for every
+ * characteristic, then a CCCD when it can be notified or indicated and
+ * the user description, presentation format and valid range it lists.
+ * Values are answered by the core, descriptors by the stack.
+ */
+#define IDX_SVC         0
+#define GATT_DB_MAX     BLETEMP_GATT_MAP_MAX
 
-    IDX_CHAR_UNIT,
-    IDX_CHAR_UNIT_VAL,
+static esp_gatts_attr_db_t gatt_db[GATT_DB_MAX];
+static uint8_t gatt_db_len;
 
-    IDX_SVC_END,
-};
-
-/* Data */
-typedef struct {
-    uint16_t temperature;
-    uint8_t unit;
-} __attribute__ ((packed)) temp_struct;
-
-static temp_struct temp_char_value    = {0, 'C'};
-static uint8_t unit_char_value   = {'C'};
+/* Characteristic value and CCCD of each core characteristic (0 when absent) */
+static uint8_t chr_val_idx[BLETEMP_CHR_COUNT];
+static uint8_t chr_cfg_idx[BLETEMP_CHR_COUNT];
+static uint8_t chr_fmt_idx[BLETEMP_CHR_COUNT];
 
 
 /* Service */
 static const uint8_t  GATTS_SERVICE_UUID[16]    = {0x03,0x00,0x13,0xAC,0x42,0x02,0xCD,0x8D,0xEB,0x11,0x3E,0x8E,0x56,0xF6,0x41,0x99};
-static const uint16_t GATTS_CHAR_UUID_TEMP      = 0x2A6E;
-static const uint8_t  GATTS_CHAR_UUID_UNIT[16]  = {0x03,0x00,0x13,0xAC,0x42,0x02,0xCD,0x8D,0xEB,0x11,0x3E,0x8E,0x38,0xFB,0x41,0x99};
 
+/* Characteristic UUIDs and declarations, little endian as the stack wants them */
+static uint8_t chr_uuid[BLETEMP_CHR_COUNT][ESP_UUID_LEN_128];
+static uint8_t chr_prop[BLETEMP_CHR_COUNT];
 
 static const uint16_t primary_service_uuid         = ESP_GATT_UUID_PRI_SERVICE; 
 static const uint16_t character_declaration_uuid   = ESP_GATT_UUID_CHAR_DECLARE;
 static const uint16_t character_format_uuid        = ESP_GATT_UUID_CHAR_PRESENT_FORMAT;
 static const uint16_t character_client_config_uuid = ESP_GATT_UUID_CHAR_CLIENT_CONFIG;
-//static const uint8_t char_prop_read                = ESP_GATT_CHAR_PROP_BIT_READ;
-static const uint8_t char_prop_read_write          = ESP_GATT_CHAR_PROP_BIT_READ | ESP_GATT_CHAR_PROP_BIT_WRITE;
-static const uint8_t char_prop_read_notify         = ESP_GATT_CHAR_PROP_BIT_READ | ESP_GATT_CHAR_PROP_BIT_NOTIFY;
-static const uint8_t temperature_desc_ccc[2]      = {0x00, 0x00};
-static const uint8_t temperature_desc_fmt[7]      = {0x0E, 0xFE, //signed 16-bit
-                                                      0x2F, 0x27, //GATT Unit, temperature celsius 0x272F,  
-                                                     //#0xAC, 0x27, #GATT Unit,0x27AC thermodynamic temperature (degree Fahrenheit)
-                                                     0x01, 0x00, 0x00};
-
-/* Full Database Description - Used to add attributes into the database */
-static const esp_gatts_attr_db_t gatt_db[IDX_SVC_END] =
-{
-    // Service Declaration
-    [IDX_SVC]        =
-    {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16, (uint8_t *)&primary_service_uuid, ESP_GATT_PERM_READ,
-      sizeof(uint16_t), sizeof(GATTS_SERVICE_UUID), (uint8_t *)&GATTS_SERVICE_UUID}},
-
-    /* Characteristic Declaration */
-    [IDX_CHAR_TEMP]     =
-    {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16, (uint8_t *)&character_declaration_uuid, ESP_GATT_PERM_READ,
-      sizeof(uint8_t),  sizeof(uint8_t), (uint8_t *)&char_prop_read_notify}},
-
-    /* Characteristic Value */
-    [IDX_CHAR_TEMP_VAL] =
-    //a) response sent by APP
-    {{ESP_GATT_RSP_BY_APP}, {ESP_UUID_LEN_16, (uint8_t *)&GATTS_CHAR_UUID_TEMP, ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE,
-    //b) response sent automatically
-//    {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16, (uint8_t *)&GATTS_CHAR_UUID_TEMP, ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE,
-      sizeof(temp_char_value) /* max data length */, sizeof(temp_char_value) /* current length */, (uint8_t *)&temp_char_value}},
-
-    /* Client Characteristic Configuration Descriptor */
-    [IDX_CHAR_TEMP_CFG]  =
-    {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16, (uint8_t *)&character_client_config_uuid, ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE,
-      sizeof(uint16_t), sizeof(temperature_desc_ccc), (uint8_t *)temperature_desc_ccc}},
-
-    [IDX_CHAR_TEMP_FMT]  =
-    {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16, (uint8_t *)&character_format_uuid, ESP_GATT_PERM_READ,
-      sizeof(temperature_desc_fmt), sizeof(temperature_desc_fmt), (uint8_t *)temperature_desc_fmt}},
-
-    /* Characteristic Declaration */
-    [IDX_CHAR_UNIT]      =
-    {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16, (uint8_t *)&character_declaration_uuid, ESP_GATT_PERM_READ,
-      sizeof(uint8_t),  sizeof(uint8_t), (uint8_t *)&char_prop_read_write}},
-
-    /* Characteristic Value */
-    [IDX_CHAR_UNIT_VAL]  =
-    {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_128, (uint8_t *)&GATTS_CHAR_UUID_UNIT, ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE,
-      sizeof(unit_char_value) /* max data length */, sizeof(unit_char_value) /* current length */, (uint8_t *)&unit_char_value}},
-
-};
-
-
-uint16_t thermometer_handle_table[IDX_SVC_END];
+static const uint16_t character_description_uuid   = ESP_GATT_UUID_CHAR_DESCRIPTION;
+static const uint16_t character_range_uuid         = ESP_GATT_UUID_CHAR_VALID_RANGE;
+static const uint8_t  desc_ccc[2]                  = {0x00, 0x00};
+
+static uint8_t gatt_db_add(uint8_t rsp, uint16_t uuid_len, const void *uuid, uint16_t perm,
+                           uint16_t max_len, uint16_t len, const void *value) {
+    esp_gatts_attr_db_t *attr = &gatt_db[gatt_db_len];
+
+    attr->attr_control.auto_rsp = rsp;
+    attr->att_desc.uuid_length = uuid_len;
+    attr->att_desc.uuid_p = (uint8_t *)uuid;
+    attr->att_desc.perm = perm;
+    attr->att_desc.max_length = max_len;
+    attr->att_desc.length = len;
+    attr->att_desc.value = (uint8_t *)value;
+    return gatt_db_len++;
+}
+
+static void gatt_db_build(void) {
+    const struct bletemp_gatt_chr *def;
+    uint16_t perm;
+
+    gatt_db_len = 0;
+    gatt_db_add(ESP_GATT_AUTO_RSP, ESP_UUID_LEN_16, &primary_service_uuid, ESP_GATT_PERM_READ,
+                sizeof(uint16_t), sizeof(GATTS_SERVICE_UUID), GATTS_SERVICE_UUID);
+
+    for (int chr = 0; chr < BLETEMP_CHR_COUNT; chr++) {
+        def = &bletemp_gatt_chrs[chr];
+
+        chr_prop[chr] = 0;
+        perm = 0;
+        if (def->flags & BLETEMP_GATT_F_READ) {
+            chr_prop[chr] |= ESP_GATT_CHAR_PROP_BIT_READ;
+            perm |= ESP_GATT_PERM_READ;
+        }
+        if (def->flags & BLETEMP_GATT_F_WRITE) {
+            chr_prop[chr] |= ESP_GATT_CHAR_PROP_BIT_WRITE;
+            perm |= ESP_GATT_PERM_WRITE;
+        }
+        if (def->flags & BLETEMP_GATT_F_NOTIFY) {
+            chr_prop[chr] |= ESP_GATT_CHAR_PROP_BIT_NOTIFY;
+        }
+        if (def->flags & BLETEMP_GATT_F_INDICATE) {
+            chr_prop[chr] |= ESP_GATT_CHAR_PROP_BIT_INDICATE;
+        }
+        gatt_db_add(ESP_GATT_AUTO_RSP, ESP_UUID_LEN_16, &character_declaration_uuid, ESP_GATT_PERM_READ,
+                    sizeof(uint8_t), sizeof(uint8_t), &chr_prop[chr]);
+
+        /* Characteristic Value, read and written through the core */
+        if (def->uuid > 0xFFFF) {
+            bletemp_gatt_uuid128(def->uuid, chr_uuid[chr]);
+            chr_val_idx[chr] = gatt_db_add(ESP_GATT_RSP_BY_APP, ESP_UUID_LEN_128, chr_uuid[chr], perm,
+                                           def->max_len, 0, NULL);
+        } else {
+            chr_uuid[chr][0] = def->uuid & 0xFF;
+            chr_uuid[chr][1] = def->uuid >> 8;
+            chr_val_idx[chr] = gatt_db_add(ESP_GATT_RSP_BY_APP, ESP_UUID_LEN_16, chr_uuid[chr], perm,
+                                           def->max_len, 0, NULL);
+        }
+
+        chr_cfg_idx[chr] = 0;
+        if (def->flags & (BLETEMP_GATT_F_NOTIFY | BLETEMP_GATT_F_INDICATE)) {
+            chr_cfg_idx[chr] = gatt_db_add(ESP_GATT_AUTO_RSP, ESP_UUID_LEN_16, &character_client_config_uuid,
+                                           ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE,
+                                           sizeof(uint16_t), sizeof(desc_ccc), desc_ccc);
+        }
+        if (def->desc != NULL) {
+            gatt_db_add(ESP_GATT_AUTO_RSP, ESP_UUID_LEN_16, &character_description_uuid, ESP_GATT_PERM_READ,
+                        strlen(def->desc), strlen(def->desc), def->desc);
+        }
+        chr_fmt_idx[chr] = 0;
+        if (def->fmt != NULL) {
+            chr_fmt_idx[chr] = gatt_db_add(ESP_GATT_AUTO_RSP, ESP_UUID_LEN_16, &character_format_uuid,
+                                           ESP_GATT_PERM_READ, BLETEMP_GATT_FMT_LEN, BLETEMP_GATT_FMT_LEN,
+                                           def->fmt);
+        }
+        if (def->range != NULL) {
+            gatt_db_add(ESP_GATT_AUTO_RSP, ESP_UUID_LEN_16, &character_range_uuid, ESP_GATT_PERM_READ,
+                        def->range->len, def->range->len, def->range->data);
+        }
+    }
+}
+
+
+uint16_t thermometer_handle_table[GATT_DB_MAX];
@@ -10,6 +10,7 @@ import (
 	"io/ioutil"
 	"strconv"
 	"strings"
+	"sync/atomic"
 	"math/rand"
 )
 
@@ -18,6 +19,12 @@ type packet struct {
 	unit uint8
 }
 
+// Bounds of the measurement interval characteristic, in milliseconds
+const (
+	intervalMin = 50
+	intervalMax = 60000
+)
+
 func getTemperature() float64 {
 	path := "/sys/class/thermal/thermal_zone0/temp"
 	raw, err := ioutil.ReadFile(path)
@@ -40,31 +47,38 @@ func getTemperature() float64 {
 
 func NewThermometerService() *gatt.Service {
 	s := gatt.NewService(gatt.MustParseUUID("9941f656-8e3e-11eb-8dcd-0242ac130003"))
-	unit := "C"
+	// "C" or "F"; shared between the GATT handlers and the notify goroutine
+	var unit atomic.Value
+	unit.Store("C")
 	unitchanged := make(chan bool, 1)
+	// milliseconds; written by the GATT handler, read by the notify goroutine
+	interval := uint32(2000)
+	intervalchanged := make(chan bool, 1)
 
 	sendTempPacket := func (w io.Writer) error {
 
+		u := unit.Load().(string)
 		temp := getTemperature()
-		if unit == "F" {
+		if u == "F" {
 			temp = (temp * 1.8) + 32.0
 		}
 
-		return binary.Write(w, binary.LittleEndian, packet{int16(temp*100), uint8(unit[0])})
+		return binary.Write(w, binary.LittleEndian, packet{int16(temp*100), uint8(u[0])})
 	}
 
 	//Temperature characteristic
 	c := s.AddCharacteristic(gatt.UUID16(0x2A6E))
 	c.HandleNotifyFunc(
 		func(r gatt.Request, n gatt.Notifier) {
-			// start a timer event which calls the update callback ever 2 seconds
+			// start a timer event which calls the update callback every interval
 			for !n.Done() {
 				if err := sendTempPacket(n); err != nil {
 					log.Fatal("Write failed")
 				}
 				select {
 					case _ = <- unitchanged:
-					case <-time.After(2 * time.Second):
+					case _ = <- intervalchanged:
+					case <-time.After(time.Duration(atomic.LoadUint32(&interval)) * time.Millisecond):
 				}
 			}
 		})	
@@ -91,9 +105,9 @@ func NewThermometerService() *gatt.Service {
 				newunit = "F"
 			}
 
-			if newunit != unit {
-				unit = newunit
-				log.Println("change unit to:", unit)
+			if unit.Load().(string) != newunit {
+				unit.Store(newunit)
+				log.Println("change unit to:", newunit)
 				unitchanged <- true
 			}
 
@@ -102,10 +116,48 @@ func NewThermometerService() *gatt.Service {
 
 	c.HandleReadFunc(
 		func(rsp gatt.ResponseWriter, req *gatt.ReadRequest) {
-			rsp.Write([]byte(unit))
+			rsp.Write([]byte(unit.Load().(string)))
 		})
 
 	c.AddDescriptor(gatt.UUID16(0x2901)).SetValue([]byte("Temperature Units (F or C)"))
 
+	//Measurement interval characteristic, uint16 little-endian milliseconds
+	c = s.AddCharacteristic(gatt.MustParseUUID("9941fc80-8e3e-11eb-8dcd-0242ac130003"))
+
+	c.HandleWriteFunc(
+		func(r gatt.Request, data []byte) (status byte) {
+			if len(data) != 2 {
+				return gatt.StatusUnexpectedError
+			}
+
+			ms := binary.LittleEndian.Uint16(data)
+			if ms < intervalMin || ms > intervalMax {
+				return gatt.StatusUnexpectedError
+			}
+
+			if atomic.SwapUint32(&interval, uint32(ms)) != uint32(ms) {
+				log.Println("change interval to:", ms, "ms")
+				select {
+					case intervalchanged <- true:
+					default:
+				}
+			}
+
+			return gatt.StatusSuccess
+		})
+
+	c.HandleReadFunc(
+		func(rsp gatt.ResponseWriter, req *gatt.ReadRequest) {
+			binary.Write(rsp, binary.LittleEndian, uint16(atomic.LoadUint32(&interval)))
+		})
+
+	c.AddDescriptor(gatt.UUID16(0x2901)).SetValue([]byte("Measurement interval (ms)"))
+	c.AddDescriptor(gatt.UUID16(0x2904)).SetValue([]byte{ 0x06, 0xFD, //unsigned 16-bit, milliseconds
+		0x03, 0x27, //GATT Unit, time second 0x2703
+		0x01, 0x00, 0x00})
+	c.AddDescriptor(gatt.UUID16(0x2906)).SetValue([]byte{
+		intervalMin & 0xFF, intervalMin >> 8,
+		intervalMax & 0xFF, intervalMax >> 8})
+
 	return s
 }
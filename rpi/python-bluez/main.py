@@ -1,7 +1,7 @@
 import dbus, struct
 
 from bluezbledbus.advertisement import Advertisement
-from bluezbledbus.ble import Application, Service, Characteristic, Descriptor
+from bluezbledbus.ble import Application, Service, Characteristic, Descriptor, InvalidArgsException
 from bluezbledbus.bletools import struct_to_list
 
 try:
@@ -14,16 +14,22 @@ except:
 
 GATT_CHRC_IFACE = "org.bluez.GattCharacteristic1"
 NOTIFY_TIMEOUT = 5000
+# Bounds of the measurement interval characteristic, in milliseconds
+NOTIFY_TIMEOUT_MIN = 50
+NOTIFY_TIMEOUT_MAX = 60000
 
 class ThermometerService(Service):
     THERMOMETER_SVC_UUID = "9941f656-8e3e-11eb-8dcd-0242ac130003"
 
     def __init__(self, index):
         self.farenheit = True
+        self.interval = NOTIFY_TIMEOUT
 
         Service.__init__(self, index, self.THERMOMETER_SVC_UUID, True)
-        self.add_characteristic(TempCharacteristic(self))
+        self.temp = TempCharacteristic(self)
+        self.add_characteristic(self.temp)
         self.add_characteristic(UnitCharacteristic(self))
+        self.add_characteristic(IntervalCharacteristic(self))
 
     def is_farenheit(self):
         return self.farenheit
@@ -31,6 +37,14 @@ class ThermometerService(Service):
     def set_farenheit(self, farenheit):
         self.farenheit = farenheit
 
+    def get_interval(self):
+        return self.interval
+
+    def set_interval(self, interval):
+        if interval != self.interval:
+            self.interval = interval
+            self.temp.restart_timer()
+
 
 class ThermometerAdvertisement(Advertisement):
     def __init__(self, index):
@@ -49,6 +63,7 @@ class TempCharacteristic(Characteristic):
 
     def __init__(self, service):
         self.notifying = False
+        self.timer = 0
 
         Characteristic.__init__(
                 self, self.TEMP_CHARACTERISTIC_UUID,
@@ -73,6 +88,14 @@ class TempCharacteristic(Characteristic):
 
         return self.notifying
 
+    def restart_timer(self):
+        # a timer left over from an earlier interval stops at its next tick
+        self.timer += 1
+        timer = self.timer
+        if self.notifying:
+            self.add_timeout(self.service.get_interval(),
+                    lambda: timer == self.timer and self.set_temperature_callback())
+
     def StartNotify(self):
         if self.notifying:
             return
@@ -81,7 +104,7 @@ class TempCharacteristic(Characteristic):
 
         value = self.get_temperature()
         self.PropertiesChanged(GATT_CHRC_IFACE, {"Value": value}, [])
-        self.add_timeout(NOTIFY_TIMEOUT, self.set_temperature_callback)
+        self.restart_timer()
 
     def StopNotify(self):
         self.notifying = False
@@ -154,6 +177,47 @@ class UnitDescriptor(Descriptor):
 
         return value
 
+class IntervalCharacteristic(Characteristic):
+    INTERVAL_CHARACTERISTIC_UUID = "9941fc80-8e3e-11eb-8dcd-0242ac130003"
+
+    def __init__(self, service):
+        Characteristic.__init__(
+                self, self.INTERVAL_CHARACTERISTIC_UUID,
+                ["read", "write"], service)
+        self.add_descriptor(IntervalDescriptor(self))
+
+    def WriteValue(self, value, options):
+        if len(value) != 2:
+            raise InvalidArgsException()
+
+        interval = int(value[0]) | (int(value[1]) << 8)
+        if interval < NOTIFY_TIMEOUT_MIN or interval > NOTIFY_TIMEOUT_MAX:
+            raise InvalidArgsException()
+
+        self.service.set_interval(interval)
+
+    def ReadValue(self, options):
+        return struct_to_list('<H', self.service.get_interval())
+
+class IntervalDescriptor(Descriptor):
+    INTERVAL_DESCRIPTOR_UUID = "2901"
+    INTERVAL_DESCRIPTOR_VALUE = "Measurement interval (ms)"
+
+    def __init__(self, characteristic):
+        Descriptor.__init__(
+                self, self.INTERVAL_DESCRIPTOR_UUID,
+                ["read"],
+                characteristic)
+
+    def ReadValue(self, options):
+        value = []
+        desc = self.INTERVAL_DESCRIPTOR_VALUE
+
+        for c in desc:
+            value.append(dbus.Byte(c.encode()))
+
+        return value
+
 app = Application()
 app.add_service(ThermometerService(0))
 app.register()